@@ -0,0 +1,480 @@
+#include "matrix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <utility>
+
+#include "gemm.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Products accumulate a panel of kMulCols columns of the result from
+// kMulDepth rows of the second operand at a time, both stay in cache
+constexpr size_t kMulCols = 512;
+constexpr size_t kMulDepth = 128;
+
+template <typename T>
+using IsExact = std::is_integral<T>;
+
+// Fraction-free Gaussian elimination (Bareiss): every intermediate entry
+// is a minor of the input, so the divisions are exact and integer
+// determinants never round. a is n x n row-major and is destroyed.
+template <typename T>
+T bareissDeterminant(std::vector<T> a, size_t n) {
+  T sign = 1, previous = 1;
+  for (size_t k = 0; k != n; ++k) {
+    if (a[k * n + k] == T(0)) {
+      size_t pivot = k + 1;
+      while (pivot != n && a[pivot * n + k] == T(0)) ++pivot;
+      if (pivot == n) return 0;
+      std::swap_ranges(a.begin() + k * n, a.begin() + (k + 1) * n,
+                       a.begin() + pivot * n);
+      sign = -sign;
+    }
+    for (size_t i = k + 1; i != n; ++i) {
+      for (size_t j = k + 1; j != n; ++j)
+        a[i * n + j] = (a[i * n + j] * a[k * n + k] -
+                        a[i * n + k] * a[k * n + j]) /
+                       previous;
+      a[i * n + k] = 0;
+    }
+    previous = a[k * n + k];
+  }
+  return n ? sign * a[n * n - 1] : T(1);
+}
+
+// Gaussian elimination with partial pivoting on the magnitude
+template <typename T>
+T pivotingDeterminant(std::vector<T> a, size_t n) {
+  T result = 1;
+  for (size_t k = 0; k != n; ++k) {
+    size_t pivot = k;
+    for (size_t i = k + 1; i != n; ++i)
+      if (std::abs(a[i * n + k]) > std::abs(a[pivot * n + k])) pivot = i;
+    if (a[pivot * n + k] == T(0)) return 0;
+    if (pivot != k) {
+      std::swap_ranges(a.begin() + k * n, a.begin() + (k + 1) * n,
+                       a.begin() + pivot * n);
+      result = -result;
+    }
+    result *= a[k * n + k];
+    for (size_t i = k + 1; i != n; ++i) {
+      T factor = a[i * n + k] / a[k * n + k];
+      for (size_t j = k + 1; j != n; ++j) a[i * n + j] -= factor * a[k * n + j];
+    }
+  }
+  return result;
+}
+
+// Fraction-free Gauss-Jordan on [A | I], Bareiss' divisions stay exact
+// here too. The row operations take A to d * I, d = +-det(A) from the
+// swaps, and so take I to d * A^-1 = +-adj(A). a is n x n row-major;
+// returns false, leaving adjugate unset, when A is singular.
+template <typename T>
+bool bareissAdjugate(const std::vector<T>& a, size_t n,
+                     std::vector<T>& adjugate) {
+  const size_t w = 2 * n;
+  std::vector<T> m(n * w, T(0));
+  for (size_t i = 0; i != n; ++i) {
+    std::copy_n(a.begin() + i * n, n, m.begin() + i * w);
+    m[i * w + n + i] = 1;
+  }
+  T sign = 1, previous = 1;
+  for (size_t k = 0; k != n; ++k) {
+    if (m[k * w + k] == T(0)) {
+      size_t pivot = k + 1;
+      while (pivot != n && m[pivot * w + k] == T(0)) ++pivot;
+      if (pivot == n) return false;
+      std::swap_ranges(m.begin() + k * w, m.begin() + (k + 1) * w,
+                       m.begin() + pivot * w);
+      sign = -sign;
+    }
+    // Columns before k hold previous on the diagonal and zeros elsewhere,
+    // only the diagonal would change and it is never read again
+    const T pivot = m[k * w + k];
+    for (size_t i = 0; i != n; ++i) {
+      if (i == k) continue;
+      const T factor = m[i * w + k];
+      for (size_t j = k + 1; j != w; ++j)
+        m[i * w + j] = (m[i * w + j] * pivot - factor * m[k * w + j]) /
+                       previous;
+      m[i * w + k] = 0;
+    }
+    previous = pivot;
+  }
+  adjugate.resize(n * n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      adjugate[i * n + j] = sign * m[i * w + n + j];
+  return true;
+}
+
+// Gaussian elimination with complete pivoting, stopped after n - 1 steps
+// or at the first step left without a nonzero pivot; fraction-free for
+// exact types, on the largest magnitude otherwise. Returns the number of
+// steps, which is min(rank, n - 1), and permutes rows and cols alike so
+// that the first steps entries index the pivots in A. a is n x n
+// row-major and is destroyed.
+template <typename T>
+size_t eliminate(std::vector<T> a, size_t n, std::vector<size_t>& rows,
+                 std::vector<size_t>& cols) {
+  T previous = 1;
+  for (size_t k = 0; k + 1 < n; ++k) {
+    size_t p = k, q = k;
+    for (size_t i = k; i != n; ++i)
+      for (size_t j = k; j != n; ++j) {
+        bool better = IsExact<T>::value
+                          ? a[p * n + q] == T(0) && a[i * n + j] != T(0)
+                          : std::abs(a[i * n + j]) > std::abs(a[p * n + q]);
+        if (better) p = i, q = j;
+      }
+    if (a[p * n + q] == T(0)) return k;
+    std::swap_ranges(a.begin() + k * n, a.begin() + (k + 1) * n,
+                     a.begin() + p * n);
+    for (size_t i = 0; i != n; ++i) std::swap(a[i * n + k], a[i * n + q]);
+    std::swap(rows[k], rows[p]);
+    std::swap(cols[k], cols[q]);
+    const T pivot = a[k * n + k];
+    for (size_t i = k + 1; i != n; ++i) {
+      const T factor = a[i * n + k];
+      for (size_t j = k + 1; j != n; ++j) {
+        if constexpr (IsExact<T>::value)
+          a[i * n + j] =
+              (a[i * n + j] * pivot - factor * a[k * n + j]) / previous;
+        else
+          a[i * n + j] -= factor / pivot * a[k * n + j];
+      }
+    }
+    previous = pivot;
+  }
+  return n ? n - 1 : 0;
+}
+
+template <typename T>
+T determinant(std::vector<T> a, size_t n) {
+  if constexpr (IsExact<T>::value)
+    return bareissDeterminant(std::move(a), n);
+  else
+    return pivotingDeterminant(std::move(a), n);
+}
+
+}  // namespace
+
+template <typename T>
+BasicMatrix<T>::BasicMatrix() : BasicMatrix(2, 2) {}
+
+template <typename T>
+BasicMatrix<T>::BasicMatrix(int rows, int cols)
+    : BasicMatrix(rows, cols, DefaultResource()) {}
+
+template <typename T>
+BasicMatrix<T>::BasicMatrix(int rows, int cols,
+                            std::pmr::memory_resource* resource)
+    : rows_(rows), cols_(cols), matrix_(rows_ * cols_, T(0), resource) {}
+
+template <typename T>
+BasicMatrix<T>::BasicMatrix(const BasicMatrix& other)
+    : rows_(other.rows_), cols_(other.cols_),
+      matrix_(other.matrix_, DefaultResource()) {}
+
+template <typename T>
+BasicMatrix<T>::BasicMatrix(BasicMatrix&& other) noexcept
+    : rows_(other.rows_), cols_(other.cols_),
+      matrix_(std::move(other.matrix_)) {
+  other.rows_ = 0;
+  other.cols_ = 0;
+  other.matrix_.clear();
+}
+
+template <typename T>
+BasicMatrix<T>& BasicMatrix<T>::operator=(const BasicMatrix& other) {
+  if (&other == this) return *this;
+  rows_ = other.rows_;
+  cols_ = other.cols_;
+  matrix_ = other.matrix_;
+  return *this;
+}
+
+// Buffers from different resources are copied by std::pmr::vector
+template <typename T>
+BasicMatrix<T>& BasicMatrix<T>::operator=(BasicMatrix&& other) noexcept {
+  if (&other == this) return *this;
+  rows_ = other.rows_;
+  cols_ = other.cols_;
+  matrix_ = std::move(other.matrix_);
+  other.rows_ = 0;
+  other.cols_ = 0;
+  other.matrix_.clear();
+  return *this;
+}
+
+template <typename T>
+T& BasicMatrix<T>::operator()(size_t i, size_t j) {
+  if (i >= rows_) throw std::out_of_range("i out greater then num rows");
+  if (j >= cols_) throw std::out_of_range("j out greater then num columns");
+  return matrix_[i * cols_ + j];
+}
+
+template <typename T>
+const T& BasicMatrix<T>::operator()(size_t i, size_t j) const {
+  if (i >= rows_) throw std::out_of_range("i out greater then num rows");
+  if (j >= cols_) throw std::out_of_range("j out greater then num columns");
+  return matrix_[i * cols_ + j];
+}
+
+template <typename T>
+BasicMatrix<T>& BasicMatrix<T>::operator+=(const BasicMatrix& other) {
+  SumMatrix(other);
+  return *this;
+}
+
+template <typename T>
+BasicMatrix<T>& BasicMatrix<T>::operator-=(const BasicMatrix& other) {
+  SubMatrix(other);
+  return *this;
+}
+
+template <typename T>
+BasicMatrix<T>& BasicMatrix<T>::operator*=(const T num) {
+  MulNumber(num);
+  return *this;
+}
+
+template <typename T>
+BasicMatrix<T>& BasicMatrix<T>::operator*=(const BasicMatrix& other) {
+  MulMatrix(other);
+  return *this;
+}
+
+template <typename T>
+size_t BasicMatrix<T>::getRows() const {
+  return rows_;
+}
+
+template <typename T>
+size_t BasicMatrix<T>::getCols() const {
+  return cols_;
+}
+
+template <typename T>
+std::pmr::memory_resource* BasicMatrix<T>::getResource() const {
+  return matrix_.get_allocator().resource();
+}
+
+template <typename T>
+void BasicMatrix<T>::setRows(const size_t& rows) {
+  if (rows == 0) cols_ = 0;
+  rows_ = rows;
+  matrix_.resize(rows_ * cols_, T(0));
+}
+
+template <typename T>
+void BasicMatrix<T>::setCols(const size_t& cols) {
+  if (cols == 0) rows_ = 0;
+  if (cols == cols_ || rows_ == 0) {
+    cols_ = cols;
+    matrix_.resize(rows_ * cols_);
+    return;
+  }
+  std::pmr::vector<T> resized(rows_ * cols, T(0), getResource());
+  size_t kept = std::min(cols, cols_);
+  for (size_t i = 0; i != rows_; ++i)
+    std::copy_n(matrix_.begin() + i * cols_, kept, resized.begin() + i * cols);
+  matrix_.swap(resized);
+  cols_ = cols;
+}
+
+template <typename T>
+void BasicMatrix<T>::SumMatrix(const BasicMatrix& other) {
+  if (rows_ != other.rows_) throw DifferentMatrixSize("rows count not equal");
+  if (cols_ != other.cols_) throw DifferentMatrixSize("cols count not equal");
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t p = first * cols_; p != last * cols_; ++p)
+      matrix_[p] += other.matrix_[p];
+  });
+}
+
+template <typename T>
+void BasicMatrix<T>::SubMatrix(const BasicMatrix& other) {
+  if (rows_ != other.rows_) throw DifferentMatrixSize("rows count not equal");
+  if (cols_ != other.cols_) throw DifferentMatrixSize("cols count not equal");
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t p = first * cols_; p != last * cols_; ++p)
+      matrix_[p] -= other.matrix_[p];
+  });
+}
+
+template <typename T>
+void BasicMatrix<T>::MulNumber(const T num) {
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t p = first * cols_; p != last * cols_; ++p) matrix_[p] *= num;
+  });
+}
+
+template <typename T>
+void BasicMatrix<T>::MulMatrix(const BasicMatrix& other) {
+  if (cols_ != other.rows_)
+    throw DifferentMatrixSize("cols first op operand not equal rows second op");
+  BasicMatrix result(rows_, other.cols_);
+  const size_t n = other.cols_;
+  if constexpr (std::is_same<T, float>::value) {
+    kernels::Gemm(rows_, n, cols_, 1.0f, matrix_.data(), cols_, 1,
+                  other.matrix_.data(), n, 1, 0.0f, result.matrix_.data(), n);
+    *this = std::move(result);
+    return;
+  }
+  ThreadPool::ParallelFor(rows_, cols_ * n, [&](size_t first, size_t last) {
+    for (size_t jj = 0; jj < n; jj += kMulCols) {
+      const size_t j_end = std::min(jj + kMulCols, n);
+      for (size_t kk = 0; kk < cols_; kk += kMulDepth) {
+        const size_t k_end = std::min(kk + kMulDepth, cols_);
+        for (size_t i = first; i != last; ++i) {
+          T* c = result.matrix_.data() + i * n;
+          const T* a = matrix_.data() + i * cols_;
+          for (size_t k = kk; k != k_end; ++k) {
+            const T* b = other.matrix_.data() + k * n;
+            const T a_ik = a[k];
+            for (size_t j = jj; j != j_end; ++j) c[j] += a_ik * b[j];
+          }
+        }
+      }
+    }
+  });
+  *this = std::move(result);
+}
+
+template <typename T>
+bool BasicMatrix<T>::EqMatrix(const BasicMatrix& other) const {
+  return rows_ == other.rows_ && cols_ == other.cols_ &&
+         matrix_ == other.matrix_;
+}
+
+template <typename T>
+BasicMatrix<T> BasicMatrix<T>::Transpose() const {
+  BasicMatrix result(cols_, rows_);
+  for (size_t i = 0; i != rows_; ++i)
+    for (size_t j = 0; j != cols_; ++j)
+      result.matrix_[j * rows_ + i] = matrix_[i * cols_ + j];
+  return result;
+}
+
+template <typename T>
+T BasicMatrix<T>::Determinant() const {
+  if (rows_ != cols_) throw NotSquare("matrix is not square");
+  return determinant(std::vector<T>(matrix_.begin(), matrix_.end()), rows_);
+}
+
+// Complements are the transposed adjugate, all in O(n^3). A nonsingular
+// matrix takes Bareiss for integers and det(A) * A^-1 for fields. For a
+// singular one, elimination with complete pivoting bounds the rank: below
+// n - 1 every minor vanishes. At rank n - 1 the complements are a
+// rank-one C = c * y * x^T, so C(i, j) = C(i, l) * C(k, j) / C(k, l) for
+// the row k and column l left without a pivot, whose minor is nonsingular.
+// Row k of C does not depend on row k of A; replacing it by e_l makes the
+// matrix nonsingular with the same row of complements, and likewise for
+// column l.
+template <typename T>
+BasicMatrix<T> BasicMatrix<T>::CalcComplements() const {
+  if (rows_ != cols_) throw NotSquare("matrix is not square");
+  const size_t n = rows_;
+  BasicMatrix result(n, n);
+  if (n == 1) {
+    result.matrix_[0] = 1;
+    return result;
+  }
+  auto nonsingular = [n](const BasicMatrix& a, BasicMatrix& complements) {
+    if constexpr (IsExact<T>::value) {
+      std::vector<T> adjugate;
+      if (!bareissAdjugate(std::vector<T>(a.matrix_.begin(), a.matrix_.end()),
+                           n, adjugate))
+        return false;
+      for (size_t i = 0; i != n; ++i)
+        for (size_t j = 0; j != n; ++j)
+          complements.matrix_[j * n + i] = adjugate[i * n + j];
+    } else {
+      const T det = a.Determinant();
+      if (det == T(0)) return false;
+      complements = a.InverseMatrix().Transpose();
+      complements.MulNumber(det);
+    }
+    return true;
+  };
+  if (nonsingular(*this, result)) return result;
+  std::vector<size_t> rows(n), cols(n);
+  for (size_t i = 0; i != n; ++i) rows[i] = cols[i] = i;
+  if (eliminate(std::vector<T>(matrix_.begin(), matrix_.end()), n, rows,
+                cols) != n - 1)
+    return result;
+  const size_t k = rows[n - 1], l = cols[n - 1];
+  BasicMatrix row_replaced(*this), col_replaced(*this);
+  BasicMatrix by_row(n, n), by_col(n, n);
+  for (size_t j = 0; j != n; ++j)
+    row_replaced.matrix_[k * n + j] = j == l ? T(1) : T(0);
+  for (size_t i = 0; i != n; ++i)
+    col_replaced.matrix_[i * n + l] = i == k ? T(1) : T(0);
+  // Only a floating point determinant rounding to exactly zero fails here
+  if (!nonsingular(row_replaced, by_row) || !nonsingular(col_replaced, by_col))
+    return result;
+  const T pivot = by_row.matrix_[k * n + l];
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      result.matrix_[i * n + j] =
+          by_col.matrix_[i * n + l] * by_row.matrix_[k * n + j] / pivot;
+  return result;
+}
+
+// Gauss-Jordan with partial pivoting for fields, the adjugate times the
+// unit determinant for integers
+template <typename T>
+BasicMatrix<T> BasicMatrix<T>::InverseMatrix() const {
+  if (rows_ != cols_) throw NotSquare("matrix is not square");
+  const size_t n = rows_;
+  if constexpr (IsExact<T>::value) {
+    T det = Determinant();
+    if (det == 0) throw ZeroDeterminant("matrix determinant is 0");
+    if (det != 1 && det != -1)
+      throw std::domain_error("matrix has no integer inverse");
+    BasicMatrix result = CalcComplements().Transpose();
+    result.MulNumber(det);
+    return result;
+  } else {
+    BasicMatrix a(*this), result(n, n);
+    for (size_t i = 0; i != n; ++i) result.matrix_[i * n + i] = 1;
+    for (size_t k = 0; k != n; ++k) {
+      size_t pivot = k;
+      for (size_t i = k + 1; i != n; ++i)
+        if (std::abs(a.matrix_[i * n + k]) > std::abs(a.matrix_[pivot * n + k]))
+          pivot = i;
+      if (a.matrix_[pivot * n + k] == T(0))
+        throw ZeroDeterminant("matrix determinant is 0");
+      for (BasicMatrix* m : {&a, &result})
+        std::swap_ranges(m->matrix_.begin() + k * n,
+                         m->matrix_.begin() + (k + 1) * n,
+                         m->matrix_.begin() + pivot * n);
+      const T scale = T(1) / a.matrix_[k * n + k];
+      for (size_t j = 0; j != n; ++j) {
+        a.matrix_[k * n + j] *= scale;
+        result.matrix_[k * n + j] *= scale;
+      }
+      for (size_t i = 0; i != n; ++i) {
+        if (i == k || a.matrix_[i * n + k] == T(0)) continue;
+        const T factor = a.matrix_[i * n + k];
+        for (size_t j = 0; j != n; ++j) {
+          a.matrix_[i * n + j] -= factor * a.matrix_[k * n + j];
+          result.matrix_[i * n + j] -= factor * result.matrix_[k * n + j];
+        }
+      }
+    }
+    return result;
+  }
+}
+
+template class BasicMatrix<float>;
+template class BasicMatrix<std::complex<float>>;
+template class BasicMatrix<std::complex<double>>;
+template class BasicMatrix<int>;
+template class BasicMatrix<long>;
+template class BasicMatrix<long long>;
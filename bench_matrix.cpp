@@ -0,0 +1,264 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#include "matrix.h"
+
+// Every benchmark takes the matrix side n as its argument and reports
+// FLOP/s and bytes/s from the minimal work and memory traffic of one
+// call, so results stay comparable between implementations. Write JSON
+// for diffing releases with
+//   bench_matrix --benchmark_out=result.json --benchmark_out_format=json
+
+namespace {
+
+constexpr int64_t kMinSize = 2;
+constexpr int64_t kMaxSize = 4096;
+
+void Sizes(benchmark::internal::Benchmark* bench) {
+  bench->RangeMultiplier(2)
+      ->Range(kMinSize, kMaxSize)
+      ->Unit(benchmark::kMicrosecond);
+}
+
+// Diagonally dominant, so every size is well conditioned for the
+// determinant and the inverse
+Matrix Sample(size_t n) {
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = std::sin(i * 0.7 + j * 1.3) + (i == j ? n : 0.0);
+  return matrix;
+}
+
+void Report(benchmark::State& state, double flops, double bytes) {
+  if (flops > 0)
+    state.counters["FLOPS"] = benchmark::Counter(
+        flops, benchmark::Counter::kIsIterationInvariantRate);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+double Elements(const benchmark::State& state) {
+  return static_cast<double>(state.range(0)) * state.range(0);
+}
+
+double Cube(const benchmark::State& state) {
+  return Elements(state) * state.range(0);
+}
+
+void BM_Construct(benchmark::State& state) {
+  const int n = state.range(0);
+  for (auto _ : state) {
+    Matrix matrix(n, n);
+    benchmark::DoNotOptimize(matrix);
+  }
+  Report(state, 0, Elements(state) * sizeof(double));
+}
+
+void BM_Copy(benchmark::State& state) {
+  const Matrix source = Sample(state.range(0));
+  for (auto _ : state) {
+    Matrix copy(source);
+    benchmark::DoNotOptimize(copy);
+  }
+  Report(state, 0, 2 * Elements(state) * sizeof(double));
+}
+
+void BM_Move(benchmark::State& state) {
+  Matrix matrix = Sample(state.range(0));
+  for (auto _ : state) {
+    Matrix moved(std::move(matrix));
+    matrix = std::move(moved);
+    benchmark::DoNotOptimize(matrix);
+  }
+  Report(state, 0, 0);
+}
+
+void BM_SumMatrix(benchmark::State& state) {
+  Matrix matrix = Sample(state.range(0));
+  const Matrix other = Sample(state.range(0));
+  for (auto _ : state) {
+    matrix.SumMatrix(other);
+    benchmark::ClobberMemory();
+  }
+  Report(state, Elements(state), 3 * Elements(state) * sizeof(double));
+}
+
+void BM_MulNumber(benchmark::State& state) {
+  Matrix matrix = Sample(state.range(0));
+  for (auto _ : state) {
+    matrix.MulNumber(-1.0);
+    benchmark::ClobberMemory();
+  }
+  Report(state, Elements(state), 2 * Elements(state) * sizeof(double));
+}
+
+void BM_MulMatrix(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Matrix matrix = Sample(n);
+  // Every row of the product is the mean of the row, the values settle
+  // after the first iteration
+  Matrix average(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) average(i, j) = 1.0 / n;
+  for (auto _ : state) {
+    matrix.MulMatrix(average);
+    benchmark::ClobberMemory();
+  }
+  Report(state, 2 * Cube(state), 3 * Elements(state) * sizeof(double));
+}
+
+// C += A * B^T into the existing C, no temporaries
+void BM_GemmAccumulate(benchmark::State& state) {
+  const size_t n = state.range(0);
+  const Matrix a = Sample(n), b = Sample(n);
+  Matrix c(n, n);
+  for (auto _ : state) {
+    Gemm(1.0 / n, a, false, b, true, 0.5, c);
+    benchmark::ClobberMemory();
+  }
+  Report(state, 2 * Cube(state), 4 * Elements(state) * sizeof(double));
+}
+
+void BM_Transpose(benchmark::State& state) {
+  const Matrix matrix = Sample(state.range(0));
+  for (auto _ : state) {
+    Matrix transposed = matrix.Transpose();
+    benchmark::DoNotOptimize(transposed);
+  }
+  Report(state, 0, 2 * Elements(state) * sizeof(double));
+}
+
+void BM_TransposeInPlace(benchmark::State& state) {
+  Matrix matrix = Sample(state.range(0));
+  for (auto _ : state) {
+    matrix.TransposeInPlace();
+    benchmark::ClobberMemory();
+  }
+  Report(state, 0, 2 * Elements(state) * sizeof(double));
+}
+
+void BM_Determinant(benchmark::State& state) {
+  const Matrix matrix = Sample(state.range(0));
+  for (auto _ : state) benchmark::DoNotOptimize(matrix.Determinant());
+  Report(state, 2.0 / 3 * Cube(state), Elements(state) * sizeof(double));
+}
+
+void BM_CalcComplements(benchmark::State& state) {
+  const Matrix matrix = Sample(state.range(0));
+  for (auto _ : state) {
+    Matrix complements = matrix.CalcComplements();
+    benchmark::DoNotOptimize(complements);
+  }
+  Report(state, 2 * Cube(state), 2 * Elements(state) * sizeof(double));
+}
+
+void BM_InverseMatrix(benchmark::State& state) {
+  const Matrix matrix = Sample(state.range(0));
+  for (auto _ : state) {
+    Matrix inverse = matrix.InverseMatrix();
+    benchmark::DoNotOptimize(inverse);
+  }
+  Report(state, 2 * Cube(state), 2 * Elements(state) * sizeof(double));
+}
+
+// Right-hand side of as many columns as the matrix, the usual shape of
+// a blocked solve
+void BM_Solve(benchmark::State& state) {
+  const Matrix matrix = Sample(state.range(0));
+  const Matrix rhs = Sample(state.range(0));
+  for (auto _ : state) {
+    Matrix x = matrix.Solve(rhs);
+    benchmark::DoNotOptimize(x);
+  }
+  Report(state, 8.0 / 3 * Cube(state), 3 * Elements(state) * sizeof(double));
+}
+
+// Overdetermined 2n x n system with one right-hand side
+void BM_LeastSquares(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Matrix matrix(2 * n, n);
+  for (size_t i = 0; i != 2 * n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = std::sin(i * 0.7 + j * 1.3) + (i == j ? n : 0.0);
+  Matrix column(2 * n, 1);
+  for (size_t i = 0; i != 2 * n; ++i) column(i, 0) = std::cos(i * 0.3);
+  for (auto _ : state) {
+    Matrix x = matrix.LeastSquares(column);
+    benchmark::DoNotOptimize(x);
+  }
+  Report(state, 10.0 / 3 * Cube(state), 2 * Elements(state) * sizeof(double));
+}
+
+// Element-by-element fill through the bounds-checked operator() and
+// through the row pointers
+void BM_FillChecked(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Matrix matrix(n, n);
+  for (auto _ : state) {
+    for (size_t i = 0; i != n; ++i)
+      for (size_t j = 0; j != n; ++j) matrix(i, j) = i * 0.5 + j;
+    benchmark::ClobberMemory();
+  }
+  Report(state, 0, Elements(state) * sizeof(double));
+}
+
+void BM_FillUnchecked(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Matrix matrix(n, n);
+  for (auto _ : state) {
+    for (size_t i = 0; i != n; ++i) {
+      double* row = matrix.rowPtr(i);
+      for (size_t j = 0; j != n; ++j) row[j] = i * 0.5 + j;
+    }
+    benchmark::ClobberMemory();
+  }
+  Report(state, 0, Elements(state) * sizeof(double));
+}
+
+// One iteration grows the matrix by a row or column and shrinks it back,
+// each step copies the kept elements
+void BM_SetRows(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Matrix matrix = Sample(n);
+  for (auto _ : state) {
+    matrix.setRows(n + 1);
+    matrix.setRows(n);
+    benchmark::ClobberMemory();
+  }
+  Report(state, 0, 4 * Elements(state) * sizeof(double));
+}
+
+void BM_SetCols(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Matrix matrix = Sample(n);
+  for (auto _ : state) {
+    matrix.setCols(n + 1);
+    matrix.setCols(n);
+    benchmark::ClobberMemory();
+  }
+  Report(state, 0, 4 * Elements(state) * sizeof(double));
+}
+
+}  // namespace
+
+BENCHMARK(BM_Construct)->Apply(Sizes);
+BENCHMARK(BM_Copy)->Apply(Sizes);
+BENCHMARK(BM_Move)->Apply(Sizes);
+BENCHMARK(BM_SumMatrix)->Apply(Sizes);
+BENCHMARK(BM_MulNumber)->Apply(Sizes);
+BENCHMARK(BM_MulMatrix)->Apply(Sizes);
+BENCHMARK(BM_GemmAccumulate)->Apply(Sizes);
+BENCHMARK(BM_Transpose)->Apply(Sizes);
+BENCHMARK(BM_TransposeInPlace)->Apply(Sizes);
+BENCHMARK(BM_Determinant)->Apply(Sizes);
+BENCHMARK(BM_CalcComplements)->Apply(Sizes);
+BENCHMARK(BM_InverseMatrix)->Apply(Sizes);
+BENCHMARK(BM_Solve)->Apply(Sizes);
+BENCHMARK(BM_LeastSquares)->Apply(Sizes);
+BENCHMARK(BM_FillChecked)->Apply(Sizes);
+BENCHMARK(BM_FillUnchecked)->Apply(Sizes);
+BENCHMARK(BM_SetRows)->Apply(Sizes);
+BENCHMARK(BM_SetCols)->Apply(Sizes);
@@ -0,0 +1,195 @@
+#include "cholesky.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "gemm.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Panel width, the trailing update of each panel is one GEMM per block
+// column below the diagonal
+constexpr size_t kBlock = 64;
+
+// Rounding in a product like B * B^T may leave the two triangles apart by
+// a few ulps, anything beyond this relative to the diagonal is rejected
+constexpr double kSymmetryTolerance = 1e-10;
+
+const Matrix& checkSymmetric(const Matrix& matrix) {
+  if (matrix.getRows() != matrix.getCols())
+    throw Matrix::NotSquare("matrix is not square");
+  ConstMatrixView a = matrix.view();
+  for (size_t i = 0; i != a.getRows(); ++i)
+    for (size_t j = 0; j != i; ++j) {
+      double scale = std::sqrt(std::fabs(a(i, i) * a(j, j)));
+      if (std::fabs(a(i, j) - a(j, i)) > kSymmetryTolerance * scale)
+        throw Matrix::NotPositiveDefinite("matrix is not symmetric");
+    }
+  return matrix;
+}
+
+}  // namespace
+
+Cholesky::Cholesky(const Matrix& matrix) : lower_(checkSymmetric(matrix)) {
+  factorize();
+}
+
+// Right-looking blocked factorization on the lower triangle. The upper
+// triangle is cleared at the end so that lower_ is L itself.
+void Cholesky::factorize() {
+  const size_t n = lower_.getRows(), ld = lower_.getStride();
+  double* a = lower_.view().data();
+  for (size_t j = 0; j < n; j += kBlock) {
+    const size_t jb = std::min(kBlock, n - j), rest = j + jb;
+    // Diagonal block
+    for (size_t c = j; c != rest; ++c) {
+      double* row = a + c * ld;
+      double d = row[c];
+      for (size_t k = j; k != c; ++k) d -= row[k] * row[k];
+      if (!(d > 0))
+        throw Matrix::NotPositiveDefinite("matrix is not positive definite");
+      row[c] = std::sqrt(d);
+      for (size_t r = c + 1; r != rest; ++r) {
+        double* other = a + r * ld;
+        double sum = other[c];
+        for (size_t k = j; k != c; ++k) sum -= other[k] * row[k];
+        other[c] = sum / row[c];
+      }
+    }
+    if (rest == n) continue;
+    // L21 = A21 * L11^-T, row by row
+    ThreadPool::ParallelFor(n - rest, jb * jb, [&](size_t first, size_t last) {
+      for (size_t r = rest + first; r != rest + last; ++r) {
+        double* row = a + r * ld;
+        for (size_t c = j; c != rest; ++c) {
+          const double* pivot_row = a + c * ld;
+          double sum = row[c];
+          for (size_t k = j; k != c; ++k) sum -= row[k] * pivot_row[k];
+          row[c] = sum / pivot_row[c];
+        }
+      }
+    });
+    // A22 -= L21 * L21^T on and below the diagonal, one block column at a
+    // time, so the flops stay half of a full GEMM
+    for (size_t jj = rest; jj < n; jj += kBlock) {
+      const size_t w = std::min(kBlock, n - jj);
+      kernels::Gemm(n - jj, w, jb, -1.0, a + jj * ld + j, ld, 1,
+                    a + jj * ld + j, 1, ld, 1.0, a + jj * ld + jj, ld);
+    }
+  }
+  for (size_t i = 0; i != n; ++i)
+    std::fill(a + i * ld + i + 1, a + i * ld + n, 0.0);
+}
+
+size_t Cholesky::getSize() const { return lower_.getRows(); }
+
+const Matrix& Cholesky::getLower() const { return lower_; }
+
+double Cholesky::Determinant() const {
+  double result = 1;
+  for (size_t i = 0; i != lower_.getRows(); ++i) {
+    double l = lower_(i, i);
+    result *= l * l;
+  }
+  return result;
+}
+
+double Cholesky::LogDeterminant() const {
+  double result = 0;
+  for (size_t i = 0; i != lower_.getRows(); ++i)
+    result += 2 * std::log(lower_(i, i));
+  return result;
+}
+
+// L * Y = X, then L^T * X = Y, in place. Columns of x are independent and
+// split over threads.
+void Cholesky::solveFactored(Matrix& x) const {
+  const size_t n = lower_.getRows(), ld = lower_.getStride();
+  const size_t m = x.getCols(), ldx = x.getStride();
+  const double* a = lower_.view().data();
+  double* b = x.view().data();
+  ThreadPool::ParallelFor(m, 2 * n * n, [&](size_t first, size_t last) {
+    for (size_t i = 0; i != n; ++i) {
+      double* row = b + i * ldx;
+      for (size_t k = 0; k != i; ++k) {
+        double l = a[i * ld + k];
+        const double* x_row = b + k * ldx;
+        for (size_t col = first; col != last; ++col)
+          row[col] -= l * x_row[col];
+      }
+      double pivot = a[i * ld + i];
+      for (size_t col = first; col != last; ++col) row[col] /= pivot;
+    }
+    for (size_t i = n; i-- != 0;) {
+      double* row = b + i * ldx;
+      for (size_t k = i + 1; k != n; ++k) {
+        double l = a[k * ld + i];
+        const double* x_row = b + k * ldx;
+        for (size_t col = first; col != last; ++col)
+          row[col] -= l * x_row[col];
+      }
+      double pivot = a[i * ld + i];
+      for (size_t col = first; col != last; ++col) row[col] /= pivot;
+    }
+  });
+}
+
+Matrix Cholesky::Solve(const Matrix& b) const {
+  if (b.getRows() != lower_.getRows())
+    throw Matrix::DifferentMatrixSize("rows count not equal");
+  Matrix x(b);
+  solveFactored(x);
+  return x;
+}
+
+Matrix Cholesky::InverseMatrix() const {
+  const size_t n = lower_.getRows(), ld = lower_.getStride();
+  const double* a = lower_.view().data();
+  // L * X = I by forward substitution over column blocks. Column j of
+  // L^-1 is zero above row j, so rows and terms outside the lower
+  // triangle are skipped.
+  Matrix inverse_lower(n, n);
+  double* v = inverse_lower.view().data();
+  const size_t ldv = inverse_lower.getStride();
+  ThreadPool::ParallelFor(n, n * n / 2, [&](size_t first, size_t last) {
+    for (size_t i = first; i != n; ++i) {
+      double* row = v + i * ldv;
+      if (i < last) row[i] = 1;
+      for (size_t k = first; k != i; ++k) {
+        const double l = a[i * ld + k];
+        const double* x_row = v + k * ldv;
+        const size_t end = std::min(last, k + 1);
+        for (size_t col = first; col != end; ++col) row[col] -= l * x_row[col];
+      }
+      const double pivot = a[i * ld + i];
+      const size_t end = std::min(last, i + 1);
+      for (size_t col = first; col != end; ++col) row[col] /= pivot;
+    }
+  });
+  // A^-1 = L^-T * L^-1. Below the diagonal, element (i, j) only needs
+  // rows k >= i of L^-1, so block column jj is a GEMM over rows from jj.
+  Matrix result(n, n);
+  double* c = result.view().data();
+  const size_t ldc = result.getStride();
+  for (size_t jj = 0; jj < n; jj += kBlock) {
+    const size_t w = std::min(kBlock, n - jj);
+    kernels::Gemm(n - jj, w, n - jj, 1.0, v + jj * ldv + jj, 1, ldv,
+                  v + jj * ldv + jj, ldv, 1, 0.0, c + jj * ldc + jj, ldc);
+  }
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = i + 1; j != n; ++j) c[i * ldc + j] = c[j * ldc + i];
+  return result;
+}
+
+Matrix Matrix::CalcCholesky() const { return Cholesky(*this).getLower(); }
+
+bool Matrix::IsPositiveDefinite() const {
+  if (rows_ != cols_) return false;
+  try {
+    Cholesky factor(*this);
+  } catch (const NotPositiveDefinite&) {
+    return false;
+  }
+  return true;
+}
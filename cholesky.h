@@ -0,0 +1,34 @@
+#ifndef CHOLESKY_H
+#define CHOLESKY_H
+#include <cstddef>
+
+#include "matrix.h"
+
+// Cholesky factorization A = L * L^T of a symmetric positive definite
+// matrix, L lower triangular with a positive diagonal. Half the work of
+// LU and no pivoting; the determinant, inverse and solves come from the
+// same factor. Throws Matrix::NotPositiveDefinite when a pivot is not
+// positive or when the matrix is not symmetric. SymmetricMatrix factors
+// its packed triangle itself, see SymmetricMatrix::Determinant.
+class Cholesky {
+ private:
+  Matrix lower_;
+
+  void factorize();
+  void solveFactored(Matrix& x) const;
+
+ public:
+  explicit Cholesky(const Matrix& matrix);
+
+  size_t getSize() const;
+  const Matrix& getLower() const;
+
+  double Determinant() const;
+  // log(det A), finite where the determinant itself under- or overflows
+  double LogDeterminant() const;
+  // Solves A * X = B for every column of B
+  Matrix Solve(const Matrix& b) const;
+  // L^-1 first, then L^-T * L^-1 over the lower triangle only
+  Matrix InverseMatrix() const;
+};
+#endif
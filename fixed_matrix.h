@@ -0,0 +1,326 @@
+#ifndef FIXED_MATRIX_H
+#define FIXED_MATRIX_H
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+#include "matrix.h"
+
+// Matrix with compile-time dimensions and inline storage: no heap
+// allocation, kernels are unrolled over the element count and usable in
+// constant expressions. Determinant and inverse have closed forms up to
+// 4x4. Converts to Matrix implicitly and takes part in Matrix expressions,
+// so FixedMatrix and Matrix operands can be mixed freely.
+template <size_t R, size_t C>
+class FixedMatrix : public MatrixExpr<FixedMatrix<R, C>> {
+  static_assert(R > 0 && C > 0, "matrix dimensions must be positive");
+
+ private:
+  double matrix_[R * C];
+
+  template <typename F, size_t... I>
+  static constexpr void unroll(F f, std::index_sequence<I...>) {
+    (f(I), ...);
+  }
+  template <typename F>
+  static constexpr void forEach(F f) {
+    unroll(f, std::make_index_sequence<R * C>());
+  }
+  static constexpr double abs(double value) {
+    return value < 0 ? -value : value;
+  }
+
+  constexpr double at(size_t i, size_t j) const { return matrix_[i * C + j]; }
+  constexpr double& ref(size_t i, size_t j) { return matrix_[i * C + j]; }
+  constexpr FixedMatrix<R - 1, C - 1> minor(size_t s, size_t k) const;
+
+  template <size_t, size_t>
+  friend class FixedMatrix;
+
+ public:
+  constexpr FixedMatrix() : matrix_{} {}
+  constexpr FixedMatrix(const double (&values)[R][C]) : matrix_{} {
+    for (size_t i = 0; i != R; ++i)
+      for (size_t j = 0; j != C; ++j) matrix_[i * C + j] = values[i][j];
+  }
+  explicit FixedMatrix(const Matrix& other) : matrix_{} {
+    if (other.getRows() != R)
+      throw Matrix::DifferentMatrixSize("rows count not equal");
+    if (other.getCols() != C)
+      throw Matrix::DifferentMatrixSize("cols count not equal");
+    for (size_t i = 0; i != R; ++i)
+      for (size_t j = 0; j != C; ++j) matrix_[i * C + j] = other(i, j);
+  }
+
+  // Overloading operators
+  constexpr FixedMatrix& operator+=(const FixedMatrix& other) {
+    SumMatrix(other);
+    return *this;
+  }
+  constexpr FixedMatrix& operator-=(const FixedMatrix& other) {
+    SubMatrix(other);
+    return *this;
+  }
+  constexpr FixedMatrix& operator*=(const double num) {
+    MulNumber(num);
+    return *this;
+  }
+  constexpr FixedMatrix& operator*=(const FixedMatrix<C, C>& other) {
+    MulMatrix(other);
+    return *this;
+  }
+  template <size_t K>
+  constexpr FixedMatrix<R, K> operator*(const FixedMatrix<C, K>& other) const {
+    FixedMatrix<R, K> result;
+    for (size_t i = 0; i != R; ++i)
+      for (size_t k = 0; k != C; ++k) {
+        double a = at(i, k);
+        for (size_t j = 0; j != K; ++j) result.ref(i, j) += a * other.at(k, j);
+      }
+    return result;
+  }
+  constexpr double& operator()(size_t i, size_t j) {
+    if (i >= R) throw std::out_of_range("i out greater then num rows");
+    if (j >= C) throw std::out_of_range("j out greater then num columns");
+    return matrix_[i * C + j];
+  }
+  constexpr const double& operator()(size_t i, size_t j) const {
+    if (i >= R) throw std::out_of_range("i out greater then num rows");
+    if (j >= C) throw std::out_of_range("j out greater then num columns");
+    return matrix_[i * C + j];
+  }
+
+  // accessors
+  static constexpr size_t getRows() { return R; }
+  static constexpr size_t getCols() { return C; }
+
+  // Member functions
+  constexpr void SumMatrix(const FixedMatrix& other) {
+    forEach([&](size_t k) { matrix_[k] += other.matrix_[k]; });
+  }
+  constexpr void SubMatrix(const FixedMatrix& other) {
+    forEach([&](size_t k) { matrix_[k] -= other.matrix_[k]; });
+  }
+  constexpr void MulNumber(const double num) {
+    forEach([&](size_t k) { matrix_[k] *= num; });
+  }
+  constexpr void MulMatrix(const FixedMatrix<C, C>& other) {
+    *this = *this * other;
+  }
+  constexpr bool EqMatrix(const FixedMatrix& other) const {
+    bool equal = true;
+    forEach([&](size_t k) { equal &= matrix_[k] == other.matrix_[k]; });
+    return equal;
+  }
+  constexpr FixedMatrix<C, R> Transpose() const {
+    FixedMatrix<C, R> result;
+    for (size_t i = 0; i != R; ++i)
+      for (size_t j = 0; j != C; ++j) result.ref(j, i) = at(i, j);
+    return result;
+  }
+  constexpr double Determinant() const;
+  constexpr FixedMatrix CalcComplements() const;
+  constexpr FixedMatrix InverseMatrix() const;
+
+  // Expression template hooks
+  using RowReader = Matrix::RowReader;
+  RowReader evalRow(size_t i) const { return {matrix_ + i * C}; }
+  bool aliases(const ConstMatrixView&) const { return false; }
+};
+
+template <size_t R, size_t C>
+constexpr FixedMatrix<R - 1, C - 1> FixedMatrix<R, C>::minor(size_t s,
+                                                             size_t k) const {
+  FixedMatrix<R - 1, C - 1> result;
+  for (size_t i = 0, a = 0; i != R; ++i) {
+    if (i == s) continue;
+    for (size_t j = 0, b = 0; j != C; ++j)
+      if (j != k) result.ref(a, b++) = at(i, j);
+    ++a;
+  }
+  return result;
+}
+
+template <size_t R, size_t C>
+constexpr double FixedMatrix<R, C>::Determinant() const {
+  static_assert(R == C, "matrix is not square");
+  if constexpr (R == 1) {
+    return at(0, 0);
+  } else if constexpr (R == 2) {
+    return at(0, 0) * at(1, 1) - at(0, 1) * at(1, 0);
+  } else if constexpr (R == 3) {
+    return at(0, 0) * (at(1, 1) * at(2, 2) - at(1, 2) * at(2, 1)) -
+           at(0, 1) * (at(1, 0) * at(2, 2) - at(1, 2) * at(2, 0)) +
+           at(0, 2) * (at(1, 0) * at(2, 1) - at(1, 1) * at(2, 0));
+  } else if constexpr (R == 4) {
+    double s0 = at(0, 0) * at(1, 1) - at(1, 0) * at(0, 1);
+    double s1 = at(0, 0) * at(1, 2) - at(1, 0) * at(0, 2);
+    double s2 = at(0, 0) * at(1, 3) - at(1, 0) * at(0, 3);
+    double s3 = at(0, 1) * at(1, 2) - at(1, 1) * at(0, 2);
+    double s4 = at(0, 1) * at(1, 3) - at(1, 1) * at(0, 3);
+    double s5 = at(0, 2) * at(1, 3) - at(1, 2) * at(0, 3);
+    double c5 = at(2, 2) * at(3, 3) - at(3, 2) * at(2, 3);
+    double c4 = at(2, 1) * at(3, 3) - at(3, 1) * at(2, 3);
+    double c3 = at(2, 1) * at(3, 2) - at(3, 1) * at(2, 2);
+    double c2 = at(2, 0) * at(3, 3) - at(3, 0) * at(2, 3);
+    double c1 = at(2, 0) * at(3, 2) - at(3, 0) * at(2, 2);
+    double c0 = at(2, 0) * at(3, 1) - at(3, 0) * at(2, 1);
+    return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+  } else {
+    // Gaussian elimination with partial pivoting
+    FixedMatrix work = *this;
+    double result = 1;
+    for (size_t j = 0; j != R; ++j) {
+      size_t p = j;
+      for (size_t i = j + 1; i != R; ++i)
+        if (abs(work.at(i, j)) > abs(work.at(p, j))) p = i;
+      if (work.at(p, j) == 0) return 0;
+      if (p != j) {
+        for (size_t k = j; k != C; ++k) {
+          double tmp = work.at(j, k);
+          work.ref(j, k) = work.at(p, k);
+          work.ref(p, k) = tmp;
+        }
+        result = -result;
+      }
+      result *= work.at(j, j);
+      for (size_t i = j + 1; i != R; ++i) {
+        double l = work.at(i, j) / work.at(j, j);
+        for (size_t k = j; k != C; ++k) work.ref(i, k) -= l * work.at(j, k);
+      }
+    }
+    return result;
+  }
+}
+
+template <size_t R, size_t C>
+constexpr FixedMatrix<R, C> FixedMatrix<R, C>::CalcComplements() const {
+  static_assert(R == C, "matrix is not square");
+  FixedMatrix result;
+  if constexpr (R == 1) {
+    result.ref(0, 0) = 1;
+  } else {
+    for (size_t i = 0; i != R; ++i)
+      for (size_t j = 0; j != C; ++j) {
+        double minor_det = minor(i, j).Determinant();
+        result.ref(i, j) = (i + j) % 2 ? -minor_det : minor_det;
+      }
+  }
+  return result;
+}
+
+template <size_t R, size_t C>
+constexpr FixedMatrix<R, C> FixedMatrix<R, C>::InverseMatrix() const {
+  static_assert(R == C, "matrix is not square");
+  FixedMatrix result;
+  if constexpr (R <= 3) {
+    double det = Determinant();
+    if (det == 0) throw Matrix::ZeroDeterminant("matrix determinant is 0");
+    result = CalcComplements().Transpose();
+    result.MulNumber(1.0 / det);
+  } else if constexpr (R == 4) {
+    double s0 = at(0, 0) * at(1, 1) - at(1, 0) * at(0, 1);
+    double s1 = at(0, 0) * at(1, 2) - at(1, 0) * at(0, 2);
+    double s2 = at(0, 0) * at(1, 3) - at(1, 0) * at(0, 3);
+    double s3 = at(0, 1) * at(1, 2) - at(1, 1) * at(0, 2);
+    double s4 = at(0, 1) * at(1, 3) - at(1, 1) * at(0, 3);
+    double s5 = at(0, 2) * at(1, 3) - at(1, 2) * at(0, 3);
+    double c5 = at(2, 2) * at(3, 3) - at(3, 2) * at(2, 3);
+    double c4 = at(2, 1) * at(3, 3) - at(3, 1) * at(2, 3);
+    double c3 = at(2, 1) * at(3, 2) - at(3, 1) * at(2, 2);
+    double c2 = at(2, 0) * at(3, 3) - at(3, 0) * at(2, 3);
+    double c1 = at(2, 0) * at(3, 2) - at(3, 0) * at(2, 2);
+    double c0 = at(2, 0) * at(3, 1) - at(3, 0) * at(2, 1);
+    double det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    if (det == 0) throw Matrix::ZeroDeterminant("matrix determinant is 0");
+    double inv = 1.0 / det;
+    result.ref(0, 0) = (at(1, 1) * c5 - at(1, 2) * c4 + at(1, 3) * c3) * inv;
+    result.ref(0, 1) = (-at(0, 1) * c5 + at(0, 2) * c4 - at(0, 3) * c3) * inv;
+    result.ref(0, 2) = (at(3, 1) * s5 - at(3, 2) * s4 + at(3, 3) * s3) * inv;
+    result.ref(0, 3) = (-at(2, 1) * s5 + at(2, 2) * s4 - at(2, 3) * s3) * inv;
+    result.ref(1, 0) = (-at(1, 0) * c5 + at(1, 2) * c2 - at(1, 3) * c1) * inv;
+    result.ref(1, 1) = (at(0, 0) * c5 - at(0, 2) * c2 + at(0, 3) * c1) * inv;
+    result.ref(1, 2) = (-at(3, 0) * s5 + at(3, 2) * s2 - at(3, 3) * s1) * inv;
+    result.ref(1, 3) = (at(2, 0) * s5 - at(2, 2) * s2 + at(2, 3) * s1) * inv;
+    result.ref(2, 0) = (at(1, 0) * c4 - at(1, 1) * c2 + at(1, 3) * c0) * inv;
+    result.ref(2, 1) = (-at(0, 0) * c4 + at(0, 1) * c2 - at(0, 3) * c0) * inv;
+    result.ref(2, 2) = (at(3, 0) * s4 - at(3, 1) * s2 + at(3, 3) * s0) * inv;
+    result.ref(2, 3) = (-at(2, 0) * s4 + at(2, 1) * s2 - at(2, 3) * s0) * inv;
+    result.ref(3, 0) = (-at(1, 0) * c3 + at(1, 1) * c1 - at(1, 2) * c0) * inv;
+    result.ref(3, 1) = (at(0, 0) * c3 - at(0, 1) * c1 + at(0, 2) * c0) * inv;
+    result.ref(3, 2) = (-at(3, 0) * s3 + at(3, 1) * s1 - at(3, 2) * s0) * inv;
+    result.ref(3, 3) = (at(2, 0) * s3 - at(2, 1) * s1 + at(2, 2) * s0) * inv;
+  } else {
+    // Gauss-Jordan elimination with partial pivoting
+    FixedMatrix work = *this;
+    for (size_t i = 0; i != R; ++i) result.ref(i, i) = 1;
+    for (size_t j = 0; j != R; ++j) {
+      size_t p = j;
+      for (size_t i = j + 1; i != R; ++i)
+        if (abs(work.at(i, j)) > abs(work.at(p, j))) p = i;
+      if (work.at(p, j) == 0)
+        throw Matrix::ZeroDeterminant("matrix determinant is 0");
+      for (size_t k = 0; k != C; ++k) {
+        double tmp = work.at(j, k);
+        work.ref(j, k) = work.at(p, k);
+        work.ref(p, k) = tmp;
+        tmp = result.at(j, k);
+        result.ref(j, k) = result.at(p, k);
+        result.ref(p, k) = tmp;
+      }
+      double pivot = work.at(j, j);
+      for (size_t k = 0; k != C; ++k) {
+        work.ref(j, k) /= pivot;
+        result.ref(j, k) /= pivot;
+      }
+      for (size_t i = 0; i != R; ++i) {
+        if (i == j) continue;
+        double l = work.at(i, j);
+        for (size_t k = 0; k != C; ++k) {
+          work.ref(i, k) -= l * work.at(j, k);
+          result.ref(i, k) -= l * result.at(j, k);
+        }
+      }
+    }
+  }
+  return result;
+}
+
+// Function overloading operators. Exact FixedMatrix overloads keep results
+// fixed-size, mixed operands fall back to the Matrix expression operators.
+template <size_t R, size_t C>
+constexpr bool operator==(const FixedMatrix<R, C>& fst,
+                          const FixedMatrix<R, C>& snd) {
+  return fst.EqMatrix(snd);
+}
+
+template <size_t R, size_t C>
+constexpr bool operator!=(const FixedMatrix<R, C>& fst,
+                          const FixedMatrix<R, C>& snd) {
+  return !(fst == snd);
+}
+
+template <size_t R, size_t C>
+constexpr FixedMatrix<R, C> operator+(FixedMatrix<R, C> fst,
+                                      const FixedMatrix<R, C>& snd) {
+  return fst += snd;
+}
+
+template <size_t R, size_t C>
+constexpr FixedMatrix<R, C> operator-(FixedMatrix<R, C> fst,
+                                      const FixedMatrix<R, C>& snd) {
+  return fst -= snd;
+}
+
+template <size_t R, size_t C>
+constexpr FixedMatrix<R, C> operator*(FixedMatrix<R, C> fst,
+                                      const double num) {
+  return fst *= num;
+}
+
+template <size_t R, size_t C>
+constexpr FixedMatrix<R, C> operator*(const double num,
+                                      FixedMatrix<R, C> fst) {
+  return fst *= num;
+}
+#endif
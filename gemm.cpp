@@ -0,0 +1,370 @@
+#include "gemm.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include "matrix.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+namespace kernels {
+namespace {
+
+// Register block of the micro-kernel: kMR x Tile<T>::kNR accumulators
+// of C
+constexpr size_t kMR = kGemmMR;
+// Cache blocks: a kKC x kNR sliver of B stays in L1, a kMC x kKC panel
+// of A in L2 and a kKC x kNC panel of B in L3
+constexpr size_t kMC = 128;
+constexpr size_t kKC = 256;
+constexpr size_t kNC = 4096;
+// Products with fewer multiply-adds skip packing altogether
+constexpr size_t kSmallProduct = 32 * 32 * 32;
+constexpr size_t kPackAlignment = 64;
+constexpr size_t kDefaultStrassenCutoff = 2048;
+
+// Tile width and micro-kernel per element type
+template <typename T>
+struct Tile;
+
+template <>
+struct Tile<double> {
+  static constexpr size_t kNR = kGemmNR;
+  static auto kernel() { return Active().gemm_tile; }
+};
+
+template <>
+struct Tile<float> {
+  static constexpr size_t kNR = kGemmNRFloat;
+  static auto kernel() { return Active().gemm_tile_float; }
+};
+
+size_t roundUp(size_t value, size_t block) {
+  return (value + block - 1) / block * block;
+}
+
+template <typename T>
+struct AlignedDeleter {
+  void operator()(T* p) const {
+    ::operator delete[](p, std::align_val_t(kPackAlignment));
+  }
+};
+
+// Per-thread packing buffer that only grows, so steady-state products do
+// not touch the heap
+template <typename T>
+T* packBuffer(size_t slot, size_t size) {
+  thread_local std::unique_ptr<T[], AlignedDeleter<T>> buffers[2];
+  thread_local size_t capacity[2] = {0, 0};
+  if (capacity[slot] < size) {
+    buffers[slot].reset(static_cast<T*>(::operator new[](
+        size * sizeof(T), std::align_val_t(kPackAlignment))));
+    capacity[slot] = size;
+  }
+  return buffers[slot].get();
+}
+
+// Packs an mc x kc block of A scaled by alpha into kMR-row slivers stored
+// column by column, padding the last sliver with zeros
+template <typename T>
+void packA(size_t mc, size_t kc, T alpha, const T* a, size_t rsa, size_t csa,
+           T* packed) {
+  for (size_t i = 0; i < mc; i += kMR) {
+    size_t mr = std::min(kMR, mc - i);
+    for (size_t p = 0; p != kc; ++p) {
+      const T* src = a + i * rsa + p * csa;
+      for (size_t r = 0; r != mr; ++r) packed[r] = alpha * src[r * rsa];
+      for (size_t r = mr; r != kMR; ++r) packed[r] = 0;
+      packed += kMR;
+    }
+  }
+}
+
+// Packs a kc x nc block of B into kNR-column slivers stored row by row,
+// padding the last sliver with zeros
+template <typename T>
+void packB(size_t kc, size_t nc, const T* b, size_t rsb, size_t csb,
+           T* packed) {
+  constexpr size_t kNR = Tile<T>::kNR;
+  for (size_t j = 0; j < nc; j += kNR) {
+    size_t nr = std::min(kNR, nc - j);
+    for (size_t p = 0; p != kc; ++p) {
+      const T* src = b + p * rsb + j * csb;
+      if (csb == 1 && nr == kNR) {
+        std::copy_n(src, kNR, packed);
+      } else {
+        for (size_t c = 0; c != nr; ++c) packed[c] = src[c * csb];
+        for (size_t c = nr; c != kNR; ++c) packed[c] = 0;
+      }
+      packed += kNR;
+    }
+  }
+}
+
+template <typename T>
+void macroKernel(size_t mc, size_t nc, size_t kc, const T* packed_a,
+                 const T* packed_b, T* c, size_t rsc) {
+  constexpr size_t kNR = Tile<T>::kNR;
+  auto gemm_tile = Tile<T>::kernel();
+  for (size_t j = 0; j < nc; j += kNR) {
+    size_t nr = std::min(kNR, nc - j);
+    for (size_t i = 0; i < mc; i += kMR) {
+      size_t mr = std::min(kMR, mc - i);
+      gemm_tile(kc, packed_a + i * kc, packed_b + j * kc, c + i * rsc + j,
+                rsc, mr, nr);
+    }
+  }
+}
+
+template <typename T>
+void scale(size_t m, size_t n, T beta, T* c, size_t rsc) {
+  if (beta == 1) return;
+  for (size_t i = 0; i != m; ++i) {
+    T* row = c + i * rsc;
+    if (beta == 0)
+      std::fill_n(row, n, T(0));
+    else
+      for (size_t j = 0; j != n; ++j) row[j] *= beta;
+  }
+}
+
+template <typename T>
+void smallGemm(size_t m, size_t n, size_t k, T alpha, const T* a, size_t rsa,
+               size_t csa, const T* b, size_t rsb, size_t csb, T* c,
+               size_t rsc) {
+  for (size_t i = 0; i != m; ++i) {
+    T* row = c + i * rsc;
+    for (size_t p = 0; p != k; ++p) {
+      T a_ip = alpha * a[i * rsa + p * csa];
+      const T* b_row = b + p * rsb;
+      for (size_t j = 0; j != n; ++j) row[j] += a_ip * b_row[j * csb];
+    }
+  }
+}
+
+std::atomic<size_t>& strassenCutoff() {
+  static std::atomic<size_t> cutoff{[] {
+    const char* env = std::getenv("MATRIX_STRASSEN_CUTOFF");
+    return env ? std::strtoul(env, nullptr, 10) : kDefaultStrassenCutoff;
+  }()};
+  return cutoff;
+}
+
+// c = op(a, b) on h x w blocks, c may alias a or b
+template <typename Op>
+void combine(size_t h, size_t w, const double* a, size_t lda, const double* b,
+             size_t ldb, double* c, size_t ldc, Op op) {
+  ThreadPool::ParallelFor(h, w, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i) {
+      const double* a_row = a + i * lda;
+      const double* b_row = b + i * ldb;
+      double* c_row = c + i * ldc;
+      for (size_t j = 0; j != w; ++j) c_row[j] = op(a_row[j], b_row[j]);
+    }
+  });
+}
+
+void add(size_t h, size_t w, const double* a, size_t lda, const double* b,
+         size_t ldb, double* c, size_t ldc) {
+  combine(h, w, a, lda, b, ldb, c, ldc, [](double x, double y) {
+    return x + y;
+  });
+}
+
+void sub(size_t h, size_t w, const double* a, size_t lda, const double* b,
+         size_t ldb, double* c, size_t ldc) {
+  combine(h, w, a, lda, b, ldb, c, ldc, [](double x, double y) {
+    return x - y;
+  });
+}
+
+// Temporaries of all recursion levels: an (m/2) x max(k/2, n/2) block for
+// the A side sums and P1, a (k/2) x (n/2) block for the B side sums
+size_t workspaceSize(size_t m, size_t n, size_t k, size_t depth) {
+  size_t size = 0;
+  for (; depth != 0; --depth) {
+    m /= 2;
+    n /= 2;
+    k /= 2;
+    size += m * std::max(k, n) + k * n;
+  }
+  return size;
+}
+
+// Strassen-Winograd with the two-temporary schedule of Douglas et al.,
+// the quadrants of C hold intermediate products. m, n and k are divisible
+// by 2^depth.
+void winograd(size_t m, size_t n, size_t k, const double* a, size_t lda,
+              const double* b, size_t ldb, double* c, size_t ldc,
+              size_t depth, double* work) {
+  if (depth == 0) {
+    Gemm(m, n, k, 1.0, a, lda, 1, b, ldb, 1, 0.0, c, ldc);
+    return;
+  }
+  size_t mh = m / 2, nh = n / 2, kh = k / 2;
+  const double *a11 = a, *a12 = a + kh, *a21 = a + mh * lda, *a22 = a21 + kh;
+  const double *b11 = b, *b12 = b + nh, *b21 = b + kh * ldb, *b22 = b21 + nh;
+  double *c11 = c, *c12 = c + nh, *c21 = c + mh * ldc, *c22 = c21 + nh;
+  size_t ldx = std::max(kh, nh), ldy = nh;
+  double* x = work;
+  double* y = x + mh * ldx;
+  double* next = y + kh * nh;
+  auto product = [&](const double* p, size_t ldp, const double* q,
+                     size_t ldq, double* r, size_t ldr) {
+    winograd(mh, nh, kh, p, ldp, q, ldq, r, ldr, depth - 1, next);
+  };
+  sub(mh, kh, a11, lda, a21, lda, x, ldx);    // S3 = A11 - A21
+  sub(kh, nh, b22, ldb, b12, ldb, y, ldy);    // T3 = B22 - B12
+  product(x, ldx, y, ldy, c21, ldc);          // P7 = S3 * T3
+  add(mh, kh, a21, lda, a22, lda, x, ldx);    // S1 = A21 + A22
+  sub(kh, nh, b12, ldb, b11, ldb, y, ldy);    // T1 = B12 - B11
+  product(x, ldx, y, ldy, c22, ldc);          // P5 = S1 * T1
+  sub(mh, kh, x, ldx, a11, lda, x, ldx);      // S2 = S1 - A11
+  sub(kh, nh, b22, ldb, y, ldy, y, ldy);      // T2 = B22 - T1
+  product(x, ldx, y, ldy, c12, ldc);          // P6 = S2 * T2
+  sub(mh, kh, a12, lda, x, ldx, x, ldx);      // S4 = A12 - S2
+  product(x, ldx, b22, ldb, c11, ldc);        // P3 = S4 * B22
+  product(a11, lda, b11, ldb, x, ldx);        // P1 = A11 * B11
+  add(mh, nh, x, ldx, c12, ldc, c12, ldc);    // U2 = P1 + P6
+  add(mh, nh, c12, ldc, c21, ldc, c21, ldc);  // U3 = U2 + P7
+  add(mh, nh, c12, ldc, c22, ldc, c12, ldc);  // U4 = U2 + P5
+  add(mh, nh, c21, ldc, c22, ldc, c22, ldc);  // C22 = U3 + P5
+  add(mh, nh, c12, ldc, c11, ldc, c12, ldc);  // C12 = U4 + P3
+  sub(kh, nh, y, ldy, b21, ldb, y, ldy);      // T4 = T2 - B21
+  product(a22, lda, y, ldy, c11, ldc);        // P4 = A22 * T4
+  sub(mh, nh, c21, ldc, c11, ldc, c21, ldc);  // C21 = U3 - P4
+  product(a12, lda, b21, ldb, c11, ldc);      // P2 = A12 * B21
+  add(mh, nh, x, ldx, c11, ldc, c11, ldc);    // C11 = P1 + P2
+}
+
+// Goto-style blocked product shared by both precisions
+template <typename T>
+void gemm(size_t m, size_t n, size_t k, T alpha, const T* a, size_t rsa,
+          size_t csa, const T* b, size_t rsb, size_t csb, T beta, T* c,
+          size_t rsc) {
+  constexpr size_t kNR = Tile<T>::kNR;
+  scale(m, n, beta, c, rsc);
+  if (m == 0 || n == 0 || k == 0 || alpha == 0) return;
+  if (m * n * k <= kSmallProduct) {
+    smallGemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, c, rsc);
+    return;
+  }
+  // Row blocks of A are distributed over the pool, shrinking the block
+  // height when there are fewer blocks than threads
+  size_t threads = ThreadPool::ThreadCount();
+  size_t mc_block = std::min(kMC, roundUp((m + threads - 1) / threads, kMR));
+  size_t m_blocks = (m + mc_block - 1) / mc_block;
+  T* packed_b = packBuffer<T>(1, kKC * roundUp(std::min(n, kNC), kNR));
+  for (size_t jc = 0; jc < n; jc += kNC) {
+    size_t nc = std::min(kNC, n - jc);
+    for (size_t pc = 0; pc < k; pc += kKC) {
+      size_t kc = std::min(kKC, k - pc);
+      packB(kc, nc, b + pc * rsb + jc * csb, rsb, csb, packed_b);
+      ThreadPool::ParallelFor(
+          m_blocks, 2 * mc_block * nc * kc, [&](size_t first, size_t last) {
+            T* packed_a = packBuffer<T>(0, kKC * roundUp(mc_block, kMR));
+            for (size_t block = first; block != last; ++block) {
+              size_t ic = block * mc_block;
+              size_t mc = std::min(mc_block, m - ic);
+              packA(mc, kc, alpha, a + ic * rsa + pc * csa, rsa, csa,
+                    packed_a);
+              macroKernel(mc, nc, kc, packed_a, packed_b, c + ic * rsc + jc,
+                          rsc);
+            }
+          });
+    }
+  }
+}
+
+// Copies an h x w block into a zeroed padded_h x padded_w buffer
+void pad(size_t h, size_t w, const double* src, size_t ld, size_t padded_h,
+         size_t padded_w, double* dst) {
+  std::fill_n(dst, padded_h * padded_w, 0.0);
+  for (size_t i = 0; i != h; ++i)
+    std::copy_n(src + i * ld, w, dst + i * padded_w);
+}
+
+// Scratch buffer taken from Matrix::DefaultResource(), so a ResourceScope
+// arena also serves the Strassen temporaries
+class Workspace {
+ private:
+  std::pmr::memory_resource* resource_;
+  size_t size_;
+  double* data_;
+
+ public:
+  explicit Workspace(size_t size)
+      : resource_(Matrix::DefaultResource()),
+        size_(size),
+        data_(static_cast<double*>(resource_->allocate(
+            size * sizeof(double), Matrix::kAlignment))) {}
+  Workspace(const Workspace&) = delete;
+  Workspace& operator=(const Workspace&) = delete;
+  ~Workspace() {
+    resource_->deallocate(data_, size_ * sizeof(double), Matrix::kAlignment);
+  }
+
+  double* get() const { return data_; }
+};
+
+}  // namespace
+
+void SetStrassenCutoff(size_t cutoff) { strassenCutoff().store(cutoff); }
+
+size_t StrassenCutoff() { return strassenCutoff().load(); }
+
+void Multiply(size_t m, size_t n, size_t k, const double* a, size_t lda,
+              const double* b, size_t ldb, double* c, size_t ldc) {
+  size_t cutoff = StrassenCutoff(), depth = 0;
+  if (cutoff != 0)
+    while ((std::min({m, n, k}) >> depth) >= cutoff) ++depth;
+  if (depth == 0) {
+    Gemm(m, n, k, 1.0, a, lda, 1, b, ldb, 1, 0.0, c, ldc);
+    return;
+  }
+  size_t block = size_t(1) << depth;
+  size_t pm = roundUp(m, block), pn = roundUp(n, block);
+  size_t pk = roundUp(k, block);
+  bool pad_a = pm != m || pk != k, pad_b = pk != k || pn != n;
+  bool pad_c = pm != m || pn != n;
+  // One allocation serves every recursion level and the padded copies
+  size_t work_size = workspaceSize(pm, pn, pk, depth);
+  Workspace work(work_size + (pad_a ? pm * pk : 0) + (pad_b ? pk * pn : 0) +
+                 (pad_c ? pm * pn : 0));
+  double* extra = work.get() + work_size;
+  if (pad_a) {
+    pad(m, k, a, lda, pm, pk, extra);
+    a = extra;
+    lda = pk;
+    extra += pm * pk;
+  }
+  if (pad_b) {
+    pad(k, n, b, ldb, pk, pn, extra);
+    b = extra;
+    ldb = pn;
+    extra += pk * pn;
+  }
+  if (!pad_c) {
+    winograd(pm, pn, pk, a, lda, b, ldb, c, ldc, depth, work.get());
+    return;
+  }
+  winograd(pm, pn, pk, a, lda, b, ldb, extra, pn, depth, work.get());
+  for (size_t i = 0; i != m; ++i) std::copy_n(extra + i * pn, n, c + i * ldc);
+}
+
+void Gemm(size_t m, size_t n, size_t k, double alpha, const double* a,
+          size_t rsa, size_t csa, const double* b, size_t rsb, size_t csb,
+          double beta, double* c, size_t rsc) {
+  gemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc);
+}
+
+void Gemm(size_t m, size_t n, size_t k, float alpha, const float* a,
+          size_t rsa, size_t csa, const float* b, size_t rsb, size_t csb,
+          float beta, float* c, size_t rsc) {
+  gemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc);
+}
+
+}  // namespace kernels
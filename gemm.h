@@ -0,0 +1,35 @@
+#ifndef GEMM_H
+#define GEMM_H
+#include <cstddef>
+
+namespace kernels {
+
+// Computes C = alpha * A * B + beta * C, where A is m x k, B is k x n and
+// C is m x n. Every operand is addressed through a row and a column stride,
+// element (i, j) of A is a[i * rsa + j * csa], so transposed operands are
+// passed by swapping strides. C must not overlap A or B.
+void Gemm(size_t m, size_t n, size_t k, double alpha, const double* a,
+          size_t rsa, size_t csa, const double* b, size_t rsb, size_t csb,
+          double beta, double* c, size_t rsc);
+
+// Single precision Gemm, on float tiles twice as wide
+void Gemm(size_t m, size_t n, size_t k, float alpha, const float* a,
+          size_t rsa, size_t csa, const float* b, size_t rsb, size_t csb,
+          float beta, float* c, size_t rsc);
+
+// Computes C = A * B for row-major operands with leading dimensions lda,
+// ldb and ldc. While every dimension is at least StrassenCutoff() the
+// product is split by Strassen-Winograd recursion: 7 half-size products
+// instead of 8, padded with zeros when a dimension is odd. Results then
+// differ from Gemm in the last bits.
+void Multiply(size_t m, size_t n, size_t k, const double* a, size_t lda,
+              const double* b, size_t ldb, double* c, size_t ldc);
+
+// Smallest dimension a product needs for a Strassen-Winograd step, 0
+// disables the recursion for bit-stable results. The default comes from
+// the MATRIX_STRASSEN_CUTOFF environment variable, otherwise 2048.
+void SetStrassenCutoff(size_t cutoff);
+size_t StrassenCutoff();
+
+}  // namespace kernels
+#endif
@@ -0,0 +1,166 @@
+#include "instrument.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace instrument {
+
+namespace {
+
+constexpr const char* kOpNames[kOpCount] = {
+    "construct", "copy",      "move",      "resize",
+    "evaluate",  "sum",       "sub",       "mul_number",
+    "mul_matrix", "equal",    "transpose", "transpose_in_place",
+    "determinant", "complements", "inverse", "solve",
+    "least_squares"};
+
+// Only the owning thread writes, so updates are a relaxed load and store
+// instead of a locked read-modify-write
+struct Counter {
+  std::atomic<uint64_t> value{0};
+
+  void add(uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+  }
+  uint64_t get() const { return value.load(std::memory_order_relaxed); }
+  void reset() { value.store(0, std::memory_order_relaxed); }
+};
+
+struct Counters {
+  Counter calls[kOpCount], flops[kOpCount], bytes[kOpCount],
+      nanoseconds[kOpCount];
+  Counter allocations, allocated_bytes;
+
+  void addTo(Snapshot& snapshot) const {
+    for (size_t op = 0; op != kOpCount; ++op) {
+      snapshot.ops[op].calls += calls[op].get();
+      snapshot.ops[op].flops += flops[op].get();
+      snapshot.ops[op].bytes += bytes[op].get();
+      snapshot.ops[op].nanoseconds += nanoseconds[op].get();
+    }
+    snapshot.allocations += allocations.get();
+    snapshot.allocated_bytes += allocated_bytes.get();
+  }
+
+  void reset() {
+    for (size_t op = 0; op != kOpCount; ++op) {
+      calls[op].reset();
+      flops[op].reset();
+      bytes[op].reset();
+      nanoseconds[op].reset();
+    }
+    allocations.reset();
+    allocated_bytes.reset();
+  }
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<const Counters*> live;
+  // Totals of exited threads
+  Counters retired;
+  Hook hook;
+};
+
+// Never destroyed, threads may exit after static destruction has begun
+Registry& registry() {
+  static Registry* instance = new Registry;
+  return *instance;
+}
+
+// Counters of one thread, registered on first use and folded into the
+// retired totals when the thread exits
+class ThreadCounters {
+ private:
+  Counters counters_;
+
+ public:
+  ThreadCounters() {
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    shared.live.push_back(&counters_);
+  }
+  ~ThreadCounters() {
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    Snapshot totals;
+    counters_.addTo(totals);
+    for (size_t op = 0; op != kOpCount; ++op) {
+      shared.retired.calls[op].add(totals.ops[op].calls);
+      shared.retired.flops[op].add(totals.ops[op].flops);
+      shared.retired.bytes[op].add(totals.ops[op].bytes);
+      shared.retired.nanoseconds[op].add(totals.ops[op].nanoseconds);
+    }
+    shared.retired.allocations.add(totals.allocations);
+    shared.retired.allocated_bytes.add(totals.allocated_bytes);
+    shared.live.erase(
+        std::find(shared.live.begin(), shared.live.end(), &counters_));
+  }
+
+  Counters& get() { return counters_; }
+};
+
+Counters& local() {
+  thread_local ThreadCounters counters;
+  return counters.get();
+}
+
+}  // namespace
+
+const char* OpName(Op op) { return kOpNames[static_cast<size_t>(op)]; }
+
+Snapshot Collect() {
+  Registry& shared = registry();
+  std::lock_guard<std::mutex> lock(shared.mutex);
+  Snapshot snapshot;
+  shared.retired.addTo(snapshot);
+  for (const Counters* counters : shared.live) counters->addTo(snapshot);
+  return snapshot;
+}
+
+void Reset() {
+  Registry& shared = registry();
+  std::lock_guard<std::mutex> lock(shared.mutex);
+  shared.retired.reset();
+  for (const Counters* counters : shared.live)
+    const_cast<Counters*>(counters)->reset();
+}
+
+void SetHook(Hook hook) {
+  Registry& shared = registry();
+  std::lock_guard<std::mutex> lock(shared.mutex);
+  shared.hook = std::move(hook);
+}
+
+void Publish() {
+  Hook hook;
+  {
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    hook = shared.hook;
+  }
+  if (hook) hook(Collect());
+}
+
+OpScope::~OpScope() {
+  auto elapsed = std::chrono::steady_clock::now() - start_;
+  Counters& counters = local();
+  const size_t op = static_cast<size_t>(op_);
+  counters.calls[op].add(1);
+  counters.flops[op].add(flops_);
+  counters.bytes[op].add(bytes_);
+  counters.nanoseconds[op].add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+void RecordAllocation(size_t bytes) {
+  Counters& counters = local();
+  counters.allocations.add(1);
+  counters.allocated_bytes.add(bytes);
+}
+
+}  // namespace instrument
@@ -0,0 +1,105 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Per-operation counters of the Matrix API: calls, floating point
+// operations, bytes moved and wall time, plus heap allocations of matrix
+// storage. Built with MATRIX_INSTRUMENT defined (cmake -DINSTRUMENT=ON);
+// otherwise the recording macros expand to nothing and every counter
+// stays zero.
+//
+// Each thread records into its own counters, Collect() sums them with the
+// totals of threads that have exited. Flops and bytes are the minimal
+// work of the operation, not what the kernels actually execute. Operations
+// that call other operations are counted at every level.
+namespace instrument {
+
+#ifdef MATRIX_INSTRUMENT
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+enum class Op {
+  kConstruct,
+  kCopy,
+  kMove,
+  kResize,
+  kEvaluate,
+  kSum,
+  kSub,
+  kMulNumber,
+  kMulMatrix,
+  kEqual,
+  kTranspose,
+  kTransposeInPlace,
+  kDeterminant,
+  kComplements,
+  kInverse,
+  kSolve,
+  kLeastSquares,
+  kCount
+};
+
+constexpr size_t kOpCount = static_cast<size_t>(Op::kCount);
+
+const char* OpName(Op op);
+
+struct OpStats {
+  uint64_t calls = 0, flops = 0, bytes = 0, nanoseconds = 0;
+};
+
+struct Snapshot {
+  OpStats ops[kOpCount];
+  uint64_t allocations = 0, allocated_bytes = 0;
+
+  const OpStats& operator[](Op op) const {
+    return ops[static_cast<size_t>(op)];
+  }
+};
+
+// Sum over all threads. Counters of running threads are read while they
+// may still be updated, so a snapshot is consistent only when idle.
+Snapshot Collect();
+// Zeroes all counters; updates racing with it may survive
+void Reset();
+
+// Exports to a metrics system: Publish() passes Collect() to the hook
+using Hook = std::function<void(const Snapshot&)>;
+void SetHook(Hook hook);
+void Publish();
+
+// Records one call of op when it goes out of scope
+class OpScope {
+ private:
+  Op op_;
+  uint64_t flops_, bytes_;
+  std::chrono::steady_clock::time_point start_;
+
+ public:
+  OpScope(Op op, uint64_t flops, uint64_t bytes)
+      : op_(op), flops_(flops), bytes_(bytes),
+        start_(std::chrono::steady_clock::now()) {}
+  ~OpScope();
+  OpScope(const OpScope&) = delete;
+  OpScope& operator=(const OpScope&) = delete;
+};
+
+void RecordAllocation(size_t bytes);
+
+}  // namespace instrument
+
+// Recording hooks. Arguments are not evaluated when instrumentation is off.
+#ifdef MATRIX_INSTRUMENT
+#define MATRIX_INSTRUMENT_OP(op, flops, bytes) \
+  ::instrument::OpScope instrument_scope_(::instrument::Op::op, flops, bytes)
+#define MATRIX_INSTRUMENT_ALLOCATION(bytes) \
+  ::instrument::RecordAllocation(bytes)
+#else
+#define MATRIX_INSTRUMENT_OP(op, flops, bytes) static_cast<void>(0)
+#define MATRIX_INSTRUMENT_ALLOCATION(bytes) static_cast<void>(0)
+#endif
+#endif
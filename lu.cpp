@@ -0,0 +1,305 @@
+#include "lu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "gemm.h"
+#include "qr.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Panel width, the trailing update of each panel is one GEMM call
+constexpr size_t kBlock = 64;
+
+const Matrix& checkSquare(const Matrix& matrix) {
+  if (matrix.getRows() != matrix.getCols())
+    throw Matrix::NotSquare("matrix is not square");
+  return matrix;
+}
+
+}  // namespace
+
+LU::LU(const Matrix& matrix)
+    : lu_(checkSquare(matrix)), perm_(matrix.getRows()),
+      pivots_(matrix.getRows()), sign_(1), singular_(false) {
+  std::iota(perm_.begin(), perm_.end(), 0);
+  std::iota(pivots_.begin(), pivots_.end(), 0);
+  factorize();
+}
+
+void LU::factorize() {
+  size_t n = lu_.rows_, ld = lu_.stride_;
+  double* a = lu_.matrix_;
+  for (size_t j = 0; j < n; j += kBlock) {
+    size_t jb = std::min(kBlock, n - j);
+    // Unblocked factorization of the panel a[j:n, j:j+jb]
+    for (size_t c = j; c != j + jb; ++c) {
+      size_t p = c;
+      double max = std::fabs(a[c * ld + c]);
+      for (size_t r = c + 1; r < n; ++r)
+        if (std::fabs(a[r * ld + c]) > max) {
+          max = std::fabs(a[r * ld + c]);
+          p = r;
+        }
+      if (max == 0) {
+        singular_ = true;
+        continue;
+      }
+      if (p != c) {
+        std::swap_ranges(a + c * ld, a + c * ld + n, a + p * ld);
+        std::swap(perm_[c], perm_[p]);
+        pivots_[c] = p;
+        sign_ = -sign_;
+      }
+      const double* pivot_row = a + c * ld;
+      size_t panel_end = j + jb;
+      ThreadPool::ParallelFor(
+          n - c - 1, 2 * (panel_end - c), [&](size_t first, size_t last) {
+            for (size_t r = c + 1 + first; r != c + 1 + last; ++r) {
+              double* row = a + r * ld;
+              double l = row[c] /= pivot_row[c];
+              for (size_t k = c + 1; k != panel_end; ++k)
+                row[k] -= l * pivot_row[k];
+            }
+          });
+    }
+    size_t rest = j + jb;
+    if (rest == n) continue;
+    // U12 = L11^-1 * A12
+    for (size_t r = j + 1; r != rest; ++r) {
+      double* row = a + r * ld;
+      for (size_t k = j; k != r; ++k) {
+        double l = row[k];
+        const double* u_row = a + k * ld;
+        for (size_t col = rest; col != n; ++col) row[col] -= l * u_row[col];
+      }
+    }
+    // A22 -= L21 * U12
+    kernels::Gemm(n - rest, n - rest, jb, -1.0, a + rest * ld + j, ld, 1,
+                  a + j * ld + rest, ld, 1, 1.0, a + rest * ld + rest, ld);
+  }
+}
+
+size_t LU::getSize() const { return lu_.rows_; }
+
+const std::vector<size_t>& LU::getPermutation() const { return perm_; }
+
+Matrix LU::getLower() const {
+  size_t n = lu_.rows_;
+  Matrix lower(n, n);
+  for (size_t i = 0; i != n; ++i) {
+    std::copy_n(lu_.matrix_ + i * lu_.stride_, i,
+                lower.matrix_ + i * lower.stride_);
+    lower.matrix_[i * lower.stride_ + i] = 1;
+  }
+  return lower;
+}
+
+Matrix LU::getUpper() const {
+  size_t n = lu_.rows_;
+  Matrix upper(n, n);
+  for (size_t i = 0; i != n; ++i)
+    std::copy(lu_.matrix_ + i * lu_.stride_ + i,
+              lu_.matrix_ + i * lu_.stride_ + n,
+              upper.matrix_ + i * upper.stride_ + i);
+  return upper;
+}
+
+bool LU::isSingular() const { return singular_; }
+
+double LU::Determinant() const {
+  if (singular_) return 0;
+  double result = sign_;
+  for (size_t i = 0; i != lu_.rows_; ++i)
+    result *= lu_.matrix_[i * lu_.stride_ + i];
+  return result;
+}
+
+// Forward and back substitution in place on x, whose rows already follow
+// the pivoting order. Both run over kBlock rows at a time: the triangle on
+// the diagonal is solved with the columns of x split over threads, the
+// remaining rows are then updated by one GEMM call, so each block of x is
+// streamed once per block instead of once per row.
+void LU::solveFactored(Matrix& x) const {
+  size_t n = lu_.rows_, ld = lu_.stride_, m = x.cols_, ldx = x.stride_;
+  const double* a = lu_.matrix_;
+  double* b = x.matrix_;
+  // L * Y = X, L has a unit diagonal
+  for (size_t j = 0; j < n; j += kBlock) {
+    size_t end = std::min(j + kBlock, n);
+    ThreadPool::ParallelFor(
+        m, (end - j) * (end - j), [&](size_t first, size_t last) {
+          for (size_t i = j + 1; i != end; ++i) {
+            double* row = b + i * ldx;
+            for (size_t k = j; k != i; ++k) {
+              double l = a[i * ld + k];
+              const double* x_row = b + k * ldx;
+              for (size_t col = first; col != last; ++col)
+                row[col] -= l * x_row[col];
+            }
+          }
+        });
+    if (end != n)
+      kernels::Gemm(n - end, m, end - j, -1.0, a + end * ld + j, ld, 1,
+                    b + j * ldx, ldx, 1, 1.0, b + end * ldx, ldx);
+  }
+  // U * X = Y, blocks from the bottom up
+  for (size_t end = n; end != 0;) {
+    size_t j = end > kBlock ? end - kBlock : 0;
+    ThreadPool::ParallelFor(
+        m, (end - j) * (end - j), [&](size_t first, size_t last) {
+          for (size_t i = end; i-- != j;) {
+            double* row = b + i * ldx;
+            for (size_t k = i + 1; k != end; ++k) {
+              double u = a[i * ld + k];
+              const double* x_row = b + k * ldx;
+              for (size_t col = first; col != last; ++col)
+                row[col] -= u * x_row[col];
+            }
+            double pivot = a[i * ld + i];
+            for (size_t col = first; col != last; ++col) row[col] /= pivot;
+          }
+        });
+    if (j != 0)
+      kernels::Gemm(j, m, end - j, -1.0, a + j, ld, 1, b + j * ldx, ldx, 1,
+                    1.0, b, ldx);
+    end = j;
+  }
+}
+
+Matrix LU::Solve(const Matrix& b) const {
+  Matrix x(b);
+  SolveInPlace(x);
+  return x;
+}
+
+void LU::SolveInPlace(Matrix& b) const {
+  if (b.rows_ != lu_.rows_)
+    throw Matrix::DifferentMatrixSize("rows count not equal");
+  if (singular_) throw Matrix::ZeroDeterminant("matrix determinant is 0");
+  b.detach();
+  for (size_t c = 0; c != pivots_.size(); ++c)
+    if (pivots_[c] != c)
+      std::swap_ranges(b.matrix_ + c * b.stride_,
+                       b.matrix_ + c * b.stride_ + b.cols_,
+                       b.matrix_ + pivots_[c] * b.stride_);
+  solveFactored(b);
+}
+
+Matrix LU::InverseMatrix() const {
+  if (singular_) throw Matrix::ZeroDeterminant("matrix determinant is 0");
+  size_t n = lu_.rows_;
+  Matrix x(n, n);
+  for (size_t i = 0; i != n; ++i) x.matrix_[i * x.stride_ + perm_[i]] = 1;
+  solveFactored(x);
+  return x;
+}
+
+// With a single zero pivot u_kk, adj(U) = prod_{i != k} u_ii * x * y^T,
+// where U x = 0 and y^T U = 0 are normalized to x_k = y_k = 1. Then
+// adj(A) = adj(U) * adj(L) * adj(P^T) = sign * adj(U) * L^-1 * P.
+Matrix LU::rankOneAdjugate(size_t k) const {
+  size_t n = lu_.rows_, ld = lu_.stride_;
+  const double* a = lu_.matrix_;
+  std::vector<double> x(n, 0.0), y(n, 0.0), z(n);
+  x[k] = y[k] = 1;
+  double scale = sign_;
+  for (size_t i = 0; i != n; ++i)
+    if (i != k) scale *= a[i * ld + i];
+  for (size_t i = k; i-- != 0;) {
+    double sum = a[i * ld + k];
+    for (size_t j = i + 1; j != k; ++j) sum += a[i * ld + j] * x[j];
+    x[i] = -sum / a[i * ld + i];
+  }
+  for (size_t j = k + 1; j != n; ++j) {
+    double sum = a[k * ld + j];
+    for (size_t i = k + 1; i != j; ++i) sum += y[i] * a[i * ld + j];
+    y[j] = -sum / a[j * ld + j];
+  }
+  // z^T = y^T * L^-1, i.e. L^T z = y with unit diagonal
+  for (size_t i = n; i-- != 0;) {
+    double sum = y[i];
+    for (size_t j = i + 1; j != n; ++j) sum -= a[j * ld + i] * z[j];
+    z[i] = sum;
+  }
+  Matrix adjugate(n, n);
+  for (size_t i = 0; i != n; ++i) {
+    double* row = adjugate.matrix_ + i * adjugate.stride_;
+    double factor = scale * x[i];
+    for (size_t j = 0; j != n; ++j) row[perm_[j]] = factor * z[j];
+  }
+  return adjugate;
+}
+
+// Several zero pivots leave the rank open, a column-pivoted QR
+// A * P = Q * R of A = P^T * L * U settles it. Below rank n - 1 every
+// minor vanishes. At rank n - 1, adj(A) = c * x * y^T with A * x = 0 and
+// y^T * A = 0: x = P * [-R11^-1 * r; 1] for the last column r of R and y
+// the last column of Q. c follows from the one cofactor at the largest
+// entries of x and y.
+Matrix LU::nullSpaceAdjugate() const {
+  size_t n = lu_.rows_;
+  Matrix product = getLower() * getUpper();
+  Matrix original(n, n);
+  for (size_t i = 0; i != n; ++i)
+    std::copy_n(product.matrix_ + i * product.stride_, n,
+                original.matrix_ + perm_[i] * original.stride_);
+  QR qr(original, true);
+  Matrix adjugate(n, n);
+  if (qr.getRank() + 1 < n) return adjugate;
+  Matrix r = qr.getR(), q = qr.getQ();
+  const std::vector<size_t>& columns = qr.getPermutation();
+  std::vector<double> z(n), x(n), y(n);
+  z[n - 1] = 1;
+  for (size_t i = n - 1; i-- != 0;) {
+    const double* row = r.matrix_ + i * r.stride_;
+    double sum = row[n - 1];
+    for (size_t j = i + 1; j != n - 1; ++j) sum += row[j] * z[j];
+    z[i] = -sum / row[i];
+  }
+  for (size_t j = 0; j != n; ++j) x[columns[j]] = z[j];
+  for (size_t i = 0; i != n; ++i) y[i] = q.matrix_[i * q.stride_ + n - 1];
+  auto largest = [](const std::vector<double>& v) {
+    return size_t(std::max_element(v.begin(), v.end(),
+                                   [](double a, double b) {
+                                     return std::fabs(a) < std::fabs(b);
+                                   }) -
+                  v.begin());
+  };
+  size_t k = largest(y), l = largest(x);
+  // adj(A)(l, k) is the cofactor of a_kl
+  Matrix minor(n - 1, n - 1);
+  for (size_t i = 0, row = 0; i != n; ++i) {
+    if (i == k) continue;
+    const double* src = original.matrix_ + i * original.stride_;
+    double* dst = minor.matrix_ + row++ * minor.stride_;
+    std::copy_n(src, l, dst);
+    std::copy(src + l + 1, src + n, dst + l);
+  }
+  double cofactor = LU(minor).Determinant();
+  double scale = ((k + l) % 2 ? -cofactor : cofactor) / (x[l] * y[k]);
+  for (size_t i = 0; i != n; ++i) {
+    double* row = adjugate.matrix_ + i * adjugate.stride_;
+    for (size_t j = 0; j != n; ++j) row[j] = scale * x[i] * y[j];
+  }
+  return adjugate;
+}
+
+Matrix LU::Adjugate() const {
+  size_t n = lu_.rows_, ld = lu_.stride_;
+  if (!singular_) {
+    Matrix adjugate = InverseMatrix();
+    adjugate.MulNumber(Determinant());
+    return adjugate;
+  }
+  size_t zero_pivots = 0, zero_pivot = 0;
+  for (size_t i = 0; i != n; ++i)
+    if (lu_.matrix_[i * ld + i] == 0) {
+      ++zero_pivots;
+      zero_pivot = i;
+    }
+  if (zero_pivots == 1) return rankOneAdjugate(zero_pivot);
+  return nullSpaceAdjugate();
+}
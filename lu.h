@@ -0,0 +1,47 @@
+#ifndef LU_H
+#define LU_H
+#include <cstddef>
+#include <vector>
+
+#include "matrix.h"
+
+// LU factorization with partial pivoting, PA = LU. L (unit diagonal) and
+// U share one matrix, P is kept as a permutation of row indices. Factor
+// once, then take the determinant, inverse and any number of solves from
+// the same factors.
+class LU {
+ private:
+  Matrix lu_;
+  // Row i of PA is row perm_[i] of A
+  std::vector<size_t> perm_;
+  // Row swaps in elimination order, step c exchanged rows c and pivots_[c]
+  std::vector<size_t> pivots_;
+  int sign_;
+  bool singular_;
+
+  void factorize();
+  void solveFactored(Matrix& x) const;
+  Matrix rankOneAdjugate(size_t zero_pivot) const;
+  Matrix nullSpaceAdjugate() const;
+
+ public:
+  explicit LU(const Matrix& matrix);
+
+  size_t getSize() const;
+  const std::vector<size_t>& getPermutation() const;
+  Matrix getLower() const;
+  Matrix getUpper() const;
+  // True when a pivot is exactly zero
+  bool isSingular() const;
+
+  double Determinant() const;
+  // Solves A * X = B for every column of B
+  Matrix Solve(const Matrix& b) const;
+  // Overwrites b with X, without allocating
+  void SolveInPlace(Matrix& b) const;
+  Matrix InverseMatrix() const;
+  // adj(A) = det(A) * A^-1 in O(n^3), from the factors or, when more
+  // than one pivot is zero, from a rank-revealing QR
+  Matrix Adjugate() const;
+};
+#endif
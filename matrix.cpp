@@ -1,105 +1,242 @@
 #include "matrix.h"
 
-const char* Matrix::DifferentMatrixSize::what() const noexcept {
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "gemm.h"
+#include "instrument.h"
+#include "lu.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+const char* MatrixBase::DifferentMatrixSize::what() const noexcept {
   return mes_err.c_str();
 }
 
-const char* Matrix::NotSquare::what() const noexcept {
+const char* MatrixBase::NotSquare::what() const noexcept {
   return mes_err.c_str();
 }
 
-const char* Matrix::ZeroDeterminant::what() const noexcept {
+const char* MatrixBase::ZeroDeterminant::what() const noexcept {
   return mes_err.c_str();
 }
 
-Matrix::Matrix() : Matrix(2, 2){};
+const char* MatrixBase::NotPositiveDefinite::what() const noexcept {
+  return mes_err.c_str();
+}
+
+namespace {
+
+// Innermost ResourceScope of this thread
+thread_local std::pmr::memory_resource* scoped_resource = nullptr;
+
+// Transposes work on square blocks that fit L1 together with their image
+constexpr size_t kTransposeBlock = 32;
+
+// dst[j * ldd + i] = src[i * lds + j] for an h x w block, full tiles go
+// through the SIMD kernel
+void transposeBlock(const double* src, size_t lds, double* dst, size_t ldd,
+                    size_t h, size_t w) {
+  const size_t tile = kernels::kTransposeTile;
+  auto transpose_tile = kernels::Active().transpose_tile;
+  size_t i = 0;
+  for (; i + tile <= h; i += tile) {
+    size_t j = 0;
+    for (; j + tile <= w; j += tile)
+      transpose_tile(src + i * lds + j, lds, dst + j * ldd + i, ldd);
+    for (; j != w; ++j)
+      for (size_t r = i; r != i + tile; ++r)
+        dst[j * ldd + r] = src[r * lds + j];
+  }
+  for (; i != h; ++i)
+    for (size_t j = 0; j != w; ++j) dst[j * ldd + i] = src[i * lds + j];
+}
+
+// c = alpha * a * b + beta * c for operands of matching shapes
+void multiplyInto(double alpha, ConstMatrixView a, ConstMatrixView b,
+                  double beta, MatrixView c) {
+  // The kernel reads A and B while writing C, operands sharing storage
+  // with C are copied first
+  if (overlaps(a, c)) return multiplyInto(alpha, Matrix(a), b, beta, c);
+  if (overlaps(b, c)) return multiplyInto(alpha, a, Matrix(b), beta, c);
+  // The kernel writes C by rows
+  if (c.getColStride() != 1) {
+    Matrix result(c);
+    multiplyInto(alpha, a, b, beta, result);
+    c = result.view();
+    return;
+  }
+  kernels::Gemm(a.getRows(), b.getCols(), a.getCols(), alpha, a.data(),
+                a.getRowStride(), a.getColStride(), b.data(),
+                b.getRowStride(), b.getColStride(), beta, c.data(),
+                c.getRowStride());
+}
+
+}  // namespace
+
+std::pmr::memory_resource* MatrixBase::DefaultResource() {
+  return scoped_resource ? scoped_resource : std::pmr::get_default_resource();
+}
+
+MatrixBase::ResourceScope::ResourceScope(std::pmr::memory_resource* resource)
+    : previous_(scoped_resource) {
+  scoped_resource = resource;
+}
 
-Matrix::Matrix(int rows, int cols){
+MatrixBase::ResourceScope::~ResourceScope() { scoped_resource = previous_; }
+
+Matrix::BasicMatrix() : Matrix(2, 2){};
+
+Matrix::BasicMatrix(int rows, int cols)
+    : Matrix(rows, cols, DefaultResource()) {}
+
+Matrix::BasicMatrix(int rows, int cols, std::pmr::memory_resource* resource) {
+  MATRIX_INSTRUMENT_OP(kConstruct, 0, size_t(rows) * cols * sizeof(double));
   rows_ = rows;
   cols_ = cols;
-  matrix_ = new double*[rows_];
-  for (size_t i = 0; i != rows_; ++i) matrix_[i] = new double[cols_];
+  stride_ = alignedStride(cols_);
+  resource_ = resource;
+  capacity_ = rows_ * stride_;
+  matrix_ = allocate(capacity_);
   zeroes();
 }
 
-Matrix::Matrix(const Matrix& other){
+Matrix::BasicMatrix(size_t rows, size_t cols, Uninitialized) {
+  MATRIX_INSTRUMENT_OP(kConstruct, 0, 0);
+  rows_ = rows;
+  cols_ = cols;
+  stride_ = alignedStride(cols_);
+  resource_ = DefaultResource();
+  capacity_ = rows_ * stride_;
+  matrix_ = allocate(capacity_);
+}
+
+Matrix::BasicMatrix(size_t rows, size_t cols, double* data,
+                    std::shared_ptr<std::pmr::memory_resource> owner)
+    : owner_(std::move(owner)) {
+  rows_ = rows;
+  cols_ = cols;
+  stride_ = alignedStride(cols_);
+  matrix_ = data;
+  resource_ = owner_.get();
+  capacity_ = rows_ * stride_;
+}
+
+Matrix::BasicMatrix(const Matrix& other) {
+  MATRIX_INSTRUMENT_OP(kCopy, 0,
+                       2 * other.rows_ * other.cols_ * sizeof(double));
   cols_ = other.cols_;
   rows_ = other.rows_;
-  matrix_ = new double*[rows_];
-  for (size_t i = 0; i != rows_; ++i) {
-    matrix_[i] = new double[cols_];
-    for (size_t j = 0; j != cols_; ++j) matrix_[i][j] = other.matrix_[i][j];
-  }
+  stride_ = alignedStride(cols_);
+  resource_ = DefaultResource();
+  capacity_ = rows_ * stride_;
+  matrix_ = allocate(capacity_);
+  for (size_t i = 0; i != rows_; ++i)
+    std::copy_n(other.matrix_ + i * other.stride_, cols_,
+                matrix_ + i * stride_);
 }
 
-Matrix::Matrix(Matrix&& other) noexcept {
+Matrix::BasicMatrix(Matrix&& other) noexcept {
+  MATRIX_INSTRUMENT_OP(kMove, 0, 0);
   cols_ = other.cols_;
   rows_ = other.rows_;
+  stride_ = other.stride_;
   matrix_ = other.matrix_;
+  resource_ = other.resource_;
+  capacity_ = other.capacity_;
+  owner_ = std::move(other.owner_);
   other.rows_ = 0;
   other.cols_ = 0;
+  other.stride_ = 0;
+  other.capacity_ = 0;
   other.matrix_ = nullptr;
 }
 
-Matrix::~Matrix() {
-  for (size_t i = 0; i != rows_; ++i) delete[] matrix_[i];
-  delete[] matrix_;
+Matrix::~BasicMatrix() { deallocate(matrix_, capacity_); }
+
+void Matrix::evaluateRows(RowsBody body, void* context) const {
+  MATRIX_INSTRUMENT_OP(kEvaluate, 0, rows_ * cols_ * sizeof(double));
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    body(context, first, last);
+  });
+}
+
+size_t Matrix::alignedStride(size_t cols) {
+  const size_t per_line = kAlignment / sizeof(double);
+  return (cols + per_line - 1) / per_line * per_line;
+}
+
+// A mapped matrix only allocates buffers that replace the mapping, so they
+// come from the resource it continues on after adopt()
+double* Matrix::allocate(size_t size) const {
+  if (size == 0) return nullptr;
+  MATRIX_INSTRUMENT_ALLOCATION(size * sizeof(double));
+  std::pmr::memory_resource* resource = owner_ ? DefaultResource() : resource_;
+  return static_cast<double*>(
+      resource->allocate(size * sizeof(double), kAlignment));
+}
+
+void Matrix::deallocate(double* data, size_t size) const {
+  if (data) resource_->deallocate(data, size * sizeof(double), kAlignment);
+}
+
+void Matrix::adopt(double* data, size_t capacity) {
+  deallocate(matrix_, capacity_);
+  matrix_ = data;
+  capacity_ = capacity;
+  if (owner_) {
+    owner_.reset();
+    resource_ = DefaultResource();
+  }
+}
+
+void Matrix::detach() {
+  if (owner_) *this = Matrix(*this);
 }
 
 void Matrix::setRows(const size_t& rows) {
+  MATRIX_INSTRUMENT_OP(kResize, 0, 2 * rows * cols_ * sizeof(double));
   if (rows == 0) {
-    for (size_t i = 0; i != rows_; ++i) delete[] matrix_[i];
-    delete[] matrix_;
-    matrix_ = nullptr;
+    adopt(nullptr, 0);
     rows_ = rows;
     cols_ = 0;
+    stride_ = 0;
   } else if (rows != rows_) {
-    double** new_matrix = nullptr;
-    if (rows < rows_) {
-      new_matrix = new double*[rows];
-      for (size_t i = 0; i != rows_; ++i) {
-        if (i < rows)
-          new_matrix[i] = matrix_[i];
-        else
-          delete[] matrix_[i];
-      };
-    } else if (rows > rows_) {
-      new_matrix = new double*[rows];
-      for (size_t i = 0; i != rows; ++i) {
-        if (i < rows_)
-          new_matrix[i] = matrix_[i];
-        else {
-          new_matrix[i] = new double[cols_];
-          for (size_t j = 0; j != cols_; j++) new_matrix[i][j] = 0;
-        }
-      }
-    }
-    delete[] matrix_;
-    matrix_ = new_matrix;
+    double* new_matrix = allocate(rows * stride_);
+    size_t kept = std::min(rows, rows_);
+    std::copy_n(matrix_, kept * stride_, new_matrix);
+    std::fill_n(new_matrix + kept * stride_, (rows - kept) * stride_, 0.0);
+    adopt(new_matrix, rows * stride_);
     rows_ = rows;
   }
 }
 
 void Matrix::setCols(const size_t& cols) {
+  MATRIX_INSTRUMENT_OP(kResize, 0, 2 * rows_ * cols * sizeof(double));
   if (cols == 0) {
-    for (size_t i = 0; i != rows_; ++i) delete[] matrix_[i];
-    delete[] matrix_;
-    matrix_ = nullptr;
+    adopt(nullptr, 0);
     rows_ = 0;
     cols_ = cols;
+    stride_ = 0;
   } else if (cols != cols_) {
+    // Mapped rows are never padded in place, see adopt()
+    size_t new_stride = alignedStride(cols);
+    double* new_matrix = new_stride == stride_ && !owner_
+                             ? matrix_
+                             : allocate(rows_ * new_stride);
+    size_t kept = std::min(cols, cols_);
     for (size_t i = 0; i != rows_; ++i) {
-      double* new_column = new double[cols];
-      for (size_t j = 0; j != cols; ++j) {
-        if (j < cols_)
-          new_column[j] = matrix_[i][j];
-        else
-          new_column[j] = 0;
-      }
-      delete[] matrix_[i];
-      matrix_[i] = new_column;
+      double* new_row = new_matrix + i * new_stride;
+      if (new_matrix != matrix_)
+        std::copy_n(matrix_ + i * stride_, kept, new_row);
+      std::fill(new_row + kept, new_row + new_stride, 0.0);
     }
+    if (new_matrix != matrix_) adopt(new_matrix, rows_ * new_stride);
     cols_ = cols;
+    stride_ = new_stride;
   }
 }
 
@@ -107,167 +244,281 @@ size_t Matrix::getRows() const { return rows_; }
 
 size_t Matrix::getCols() const { return cols_; }
 
+size_t Matrix::getStride() const { return stride_; }
+
+std::pmr::memory_resource* Matrix::getResource() const { return resource_; }
+
+MatrixView Matrix::view() { return {matrix_, rows_, cols_, stride_, 1}; }
+
+ConstMatrixView Matrix::view() const {
+  return {matrix_, rows_, cols_, stride_, 1};
+}
+
+MatrixView Matrix::block(size_t row, size_t col, size_t rows, size_t cols) {
+  return view().block(row, col, rows, cols);
+}
+
+ConstMatrixView Matrix::block(size_t row, size_t col, size_t rows,
+                              size_t cols) const {
+  return view().block(row, col, rows, cols);
+}
+
+MatrixView Matrix::row(size_t i) { return view().row(i); }
+
+ConstMatrixView Matrix::row(size_t i) const { return view().row(i); }
+
+MatrixView Matrix::col(size_t j) { return view().col(j); }
+
+ConstMatrixView Matrix::col(size_t j) const { return view().col(j); }
+
+MatrixView Matrix::transposed() { return view().transposed(); }
+
+ConstMatrixView Matrix::transposed() const { return view().transposed(); }
+
 bool Matrix::EqMatrix(const Matrix& other) const {
+  MATRIX_INSTRUMENT_OP(kEqual, 0, 2 * rows_ * cols_ * sizeof(double));
   if (rows_ != other.rows_ || cols_ != other.cols_) {
     return false;
   }
-  for (size_t i = 0; i != rows_; ++i)
-    for (size_t j = 0; j != cols_; ++j)
-      if (matrix_[i][j] != other.matrix_[i][j]) return false;
-  return true;
+  auto equal = kernels::Active().equal;
+  std::atomic<bool> equals{true};
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last && equals.load(std::memory_order_relaxed);
+         ++i)
+      if (!equal(matrix_ + i * stride_, other.matrix_ + i * other.stride_,
+                 cols_))
+        equals.store(false, std::memory_order_relaxed);
+  });
+  return equals.load();
 }
 
 void Matrix::SumMatrix(const Matrix& other) {
+  MATRIX_INSTRUMENT_OP(kSum, rows_ * cols_, 3 * rows_ * cols_ * sizeof(double));
   if (rows_ != other.rows_) throw DifferentMatrixSize("rows count not equal");
   if (cols_ != other.cols_) throw DifferentMatrixSize("cols count not equal");
-  for (size_t i = 0; i < rows_; ++i)
-    for (size_t j = 0; j < cols_; ++j) matrix_[i][j] += other.matrix_[i][j];
+  detach();
+  auto add = kernels::Active().add;
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i)
+      add(matrix_ + i * stride_, other.matrix_ + i * other.stride_, cols_);
+  });
 }
 
 void Matrix::SubMatrix(const Matrix& other) {
+  MATRIX_INSTRUMENT_OP(kSub, rows_ * cols_, 3 * rows_ * cols_ * sizeof(double));
   if (rows_ != other.rows_) throw DifferentMatrixSize("rows count not equal");
   if (cols_ != other.cols_) throw DifferentMatrixSize("cols count not equal");
-  for (size_t i = 0; i < rows_; ++i)
-    for (size_t j = 0; j < cols_; ++j) matrix_[i][j] -= other.matrix_[i][j];
+  detach();
+  auto sub = kernels::Active().sub;
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i)
+      sub(matrix_ + i * stride_, other.matrix_ + i * other.stride_, cols_);
+  });
 }
 
-void Matrix::MulNumber(const double num){
-  for (size_t i = 0; i < rows_; ++i)
-    for (size_t j = 0; j < cols_; ++j) matrix_[i][j] *= num;
+void Matrix::MulNumber(const double num) {
+  MATRIX_INSTRUMENT_OP(kMulNumber, rows_ * cols_,
+                       2 * rows_ * cols_ * sizeof(double));
+  detach();
+  auto scale = kernels::Active().scale;
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i)
+      scale(matrix_ + i * stride_, num, cols_);
+  });
 }
 
 Matrix Matrix::Transpose() const {
-  Matrix new_matrix(cols_, rows_);
-  for (size_t i = 0; i < rows_; ++i)
-    for (size_t j = 0; j < cols_; ++j) new_matrix.matrix_[j][i] = matrix_[i][j];
+  MATRIX_INSTRUMENT_OP(kTranspose, 0, 2 * rows_ * cols_ * sizeof(double));
+  Matrix new_matrix(cols_, rows_, Uninitialized());
+  size_t blocks = (rows_ + kTransposeBlock - 1) / kTransposeBlock;
+  ThreadPool::ParallelFor(
+      blocks, kTransposeBlock * cols_, [&](size_t first, size_t last) {
+        for (size_t block = first; block != last; ++block) {
+          size_t i = block * kTransposeBlock;
+          size_t h = std::min(kTransposeBlock, rows_ - i);
+          for (size_t j = 0; j < cols_; j += kTransposeBlock)
+            transposeBlock(matrix_ + i * stride_ + j, stride_,
+                           new_matrix.matrix_ + j * new_matrix.stride_ + i,
+                           new_matrix.stride_, h,
+                           std::min(kTransposeBlock, cols_ - j));
+        }
+      });
+  for (size_t j = 0; j != cols_; ++j) {
+    double* row = new_matrix.matrix_ + j * new_matrix.stride_;
+    std::fill(row + rows_, row + new_matrix.stride_, 0.0);
+  }
   return new_matrix;
 }
 
-void Matrix::MulMatrix(const Matrix& other){
-  if (cols_ != other.rows_) throw DifferentMatrixSize("cols first op operand not equal rows second op");
-  double **new_matrix = new double*[rows_];
-  for (size_t i = 0; i != rows_; ++i){
-    new_matrix[i] = new double[other.cols_];
-    for (size_t j = 0; j != other.cols_; ++j){
-      new_matrix[i][j] = 0;
-      for (size_t k = 0; k != cols_; ++k)
-        new_matrix[i][j] += matrix_[i][k] * other.matrix_[k][j];}
+void Matrix::TransposeInPlace() {
+  MATRIX_INSTRUMENT_OP(kTransposeInPlace, 0,
+                       2 * rows_ * cols_ * sizeof(double));
+  if (owner_) {
+    *this = Transpose();
+    return;
+  }
+  if (rows_ == cols_) {
+    // Block (bi, bj) trades places with block (bj, bi), each pair is
+    // handled by the task owning its upper block row
+    size_t n = rows_, blocks = (n + kTransposeBlock - 1) / kTransposeBlock;
+    ThreadPool::ParallelFor(
+        blocks, kTransposeBlock * n, [&](size_t first, size_t last) {
+          double buffer[kTransposeBlock * kTransposeBlock];
+          for (size_t bi = first; bi != last; ++bi)
+            for (size_t bj = bi; bj != blocks; ++bj) {
+              size_t i = bi * kTransposeBlock, j = bj * kTransposeBlock;
+              size_t h = std::min(kTransposeBlock, n - i);
+              size_t w = std::min(kTransposeBlock, n - j);
+              double* upper = matrix_ + i * stride_ + j;
+              double* lower = matrix_ + j * stride_ + i;
+              for (size_t r = 0; r != h; ++r)
+                std::copy_n(upper + r * stride_, w,
+                            buffer + r * kTransposeBlock);
+              if (bi != bj)
+                transposeBlock(lower, stride_, upper, stride_, w, h);
+              transposeBlock(buffer, kTransposeBlock, lower, stride_, h, w);
+            }
+        });
+    return;
+  }
+  size_t new_stride = alignedStride(rows_);
+  if (cols_ * new_stride > capacity_) {
+    *this = Transpose();
+    return;
   }
-  for (size_t i = 0; i != rows_; ++i) delete[] matrix_[i];
-  delete[] matrix_;
-  matrix_ = new_matrix;
+  // Pack rows densely, permute the rows_ x cols_ array into cols_ x rows_
+  // one cycle at a time, then spread the rows to the new stride
+  size_t size = rows_ * cols_;
+  for (size_t i = 1; i < rows_; ++i)
+    std::copy_n(matrix_ + i * stride_, cols_, matrix_ + i * cols_);
+  std::vector<bool> moved(size, false);
+  for (size_t start = 1; start + 1 < size; ++start) {
+    if (moved[start]) continue;
+    double value = matrix_[start];
+    size_t k = start;
+    do {
+      // Element (k / cols_, k % cols_) goes to (k % cols_, k / cols_)
+      size_t next = k % cols_ * rows_ + k / cols_;
+      std::swap(value, matrix_[next]);
+      moved[next] = true;
+      k = next;
+    } while (k != start);
+  }
+  for (size_t i = cols_; i-- > 1;) {
+    double* row = matrix_ + i * new_stride;
+    std::copy_backward(matrix_ + i * rows_, matrix_ + (i + 1) * rows_,
+                       row + rows_);
+    std::fill(row + rows_, row + new_stride, 0.0);
+  }
+  if (cols_) std::fill(matrix_ + rows_, matrix_ + new_stride, 0.0);
+  std::swap(rows_, cols_);
+  stride_ = new_stride;
+}
+
+void Matrix::MulMatrix(const Matrix& other) {
+  MATRIX_INSTRUMENT_OP(kMulMatrix, 2 * rows_ * cols_ * other.cols_,
+                       (rows_ * cols_ + other.rows_ * other.cols_ +
+                        rows_ * other.cols_) *
+                           sizeof(double));
+  if (cols_ != other.rows_)
+    throw DifferentMatrixSize("cols first op operand not equal rows second op");
+  size_t new_stride = alignedStride(other.cols_);
+  double* new_matrix = allocate(rows_ * new_stride);
+  kernels::Multiply(rows_, other.cols_, cols_, matrix_, stride_,
+                    other.matrix_, other.stride_, new_matrix, new_stride);
+  adopt(new_matrix, rows_ * new_stride);
   cols_ = other.cols_;
+  stride_ = new_stride;
 }
 
 double Matrix::Determinant() const {
-  if (rows_ != cols_) throw NotSquare("matrix is not square");
-  double result = 1;
-  double *row_ptr;
-  double **new_matrix = new double*[rows_];
-    for (size_t i = 0; i !=rows_; ++i){
-      new_matrix[i] = new double[cols_];
-      for (size_t j = 0; j != cols_; ++j) {
-        new_matrix[i][j] = matrix_[i][j];
-      }
-    }
-    double tmp = 0;
-    for (size_t j = 0; j != cols_; ++j) {
-      for (size_t i = j + 1; i != rows_; ++i) {
-        if (new_matrix[j][j] == 0) {
-          size_t non_zero_row = j;
-          for (size_t k = j + 1; k < rows_; ++k) {
-            if (new_matrix[k][j] != 0) {
-              non_zero_row = k;
-              break;
-            }
-          }
-          if (non_zero_row != j) {
-            row_ptr = new_matrix[non_zero_row];
-            new_matrix[non_zero_row] = new_matrix[j];
-            new_matrix[j] = row_ptr;
-            result *= pow(-1, (non_zero_row - j) + (non_zero_row - j + 1));
-            tmp = (-1) * (new_matrix[i][j] / new_matrix[j][j]);
-          } else
-            tmp = 0;
-        } else
-          tmp = (-1) * (new_matrix[i][j] / new_matrix[j][j]);
-        for (size_t k = 0; k != cols_; k++)
-          new_matrix[i][k] += tmp * new_matrix[j][k];
-      }
-    }
-    for (size_t i = 0; i != rows_; ++i){
-      result *= new_matrix[i][i];
-      delete[] new_matrix[i];
-    }
-    delete[] new_matrix;
-    return result;
+  MATRIX_INSTRUMENT_OP(kDeterminant, 2 * rows_ * rows_ * rows_ / 3,
+                       rows_ * cols_ * sizeof(double));
+  return LU(*this).Determinant();
 }
 
-double Matrix::minor(size_t s, size_t k) const{
+double Matrix::minor(size_t s, size_t k) const {
   Matrix temporary(rows_ - 1, cols_ - 1);
-  size_t a = 0, b = 0;
-  for (size_t i = 0; i != rows_; ++i) {
-    for (size_t j = 0; j != cols_; ++j) {
-      if (i != s) {
-        if (j != k) {
-          temporary(a, b) = matrix_[i][j];
-          b++;
-        }
-      }
-    }
-    if (i != s) a++;
-    b = 0;
+  for (size_t i = 0, a = 0; i != rows_; ++i) {
+    if (i == s) continue;
+    const double* row = matrix_ + i * stride_;
+    double* temporary_row = temporary.matrix_ + a++ * temporary.stride_;
+    std::copy_n(row, k, temporary_row);
+    std::copy(row + k + 1, row + cols_, temporary_row + k);
   }
   return temporary.Determinant();
 }
 
 Matrix Matrix::CalcComplements() const {
-  if (rows_ != cols_) throw NotSquare("matrix is not square");
-  Matrix complement_matrix(rows_, cols_);
-  for (size_t i = 0; i !=  rows_; ++i)
-    for (size_t j = 0; j != cols_; ++j)
-      complement_matrix(i, j) = pow(-1, i + j) * minor(i, j);
-  return complement_matrix;
-}
-
-Matrix Matrix::InverseMatrix() const{
-  double det = Determinant();
-  if (det == 0) throw ZeroDeterminant("matrix determinant is 0");
-  Matrix compliment_matrix = CalcComplements().Transpose();
-  Matrix inverse_matrix(rows_, cols_);
-  for (size_t i = 0; i != rows_; ++i)
-    for (size_t j = 0; j != cols_; ++j)
-      inverse_matrix(i, j) = (1.0 / det) * compliment_matrix(i, j);
-  return inverse_matrix;
+  MATRIX_INSTRUMENT_OP(kComplements, 2 * rows_ * rows_ * rows_,
+                       2 * rows_ * cols_ * sizeof(double));
+  return LU(*this).Adjugate().Transpose();
+}
+
+Matrix Matrix::InverseMatrix() const {
+  MATRIX_INSTRUMENT_OP(kInverse, 2 * rows_ * rows_ * rows_,
+                       2 * rows_ * cols_ * sizeof(double));
+  return LU(*this).InverseMatrix();
+}
+
+Matrix Matrix::Solve(const Matrix& b) const {
+  Matrix x(b);
+  SolveInPlace(x);
+  return x;
+}
+
+void Matrix::SolveInPlace(Matrix& b) const {
+  MATRIX_INSTRUMENT_OP(kSolve, 2 * rows_ * rows_ * (rows_ / 3 + b.cols_),
+                       (rows_ * cols_ + 2 * b.rows_ * b.cols_) *
+                           sizeof(double));
+  LU(*this).SolveInPlace(b);
 }
 
 void Matrix::zeroes() {
-  for (size_t i = 0; i != rows_; ++i)
-    for (size_t j = 0; j != cols_; ++j) matrix_[i][j] = 0;
+  auto fill = kernels::Active().fill;
+  ThreadPool::ParallelFor(rows_, stride_, [&](size_t first, size_t last) {
+    fill(matrix_ + first * stride_, 0.0, (last - first) * stride_);
+  });
 }
 
+// Reuses the current buffer whenever the copy fits in it. Mapped storage
+// is never written through, it may be a read-only file.
 Matrix& Matrix::operator=(const Matrix& other) {
-  for (size_t i = 0; i != rows_; ++i) delete[] matrix_[i];
-  delete[] matrix_;
+  MATRIX_INSTRUMENT_OP(kCopy, 0,
+                       2 * other.rows_ * other.cols_ * sizeof(double));
+  if (&other == this) return *this;
+  size_t stride = alignedStride(other.cols_), size = other.rows_ * stride;
+  if (owner_ || size > capacity_) adopt(allocate(size), size);
   rows_ = other.rows_;
   cols_ = other.cols_;
-  matrix_ = new double*[rows_];
-  for (size_t i = 0; i != rows_; ++i) {
-    matrix_[i] = new double[cols_];
-    for (size_t j = 0; j != cols_; ++j) matrix_[i][j] = other.matrix_[i][j];
+  stride_ = stride;
+  if (other.stride_ == stride) {
+    std::copy_n(other.matrix_, size, matrix_);
+  } else {
+    for (size_t i = 0; i != rows_; ++i) {
+      double* row = matrix_ + i * stride_;
+      std::copy_n(other.matrix_ + i * other.stride_, cols_, row);
+      std::fill(row + cols_, row + stride_, 0.0);
+    }
   }
   return *this;
 }
 
-Matrix& Matrix::operator=(Matrix&& other) {
+Matrix& Matrix::operator=(Matrix&& other) noexcept {
+  MATRIX_INSTRUMENT_OP(kMove, 0, 0);
   if (&other == this) return *this;
-  for (size_t i = 0; i != rows_; ++i) delete[] matrix_[i];
-  delete[] matrix_;
+  deallocate(matrix_, capacity_);
   cols_ = other.cols_;
   rows_ = other.rows_;
+  stride_ = other.stride_;
   matrix_ = other.matrix_;
+  resource_ = other.resource_;
+  capacity_ = other.capacity_;
+  owner_ = std::move(other.owner_);
   other.rows_ = 0;
   other.cols_ = 0;
+  other.stride_ = 0;
+  other.capacity_ = 0;
   other.matrix_ = nullptr;
   return *this;
 }
@@ -275,13 +526,13 @@ Matrix& Matrix::operator=(Matrix&& other) {
 double& Matrix::operator()(size_t i, size_t j) {
   if (i >= rows_) throw std::out_of_range("i out greater then num rows");
   if (j >= cols_) throw std::out_of_range("j out greater then num columns");
-  return matrix_[i][j];
+  return matrix_[i * stride_ + j];
 }
 
 const double& Matrix::operator()(size_t i, size_t j) const {
   if (i >= rows_) throw std::out_of_range("i out greater then num rows");
   if (j >= cols_) throw std::out_of_range("j out greater then num columns");
-  return matrix_[i][j];
+  return matrix_[i * stride_ + j];
 }
 
 Matrix& Matrix::operator+=(const Matrix& other) {
@@ -310,27 +561,46 @@ bool operator==(const Matrix& fst, const Matrix& snd) {
 
 bool operator!=(const Matrix& fst, const Matrix& snd) { return !(fst == snd); }
 
-Matrix operator+(const Matrix& fst, const Matrix& snd){
-  Matrix new_matrix = fst;
-  return new_matrix += snd;
-}
-
-Matrix operator-(const Matrix& fst, const Matrix& snd){
-  Matrix new_matrix = fst;
-  return new_matrix -= snd;
+Matrix Multiply(ConstMatrixView fst, ConstMatrixView snd) {
+  MATRIX_INSTRUMENT_OP(
+      kMulMatrix, 2 * fst.getRows() * fst.getCols() * snd.getCols(),
+      (fst.getRows() * fst.getCols() + snd.getRows() * snd.getCols() +
+       fst.getRows() * snd.getCols()) *
+          sizeof(double));
+  if (fst.getCols() != snd.getRows())
+    throw Matrix::DifferentMatrixSize(
+        "cols first op operand not equal rows second op");
+  size_t m = fst.getRows(), n = snd.getCols(), k = fst.getCols();
+  Matrix result(m, n);
+  MatrixView c = result.view();
+  if (fst.getColStride() == 1 && snd.getColStride() == 1)
+    kernels::Multiply(m, n, k, fst.data(), fst.getRowStride(), snd.data(),
+                      snd.getRowStride(), c.data(), c.getRowStride());
+  else
+    kernels::Gemm(m, n, k, 1.0, fst.data(), fst.getRowStride(),
+                  fst.getColStride(), snd.data(), snd.getRowStride(),
+                  snd.getColStride(), 0.0, c.data(), c.getRowStride());
+  return result;
+}
+
+void Gemm(double alpha, ConstMatrixView a, bool transpose_a,
+          ConstMatrixView b, bool transpose_b, double beta, MatrixView c) {
+  ConstMatrixView op_a = transpose_a ? a.transposed() : a;
+  ConstMatrixView op_b = transpose_b ? b.transposed() : b;
+  const size_t m = op_a.getRows(), n = op_b.getCols(), k = op_a.getCols();
+  MATRIX_INSTRUMENT_OP(kMulMatrix, 2 * m * n * k,
+                       (m * k + k * n + 2 * m * n) * sizeof(double));
+  if (k != op_b.getRows())
+    throw Matrix::DifferentMatrixSize(
+        "cols first op operand not equal rows second op");
+  if (m != c.getRows())
+    throw Matrix::DifferentMatrixSize("rows count not equal");
+  if (n != c.getCols())
+    throw Matrix::DifferentMatrixSize("cols count not equal");
+  // C^T = B^T * A^T when C is stored by columns
+  if (c.getColStride() != 1 && c.getRowStride() == 1)
+    multiplyInto(alpha, op_b.transposed(), op_a.transposed(), beta,
+                 c.transposed());
+  else
+    multiplyInto(alpha, op_a, op_b, beta, c);
 }
-
-Matrix operator*(const Matrix& fst, const double num){
-    Matrix new_matrix = fst;
-    return new_matrix *= num;
-}
-
-Matrix operator*(const double num, const Matrix& fst){
-    Matrix new_matrix = fst;
-    return new_matrix *= num;
-}
-
-Matrix operator*(const Matrix& fst, const Matrix& snd){
-  Matrix new_matrix = fst;
-  return new_matrix *= snd;
-}
\ No newline at end of file
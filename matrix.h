@@ -1,17 +1,42 @@
 #ifndef MATRIX_H
 #define MATRIX_H
+#include <complex>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-class Matrix {
- private:
-  size_t rows_, cols_;
-  double** matrix_;
+#include "thread_pool.h"
 
- protected:
-  // Protected functions may be need in inheritance
-  void zeroes();
-  double minor(size_t s, size_t k) const;
+// Base of everything that can appear in a lazy element-wise expression.
+// Derived types provide getRows(), getCols() and evalRow(i), the latter
+// returning a light object whose operator[](j) yields element (i, j), and
+// aliases(target), whether evaluation reads storage of the view target at
+// other positions than the one being written.
+template <typename Derived>
+class MatrixExpr {
+ public:
+  const Derived& derived() const { return static_cast<const Derived&>(*this); }
+};
+
+template <typename T>
+class BasicMatrix;
+using Matrix = BasicMatrix<double>;
 
+template <typename T>
+class BasicMatrixView;
+using MatrixView = BasicMatrixView<double>;
+using ConstMatrixView = BasicMatrixView<const double>;
+
+// Part of every BasicMatrix that does not depend on the element type, so
+// that e.g. Matrix::NotSquare and BasicMatrix<float>::NotSquare are the
+// same exception.
+class MatrixBase {
  public:
   // Exceptions
   class DifferentMatrixSize : public std::exception {
@@ -40,12 +65,422 @@ class Matrix {
     ZeroDeterminant(std::string err) : mes_err(err){};
     const char* what() const noexcept;
   };
+
+  class NotPositiveDefinite : public std::exception {
+   private:
+    std::string mes_err;
+
+   public:
+    NotPositiveDefinite(std::string err) : mes_err(err){};
+    const char* what() const noexcept;
+  };
+
+  // With MATRIX_CHECKED defined (cmake -DCHECKED=ON) the unchecked
+  // accessors, iterators and spans test their bounds too and throw
+  // std::out_of_range like operator() does; otherwise they compile to a
+  // plain load or store.
+#ifdef MATRIX_CHECKED
+  static constexpr bool kChecked = true;
+#else
+  static constexpr bool kChecked = false;
+#endif
+
+  // Memory resource used by matrices created without an explicit one,
+  // including copies and temporaries inside operations: the innermost
+  // ResourceScope of the calling thread, otherwise
+  // std::pmr::get_default_resource().
+  static std::pmr::memory_resource* DefaultResource();
+
+  // Routes allocations of the current thread to resource while alive, e.g.
+  // a std::pmr::monotonic_buffer_resource that frees all temporaries of a
+  // computation at once. Matrices keep the resource they were allocated
+  // from, so they must not outlive it.
+  class ResourceScope {
+   private:
+    std::pmr::memory_resource* previous_;
+
+   public:
+    explicit ResourceScope(std::pmr::memory_resource* resource);
+    ~ResourceScope();
+    ResourceScope(const ResourceScope&) = delete;
+    ResourceScope& operator=(const ResourceScope&) = delete;
+  };
+};
+
+// Contiguous run of elements, such as one row of a matrix. C++17 stand-in
+// for std::span; indexing is checked only in MATRIX_CHECKED builds.
+template <typename T>
+class Span {
+ private:
+  T* data_;
+  size_t size_;
+
+ public:
+  Span(T* data, size_t size) : data_(data), size_(size) {}
+  // Span<double> converts to Span<const double>
+  template <typename U, typename = std::enable_if_t<
+                            std::is_same<const U, T>::value &&
+                            !std::is_same<U, T>::value>>
+  Span(const Span<U>& other) : Span(other.data(), other.size()) {}
+
+  T& operator[](size_t i) const {
+    if (MatrixBase::kChecked && i >= size_)
+      throw std::out_of_range("index out of span bounds");
+    return data_[i];
+  }
+  T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+};
+
+// Random access iterator over the elements of a row-major buffer whose
+// rows are stride elements apart, in row-major order with the padding at
+// the end of each row skipped. T is double or const double.
+template <typename T>
+class MatrixIterator {
+ private:
+  T* row_;
+  size_t col_, cols_, stride_;
+  // Start of the row past the last one, for checked builds
+  T* end_;
+
+ public:
+  using iterator_category = std::random_access_iterator_tag;
+  using value_type = std::remove_const_t<T>;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T*;
+  using reference = T&;
+
+  MatrixIterator()
+      : row_(nullptr), col_(0), cols_(0), stride_(0), end_(nullptr) {}
+  MatrixIterator(T* row, size_t col, size_t cols, size_t stride, T* end)
+      : row_(row), col_(col), cols_(cols), stride_(stride), end_(end) {}
+  template <typename U, typename = std::enable_if_t<
+                            std::is_same<const U, T>::value &&
+                            !std::is_same<U, T>::value>>
+  MatrixIterator(const MatrixIterator<U>& other)
+      : MatrixIterator(other.getRow(), other.getCol(), other.getCols(),
+                       other.getStride(), other.getEnd()) {}
+
+  T* getRow() const { return row_; }
+  size_t getCol() const { return col_; }
+  size_t getCols() const { return cols_; }
+  size_t getStride() const { return stride_; }
+  T* getEnd() const { return end_; }
+
+  reference operator*() const {
+    if (MatrixBase::kChecked && (col_ >= cols_ || row_ >= end_))
+      throw std::out_of_range("iterator out of matrix bounds");
+    return row_[col_];
+  }
+  pointer operator->() const { return &**this; }
+  reference operator[](difference_type n) const { return *(*this + n); }
+
+  MatrixIterator& operator++() {
+    if (++col_ == cols_) {
+      col_ = 0;
+      row_ += stride_;
+    }
+    return *this;
+  }
+  MatrixIterator operator++(int) {
+    MatrixIterator old = *this;
+    ++*this;
+    return old;
+  }
+  MatrixIterator& operator--() {
+    if (col_ == 0) {
+      col_ = cols_;
+      row_ -= stride_;
+    }
+    --col_;
+    return *this;
+  }
+  MatrixIterator operator--(int) {
+    MatrixIterator old = *this;
+    --*this;
+    return old;
+  }
+  MatrixIterator& operator+=(difference_type n) {
+    if (cols_ == 0) return *this;
+    const difference_type cols = static_cast<difference_type>(cols_);
+    difference_type col = static_cast<difference_type>(col_) + n;
+    difference_type rows = col / cols;
+    col %= cols;
+    if (col < 0) {
+      col += cols;
+      --rows;
+    }
+    row_ += rows * static_cast<difference_type>(stride_);
+    col_ = static_cast<size_t>(col);
+    return *this;
+  }
+  MatrixIterator& operator-=(difference_type n) { return *this += -n; }
+
+  friend MatrixIterator operator+(MatrixIterator it, difference_type n) {
+    return it += n;
+  }
+  friend MatrixIterator operator+(difference_type n, MatrixIterator it) {
+    return it += n;
+  }
+  friend MatrixIterator operator-(MatrixIterator it, difference_type n) {
+    return it -= n;
+  }
+  friend difference_type operator-(const MatrixIterator& fst,
+                                   const MatrixIterator& snd) {
+    difference_type rows =
+        fst.stride_ ? (fst.row_ - snd.row_) /
+                          static_cast<difference_type>(fst.stride_)
+                    : 0;
+    return rows * static_cast<difference_type>(fst.cols_) +
+           static_cast<difference_type>(fst.col_) -
+           static_cast<difference_type>(snd.col_);
+  }
+  friend bool operator==(const MatrixIterator& fst,
+                         const MatrixIterator& snd) {
+    return fst.row_ == snd.row_ && fst.col_ == snd.col_;
+  }
+  friend bool operator!=(const MatrixIterator& fst,
+                         const MatrixIterator& snd) {
+    return !(fst == snd);
+  }
+  friend bool operator<(const MatrixIterator& fst, const MatrixIterator& snd) {
+    return fst.row_ < snd.row_ || (fst.row_ == snd.row_ && fst.col_ < snd.col_);
+  }
+  friend bool operator>(const MatrixIterator& fst, const MatrixIterator& snd) {
+    return snd < fst;
+  }
+  friend bool operator<=(const MatrixIterator& fst,
+                         const MatrixIterator& snd) {
+    return !(snd < fst);
+  }
+  friend bool operator>=(const MatrixIterator& fst,
+                         const MatrixIterator& snd) {
+    return !(fst < snd);
+  }
+};
+
+// Matrix of an arbitrary element type. The members are instantiated in
+// basic_matrix.cpp for float, std::complex<float>, std::complex<double>
+// and the signed integer types; integer matrices compute determinants
+// and complements exactly by fraction-free elimination, float products go
+// through the packed GEMM on float tiles. BasicMatrix<double>, alias
+// Matrix, is specialized below with SIMD kernels, views and lazy
+// expressions.
+template <typename T>
+class BasicMatrix : public MatrixBase {
+ private:
+  // Row-major, element (i, j) at matrix_[i * cols_ + j]
+  size_t rows_, cols_;
+  std::pmr::vector<T> matrix_;
+
+  void checkIndex(size_t i, size_t j) const {
+    if (kChecked && i >= rows_)
+      throw std::out_of_range("i out greater then num rows");
+    if (kChecked && j >= cols_)
+      throw std::out_of_range("j out greater then num columns");
+  }
+
+ public:
+  // Elements in row-major order
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  // Constructors
+  BasicMatrix();
+  BasicMatrix(int rows, int cols);
+  BasicMatrix(int rows, int cols, std::pmr::memory_resource* resource);
+  BasicMatrix(const BasicMatrix& other);
+  BasicMatrix(BasicMatrix&& other) noexcept;
+  // Element-wise conversion, e.g. from Matrix to BasicMatrix<float>
+  template <typename U>
+  explicit BasicMatrix(const BasicMatrix<U>& other);
+
+  // Overloading operators
+  BasicMatrix& operator+=(const BasicMatrix& other);
+  BasicMatrix& operator-=(const BasicMatrix& other);
+  BasicMatrix& operator*=(const T num);
+  BasicMatrix& operator*=(const BasicMatrix& other);
+  BasicMatrix& operator=(const BasicMatrix& other);
+  BasicMatrix& operator=(BasicMatrix&& other) noexcept;
+  T& operator()(size_t i, size_t j);
+  const T& operator()(size_t i, size_t j) const;
+
+  // accessors & mutators
+  size_t getRows() const;
+  size_t getCols() const;
+  std::pmr::memory_resource* getResource() const;
+  void setRows(const size_t& rows);
+  void setCols(const size_t& cols);
+
+  // Access without bounds checks unless built with MATRIX_CHECKED. Rows
+  // are getCols() elements apart in data().
+  T& atUnchecked(size_t i, size_t j) {
+    checkIndex(i, j);
+    return matrix_[i * cols_ + j];
+  }
+  const T& atUnchecked(size_t i, size_t j) const {
+    checkIndex(i, j);
+    return matrix_[i * cols_ + j];
+  }
+  T* data() { return matrix_.data(); }
+  const T* data() const { return matrix_.data(); }
+  T* rowPtr(size_t i) {
+    checkIndex(i, 0);
+    return matrix_.data() + i * cols_;
+  }
+  const T* rowPtr(size_t i) const {
+    checkIndex(i, 0);
+    return matrix_.data() + i * cols_;
+  }
+  Span<T> rowSpan(size_t i) { return {rowPtr(i), cols_}; }
+  Span<const T> rowSpan(size_t i) const { return {rowPtr(i), cols_}; }
+  iterator begin() { return matrix_.data(); }
+  iterator end() { return matrix_.data() + rows_ * cols_; }
+  const_iterator begin() const { return matrix_.data(); }
+  const_iterator end() const { return matrix_.data() + rows_ * cols_; }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  // Member functions
+  void SumMatrix(const BasicMatrix& other);
+  void SubMatrix(const BasicMatrix& other);
+  void MulNumber(const T num);
+  void MulMatrix(const BasicMatrix& other);
+  bool EqMatrix(const BasicMatrix& other) const;
+  BasicMatrix Transpose() const;
+  // Bareiss elimination for integers, partial pivoting otherwise
+  T Determinant() const;
+  BasicMatrix CalcComplements() const;
+  // Integer matrices have an integer inverse only when the determinant is
+  // 1 or -1, other nonzero determinants throw std::domain_error
+  BasicMatrix InverseMatrix() const;
+
+  // Function overloading operators
+  friend bool operator==(const BasicMatrix& fst, const BasicMatrix& snd) {
+    return fst.EqMatrix(snd);
+  }
+  friend bool operator!=(const BasicMatrix& fst, const BasicMatrix& snd) {
+    return !fst.EqMatrix(snd);
+  }
+  // fst is taken by value so a temporary lends its storage to the result,
+  // which is then moved out rather than copied from the returned reference
+  friend BasicMatrix operator+(BasicMatrix fst, const BasicMatrix& snd) {
+    fst += snd;
+    return fst;
+  }
+  friend BasicMatrix operator-(BasicMatrix fst, const BasicMatrix& snd) {
+    fst -= snd;
+    return fst;
+  }
+  friend BasicMatrix operator*(BasicMatrix fst, const BasicMatrix& snd) {
+    fst *= snd;
+    return fst;
+  }
+  friend BasicMatrix operator*(BasicMatrix fst, const T num) {
+    fst *= num;
+    return fst;
+  }
+  friend BasicMatrix operator*(const T num, BasicMatrix fst) {
+    fst *= num;
+    return fst;
+  }
+};
+
+template <typename T>
+template <typename U>
+BasicMatrix<T>::BasicMatrix(const BasicMatrix<U>& other)
+    : BasicMatrix(other.getRows(), other.getCols()) {
+  for (size_t i = 0; i != rows_; ++i)
+    for (size_t j = 0; j != cols_; ++j)
+      matrix_[i * cols_ + j] = static_cast<T>(other(i, j));
+}
+
+extern template class BasicMatrix<float>;
+extern template class BasicMatrix<std::complex<float>>;
+extern template class BasicMatrix<std::complex<double>>;
+extern template class BasicMatrix<int>;
+extern template class BasicMatrix<long>;
+extern template class BasicMatrix<long long>;
+
+template <>
+class BasicMatrix<double> : public MatrixBase,
+                            public MatrixExpr<BasicMatrix<double>> {
+ private:
+  // Elements live in one contiguous buffer aligned to kAlignment bytes,
+  // row i starts at matrix_ + i * stride_, stride_ >= cols_ is rounded up
+  // so that every row starts on an aligned boundary.
+  size_t rows_, cols_, stride_;
+  double* matrix_;
+  // Resource the buffer came from, moves together with the buffer
+  std::pmr::memory_resource* resource_;
+  // Allocated elements, at least rows_ * stride_
+  size_t capacity_;
+  // Set when the matrix owns resource_, e.g. the mapping of a file
+  std::shared_ptr<std::pmr::memory_resource> owner_;
+
+  void checkIndex(size_t i, size_t j) const {
+    if (kChecked && i >= rows_)
+      throw std::out_of_range("i out greater then num rows");
+    if (kChecked && j >= cols_)
+      throw std::out_of_range("j out greater then num columns");
+  }
+  double* rowEnd() const { return matrix_ + rows_ * stride_; }
+  static size_t alignedStride(size_t cols);
+  double* allocate(size_t size) const;
+  void deallocate(double* data, size_t size) const;
+  // Frees the current buffer and takes data from allocate() in its place;
+  // a mapped matrix lets go of the file and continues on DefaultResource()
+  void adopt(double* data, size_t capacity);
+  // Moves mapped elements into a buffer of the matrix's own, for
+  // operations that write the whole matrix: the pages may be read-only
+  void detach();
+
+  struct Uninitialized {};
+  BasicMatrix(size_t rows, size_t cols, Uninitialized);
+  // Adopts rows * alignedStride(cols) elements at data allocated from owner
+  BasicMatrix(size_t rows, size_t cols, double* data,
+              std::shared_ptr<std::pmr::memory_resource> owner);
+
+  template <typename E, typename Op>
+  void evaluate(const MatrixExpr<E>& expr, Op op);
+  // Runs body(context, first, last) over ranges of rows on the thread
+  // pool. Out of line so that evaluations are counted by the library's
+  // instrumentation however the including code was compiled.
+  using RowsBody = void (*)(void* context, size_t first, size_t last);
+  void evaluateRows(RowsBody body, void* context) const;
+  template <typename E>
+  void checkSameSize(const MatrixExpr<E>& expr) const;
+
+  friend class LU;
+
+ protected:
+  // Protected functions may be need in inheritance
+  void zeroes();
+  double minor(size_t s, size_t k) const;
+
+ public:
+  // Elements in row-major order, the padding after each row skipped
+  using iterator = MatrixIterator<double>;
+  using const_iterator = MatrixIterator<const double>;
+
+  // Storage alignment in bytes
+  static constexpr size_t kAlignment = 64;
+
   // Constructors and destructor
-  Matrix();
-  Matrix(int rows, int cols);
-  Matrix(const Matrix& other);
-  Matrix(Matrix&& other) noexcept;
-  ~Matrix();
+  BasicMatrix();
+  BasicMatrix(int rows, int cols);
+  BasicMatrix(int rows, int cols, std::pmr::memory_resource* resource);
+  BasicMatrix(const Matrix& other);
+  BasicMatrix(Matrix&& other) noexcept;
+  template <typename E>
+  BasicMatrix(const MatrixExpr<E>& expr);
+  // Element-wise conversion from the other element types
+  template <typename U>
+  explicit BasicMatrix(const BasicMatrix<U>& other);
+  ~BasicMatrix();
 
   // Overloading operators
   Matrix& operator+=(const Matrix& other);
@@ -53,16 +488,74 @@ class Matrix {
   Matrix& operator*=(const double num);
   Matrix& operator*=(const Matrix& other);
   Matrix& operator=(const Matrix& other);
-  Matrix& operator=(Matrix&& other);
+  Matrix& operator=(Matrix&& other) noexcept;
+  template <typename E>
+  Matrix& operator=(const MatrixExpr<E>& expr);
+  template <typename E>
+  Matrix& operator+=(const MatrixExpr<E>& expr);
+  template <typename E>
+  Matrix& operator-=(const MatrixExpr<E>& expr);
   double& operator()(size_t i, size_t j);
   const double& operator()(size_t i, size_t j) const;
 
   // accessors & mutators
   size_t getRows() const;
   size_t getCols() const;
+  size_t getStride() const;
+  std::pmr::memory_resource* getResource() const;
+  // Whether the elements are the pages of a file, see mmap()
+  bool isMapped() const { return owner_ != nullptr; }
   void setRows(const size_t& rows);
   void setCols(const size_t& cols);
 
+  // Access without bounds checks unless built with MATRIX_CHECKED, for
+  // loops that should run at memory speed. Rows are getStride() elements
+  // apart in data(); a row is contiguous and starts kAlignment-aligned.
+  double& atUnchecked(size_t i, size_t j) {
+    checkIndex(i, j);
+    return matrix_[i * stride_ + j];
+  }
+  const double& atUnchecked(size_t i, size_t j) const {
+    checkIndex(i, j);
+    return matrix_[i * stride_ + j];
+  }
+  double* data() { return matrix_; }
+  const double* data() const { return matrix_; }
+  double* rowPtr(size_t i) {
+    checkIndex(i, 0);
+    return matrix_ + i * stride_;
+  }
+  const double* rowPtr(size_t i) const {
+    checkIndex(i, 0);
+    return matrix_ + i * stride_;
+  }
+  Span<double> rowSpan(size_t i) { return {rowPtr(i), cols_}; }
+  Span<const double> rowSpan(size_t i) const { return {rowPtr(i), cols_}; }
+  iterator begin() { return {matrix_, 0, cols_, stride_, rowEnd()}; }
+  iterator end() { return {rowEnd(), 0, cols_, stride_, rowEnd()}; }
+  const_iterator begin() const {
+    return {matrix_, 0, cols_, stride_, rowEnd()};
+  }
+  const_iterator end() const {
+    return {rowEnd(), 0, cols_, stride_, rowEnd()};
+  }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  // Views over the storage, see BasicMatrixView. block() takes the top
+  // left corner and the shape of the block.
+  MatrixView view();
+  ConstMatrixView view() const;
+  MatrixView block(size_t row, size_t col, size_t rows, size_t cols);
+  ConstMatrixView block(size_t row, size_t col, size_t rows,
+                        size_t cols) const;
+  MatrixView row(size_t i);
+  ConstMatrixView row(size_t i) const;
+  MatrixView col(size_t j);
+  ConstMatrixView col(size_t j) const;
+  MatrixView transposed();
+  ConstMatrixView transposed() const;
+
   // Member functions
   void SumMatrix(const Matrix& other);
   void SubMatrix(const Matrix& other);
@@ -70,17 +563,532 @@ class Matrix {
   void MulMatrix(const Matrix& other);
   bool EqMatrix(const Matrix& other) const;
   Matrix Transpose() const;
+  // Transposes without a second buffer: square matrices swap tiles across
+  // the diagonal, rectangular ones follow permutation cycles when the
+  // transposed layout fits the current allocation, and reallocate
+  // otherwise
+  void TransposeInPlace();
   double Determinant() const;
   Matrix CalcComplements() const;
   Matrix InverseMatrix() const;
+  // Solves A * X = B for every column of B through one LU factorization
+  // of A, far cheaper and more accurate than InverseMatrix() * B. The
+  // in-place form overwrites b and allocates only the factors; to reuse
+  // them across calls, keep an LU.
+  Matrix Solve(const Matrix& b) const;
+  void SolveInPlace(Matrix& b) const;
+  // X minimizing ||A * X - B|| for a matrix with at least as many rows as
+  // columns, through QR. Throws ZeroDeterminant when the columns are
+  // linearly dependent; QR with column pivoting handles that case.
+  Matrix LeastSquares(const Matrix& b) const;
+  // Lower factor L of A = L * L^T, see Cholesky. Throws
+  // NotPositiveDefinite unless the matrix is symmetric positive definite.
+  Matrix CalcCholesky() const;
+  bool IsPositiveDefinite() const;
+
+  // Binary file: a header with shape, element type, byte order, row stride
+  // and an optional checksum, then the rows at an aligned offset exactly as
+  // they are laid out in memory. See matrix_io.cpp.
+  enum class MapMode { kReadOnly, kCopyOnWrite };
+  void save(const std::string& path, bool checksum = false) const;
+  // Matrix backed by the pages of the file, nothing is parsed or copied.
+  // kReadOnly shares the pages with other readers and writing an element
+  // faults, while arithmetic, resizing and assignment first copy the
+  // matrix out of the mapping; kCopyOnWrite keeps writes private to the
+  // matrix. Files in a foreign byte order or row stride are loaded into a
+  // fresh buffer.
+  // verify compares the checksum, if the file has one, reading all pages.
+  static Matrix mmap(const std::string& path,
+                     MapMode mode = MapMode::kReadOnly, bool verify = false);
+  // Out-of-core MulMatrix: multiplies the matrices in files fst and snd
+  // tile by tile into file result, holding at most memory_budget bytes of
+  // tiles while the next tiles are read in the background
+  static void MulMatrixFiles(const std::string& fst, const std::string& snd,
+                             const std::string& result, size_t memory_budget);
+
+  // Expression template hooks
+  struct RowReader {
+    const double* row;
+    double operator[](size_t j) const { return row[j]; }
+  };
+  RowReader evalRow(size_t i) const { return {matrix_ + i * stride_}; }
+  bool aliases(const ConstMatrixView& target) const;
+};
+
+// Lazy element-wise expressions, built from operands marked with Lazy().
+// Matrix operands are held by reference and nested expressions by value;
+// evaluation happens in one pass when the expression is assigned to a
+// Matrix, so an expression must not outlive the matrices it refers to.
+template <typename E>
+struct ExprOperand {
+  using type = const E;
 };
 
+template <>
+struct ExprOperand<Matrix> {
+  using type = const Matrix&;
+};
+
+struct ExprPlus {
+  static double apply(double a, double b) { return a + b; }
+};
+
+struct ExprMinus {
+  static double apply(double a, double b) { return a - b; }
+};
+
+template <typename L, typename R, typename Op>
+class MatrixBinaryExpr : public MatrixExpr<MatrixBinaryExpr<L, R, Op>> {
+ private:
+  typename ExprOperand<L>::type fst_;
+  typename ExprOperand<R>::type snd_;
+
+ public:
+  MatrixBinaryExpr(const L& fst, const R& snd) : fst_(fst), snd_(snd) {
+    if (fst.getRows() != snd.getRows())
+      throw Matrix::DifferentMatrixSize("rows count not equal");
+    if (fst.getCols() != snd.getCols())
+      throw Matrix::DifferentMatrixSize("cols count not equal");
+  }
+  size_t getRows() const { return fst_.getRows(); }
+  size_t getCols() const { return fst_.getCols(); }
+
+  struct RowReader {
+    typename L::RowReader fst;
+    typename R::RowReader snd;
+    double operator[](size_t j) const { return Op::apply(fst[j], snd[j]); }
+  };
+  RowReader evalRow(size_t i) const {
+    return {fst_.evalRow(i), snd_.evalRow(i)};
+  }
+  bool aliases(const ConstMatrixView& target) const {
+    return fst_.aliases(target) || snd_.aliases(target);
+  }
+};
+
+template <typename E>
+class MatrixScaledExpr : public MatrixExpr<MatrixScaledExpr<E>> {
+ private:
+  typename ExprOperand<E>::type expr_;
+  double num_;
+
+ public:
+  MatrixScaledExpr(const E& expr, double num) : expr_(expr), num_(num) {}
+  size_t getRows() const { return expr_.getRows(); }
+  size_t getCols() const { return expr_.getCols(); }
+
+  struct RowReader {
+    typename E::RowReader expr;
+    double num;
+    double operator[](size_t j) const { return expr[j] * num; }
+  };
+  RowReader evalRow(size_t i) const { return {expr_.evalRow(i), num_}; }
+  bool aliases(const ConstMatrixView& target) const {
+    return expr_.aliases(target);
+  }
+};
+
+template <typename E>
+class LazyExpr : public MatrixExpr<LazyExpr<E>> {
+ private:
+  typename ExprOperand<E>::type expr_;
+
+ public:
+  explicit LazyExpr(const E& expr) : expr_(expr) {}
+  size_t getRows() const { return expr_.getRows(); }
+  size_t getCols() const { return expr_.getCols(); }
+
+  using RowReader = typename E::RowReader;
+  RowReader evalRow(size_t i) const { return expr_.evalRow(i); }
+  bool aliases(const ConstMatrixView& target) const {
+    return expr_.aliases(target);
+  }
+};
+
+template <typename E>
+struct IsLazy : std::false_type {};
+template <typename L, typename R, typename Op>
+struct IsLazy<MatrixBinaryExpr<L, R, Op>> : std::true_type {};
+template <typename E>
+struct IsLazy<MatrixScaledExpr<E>> : std::true_type {};
+template <typename E>
+struct IsLazy<LazyExpr<E>> : std::true_type {};
+
+// Expression node when an operand is lazy, otherwise an evaluated Matrix
+template <typename Node, typename... E>
+using ExprResult =
+    std::conditional_t<(IsLazy<E>::value || ...), Node, Matrix>;
+
+template <typename E>
+LazyExpr<E> Lazy(const MatrixExpr<E>& expr) {
+  return LazyExpr<E>(expr.derived());
+}
+
+template <typename E>
+Matrix::BasicMatrix(const MatrixExpr<E>& expr)
+    : Matrix(expr.derived().getRows(), expr.derived().getCols(),
+             Uninitialized()) {
+  evaluate(expr, [](double& dst, double src) { dst = src; });
+}
+
+template <typename U>
+Matrix::BasicMatrix(const BasicMatrix<U>& other)
+    : Matrix(other.getRows(), other.getCols(), Uninitialized()) {
+  for (size_t i = 0; i != rows_; ++i)
+    for (size_t j = 0; j != cols_; ++j)
+      matrix_[i * stride_ + j] = static_cast<double>(other(i, j));
+}
+
+template <typename E>
+Matrix& Matrix::operator=(const MatrixExpr<E>& expr) {
+  const E& e = expr.derived();
+  // Element-wise expressions read (i, j) only to produce (i, j), so
+  // evaluating straight into an operand is safe unless the operand is a
+  // view that puts the elements elsewhere, e.g. the transpose
+  if (owner_ || rows_ != e.getRows() || cols_ != e.getCols() ||
+      e.aliases(view()))
+    return *this = Matrix(expr);
+  evaluate(expr, [](double& dst, double src) { dst = src; });
+  return *this;
+}
+
+template <typename E>
+Matrix& Matrix::operator+=(const MatrixExpr<E>& expr) {
+  checkSameSize(expr);
+  if (owner_ || expr.derived().aliases(view()))
+    return *this = Matrix(
+               MatrixBinaryExpr<Matrix, E, ExprPlus>(*this, expr.derived()));
+  evaluate(expr, [](double& dst, double src) { dst += src; });
+  return *this;
+}
+
+template <typename E>
+Matrix& Matrix::operator-=(const MatrixExpr<E>& expr) {
+  checkSameSize(expr);
+  if (owner_ || expr.derived().aliases(view()))
+    return *this = Matrix(
+               MatrixBinaryExpr<Matrix, E, ExprMinus>(*this, expr.derived()));
+  evaluate(expr, [](double& dst, double src) { dst -= src; });
+  return *this;
+}
+
+template <typename E>
+void Matrix::checkSameSize(const MatrixExpr<E>& expr) const {
+  if (rows_ != expr.derived().getRows())
+    throw DifferentMatrixSize("rows count not equal");
+  if (cols_ != expr.derived().getCols())
+    throw DifferentMatrixSize("cols count not equal");
+}
+
+template <typename E, typename Op>
+void Matrix::evaluate(const MatrixExpr<E>& expr, Op op) {
+  const E& e = expr.derived();
+  auto body = [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i) {
+      double* row = matrix_ + i * stride_;
+      const typename E::RowReader reader = e.evalRow(i);
+      for (size_t j = 0; j != cols_; ++j) op(row[j], reader[j]);
+    }
+  };
+  evaluateRows(
+      [](void* context, size_t first, size_t last) {
+        (*static_cast<decltype(body)*>(context))(first, last);
+      },
+      &body);
+}
+
 // Function overloading operators
 bool operator==(const Matrix& fst, const Matrix& snd);
 bool operator!=(const Matrix& fst, const Matrix& snd);
-Matrix operator+(const Matrix& fst, const Matrix& snd);
-Matrix operator-(const Matrix& fst, const Matrix& snd);
-Matrix operator*(const Matrix& fst, const double num);
-Matrix operator*(const double num, const Matrix& fst);
-Matrix operator*(const Matrix& fst, const Matrix& snd);
+
+// +, - and scalar * of matrices and views return an evaluated Matrix, so
+// (a + b)(i, j), (a + b).Determinant() and auto s = a + b work as for any
+// matrix. Once an operand is lazy the result is an expression node, and a
+// whole expression is evaluated in one pass without temporaries:
+//   Matrix d = Lazy(a) + Lazy(b) - 2.0 * Lazy(c);
+template <typename L, typename R>
+ExprResult<MatrixBinaryExpr<L, R, ExprPlus>, L, R> operator+(
+    const MatrixExpr<L>& fst, const MatrixExpr<R>& snd) {
+  return MatrixBinaryExpr<L, R, ExprPlus>(fst.derived(), snd.derived());
+}
+
+template <typename L, typename R>
+ExprResult<MatrixBinaryExpr<L, R, ExprMinus>, L, R> operator-(
+    const MatrixExpr<L>& fst, const MatrixExpr<R>& snd) {
+  return MatrixBinaryExpr<L, R, ExprMinus>(fst.derived(), snd.derived());
+}
+
+template <typename E>
+ExprResult<MatrixScaledExpr<E>, E> operator*(const MatrixExpr<E>& fst,
+                                             const double num) {
+  return MatrixScaledExpr<E>(fst.derived(), num);
+}
+
+template <typename E>
+ExprResult<MatrixScaledExpr<E>, E> operator*(const double num,
+                                             const MatrixExpr<E>& fst) {
+  return MatrixScaledExpr<E>(fst.derived(), num);
+}
+
+// A temporary Matrix operand is evaluated into and returned, so (a * b) + c
+// or 2 * (a - b) allocate nothing beyond the product or the difference.
+// Unlike the lazy forms, these also never leave an expression referring to
+// a destroyed temporary. A mapped temporary, e.g. Matrix::mmap(path) + b,
+// may be read-only and is only read: the result goes to a new matrix.
+template <typename R>
+Matrix operator+(Matrix&& fst, const MatrixExpr<R>& snd) {
+  if (fst.isMapped())
+    return Matrix(MatrixBinaryExpr<Matrix, R, ExprPlus>(fst, snd.derived()));
+  fst += snd.derived();
+  return std::move(fst);
+}
+
+template <typename L>
+Matrix operator+(const MatrixExpr<L>& fst, Matrix&& snd) {
+  return std::move(snd) + fst.derived();
+}
+
+inline Matrix operator+(Matrix&& fst, Matrix&& snd) {
+  if (fst.isMapped()) return std::move(snd) + fst;
+  fst += snd;
+  return std::move(fst);
+}
+
+template <typename R>
+Matrix operator-(Matrix&& fst, const MatrixExpr<R>& snd) {
+  if (fst.isMapped())
+    return Matrix(MatrixBinaryExpr<Matrix, R, ExprMinus>(fst, snd.derived()));
+  fst -= snd.derived();
+  return std::move(fst);
+}
+
+// Assignment evaluates through a temporary when fst reads snd at other
+// positions, e.g. a.transposed() - std::move(a)
+template <typename L>
+Matrix operator-(const MatrixExpr<L>& fst, Matrix&& snd) {
+  MatrixBinaryExpr<L, Matrix, ExprMinus> difference(fst.derived(), snd);
+  if (snd.isMapped()) return Matrix(difference);
+  snd = difference;
+  return std::move(snd);
+}
+
+inline Matrix operator-(Matrix&& fst, Matrix&& snd) {
+  if (fst.isMapped()) return fst - std::move(snd);
+  fst -= snd;
+  return std::move(fst);
+}
+
+inline Matrix operator*(Matrix&& fst, const double num) {
+  if (fst.isMapped()) return Matrix(MatrixScaledExpr<Matrix>(fst, num));
+  fst.MulNumber(num);
+  return std::move(fst);
+}
+
+inline Matrix operator*(const double num, Matrix&& fst) {
+  return std::move(fst) * num;
+}
+
+// Non-owning window into matrix storage, element (i, j) lives at
+// data[i * row_stride + j * col_stride]. Blocks, rows, columns and the
+// transpose of a Matrix are views over its buffer: they copy nothing, and
+// must not outlive the matrix or anything that reallocates it (setRows,
+// setCols, MulMatrix, assignment of a different shape). T is double or
+// const double.
+template <typename T>
+class BasicMatrixView : public MatrixExpr<BasicMatrixView<T>> {
+ private:
+  using MatrixRef =
+      std::conditional_t<std::is_const<T>::value, const Matrix&, Matrix&>;
+
+  T* data_;
+  size_t rows_, cols_, row_stride_, col_stride_;
+
+  template <typename E, typename Op>
+  void evaluate(const MatrixExpr<E>& expr, Op op) const;
+
+ public:
+  BasicMatrixView(T* data, size_t rows, size_t cols, size_t row_stride,
+                  size_t col_stride)
+      : data_(data), rows_(rows), cols_(cols), row_stride_(row_stride),
+        col_stride_(col_stride) {}
+  BasicMatrixView(MatrixRef matrix) : BasicMatrixView(matrix.view()) {}
+  BasicMatrixView(const BasicMatrixView& other) = default;
+  // MatrixView converts to ConstMatrixView
+  template <typename U, typename = std::enable_if_t<
+                            std::is_same<const U, T>::value &&
+                            !std::is_same<U, T>::value>>
+  BasicMatrixView(const BasicMatrixView<U>& other)
+      : BasicMatrixView(other.data(), other.getRows(), other.getCols(),
+                        other.getRowStride(), other.getColStride()) {}
+
+  // Assignments write through to the viewed elements. A right-hand side
+  // reading them at other positions, a shifted block or the transpose, is
+  // evaluated into a temporary first.
+  const BasicMatrixView& operator=(const BasicMatrixView& other) const;
+  template <typename E>
+  const BasicMatrixView& operator=(const MatrixExpr<E>& expr) const;
+  template <typename E>
+  const BasicMatrixView& operator+=(const MatrixExpr<E>& expr) const;
+  template <typename E>
+  const BasicMatrixView& operator-=(const MatrixExpr<E>& expr) const;
+  const BasicMatrixView& operator*=(const double num) const;
+  T& operator()(size_t i, size_t j) const {
+    if (i >= rows_) throw std::out_of_range("i out greater then num rows");
+    if (j >= cols_) throw std::out_of_range("j out greater then num columns");
+    return data_[i * row_stride_ + j * col_stride_];
+  }
+
+  // accessors
+  T* data() const { return data_; }
+  size_t getRows() const { return rows_; }
+  size_t getCols() const { return cols_; }
+  size_t getRowStride() const { return row_stride_; }
+  size_t getColStride() const { return col_stride_; }
+
+  // Views of the view
+  BasicMatrixView block(size_t row, size_t col, size_t rows,
+                        size_t cols) const {
+    if (row + rows > rows_ || col + cols > cols_)
+      throw std::out_of_range("block out of matrix bounds");
+    return {data_ + row * row_stride_ + col * col_stride_, rows, cols,
+            row_stride_, col_stride_};
+  }
+  BasicMatrixView row(size_t i) const {
+    if (i >= rows_) throw std::out_of_range("i out greater then num rows");
+    return block(i, 0, 1, cols_);
+  }
+  BasicMatrixView col(size_t j) const {
+    if (j >= cols_) throw std::out_of_range("j out greater then num columns");
+    return block(0, j, rows_, 1);
+  }
+  BasicMatrixView transposed() const {
+    return {data_, cols_, rows_, col_stride_, row_stride_};
+  }
+
+  double Determinant() const { return Matrix(*this).Determinant(); }
+
+  // Expression template hooks
+  struct RowReader {
+    const double* row;
+    size_t step;
+    double operator[](size_t j) const { return row[j * step]; }
+  };
+  RowReader evalRow(size_t i) const {
+    return {data_ + i * row_stride_, col_stride_};
+  }
+  bool aliases(const ConstMatrixView& target) const;
+};
+
+// Whether the address ranges spanned by two views intersect
+inline bool overlaps(const ConstMatrixView& fst, const ConstMatrixView& snd) {
+  auto last = [](const ConstMatrixView& view) {
+    return view.data() + (view.getRows() - 1) * view.getRowStride() +
+           (view.getCols() - 1) * view.getColStride();
+  };
+  if (!fst.getRows() || !fst.getCols() || !snd.getRows() || !snd.getCols())
+    return false;
+  return fst.data() <= last(snd) && snd.data() <= last(fst);
+}
+
+template <typename T>
+bool BasicMatrixView<T>::aliases(const ConstMatrixView& target) const {
+  return overlaps(*this, target) &&
+         (data_ != target.data() || row_stride_ != target.getRowStride() ||
+          col_stride_ != target.getColStride());
+}
+
+inline bool Matrix::aliases(const ConstMatrixView& target) const {
+  return view().aliases(target);
+}
+
+template <typename T>
+const BasicMatrixView<T>& BasicMatrixView<T>::operator=(
+    const BasicMatrixView& other) const {
+  return *this = static_cast<const MatrixExpr<BasicMatrixView>&>(other);
+}
+
+template <typename T>
+template <typename E>
+const BasicMatrixView<T>& BasicMatrixView<T>::operator=(
+    const MatrixExpr<E>& expr) const {
+  evaluate(expr, [](double& dst, double src) { dst = src; });
+  return *this;
+}
+
+template <typename T>
+template <typename E>
+const BasicMatrixView<T>& BasicMatrixView<T>::operator+=(
+    const MatrixExpr<E>& expr) const {
+  evaluate(expr, [](double& dst, double src) { dst += src; });
+  return *this;
+}
+
+template <typename T>
+template <typename E>
+const BasicMatrixView<T>& BasicMatrixView<T>::operator-=(
+    const MatrixExpr<E>& expr) const {
+  evaluate(expr, [](double& dst, double src) { dst -= src; });
+  return *this;
+}
+
+template <typename T>
+const BasicMatrixView<T>& BasicMatrixView<T>::operator*=(
+    const double num) const {
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i)
+      for (size_t j = 0; j != cols_; ++j)
+        data_[i * row_stride_ + j * col_stride_] *= num;
+  });
+  return *this;
+}
+
+template <typename T>
+template <typename E, typename Op>
+void BasicMatrixView<T>::evaluate(const MatrixExpr<E>& expr, Op op) const {
+  static_assert(!std::is_const<T>::value, "view is read-only");
+  const E& e = expr.derived();
+  if (rows_ != e.getRows())
+    throw Matrix::DifferentMatrixSize("rows count not equal");
+  if (cols_ != e.getCols())
+    throw Matrix::DifferentMatrixSize("cols count not equal");
+  if (e.aliases(*this)) return evaluate(Matrix(expr), op);
+  ThreadPool::ParallelFor(rows_, cols_, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i) {
+      double* row = data_ + i * row_stride_;
+      const typename E::RowReader reader = e.evalRow(i);
+      for (size_t j = 0; j != cols_; ++j) op(row[j * col_stride_], reader[j]);
+    }
+  });
+}
+
+// Product of two strided operands. Matrices and views are read in place,
+// the Strassen-Winograd path applies when both have unit column stride.
+Matrix Multiply(ConstMatrixView fst, ConstMatrixView snd);
+
+// C = alpha * op(A) * op(B) + beta * C, op transposing its operand when
+// the flag is set, written straight into the storage behind c. Nothing is
+// allocated unless an operand overlaps C or C has no unit stride; with
+// beta == 0 the previous contents of C are ignored. Accumulating a
+// product is Gemm(1, a, false, b, false, 1, c).
+void Gemm(double alpha, ConstMatrixView a, bool transpose_a,
+          ConstMatrixView b, bool transpose_b, double beta, MatrixView c);
+
+// Dense operands of a product, other expressions are evaluated first
+inline const Matrix& denseOperand(const Matrix& matrix) { return matrix; }
+
+template <typename T>
+BasicMatrixView<T> denseOperand(const BasicMatrixView<T>& view) {
+  return view;
+}
+
+template <typename E>
+Matrix denseOperand(const MatrixExpr<E>& expr) {
+  return expr.derived();
+}
+
+// Matrix products are not element-wise
+template <typename L, typename R>
+Matrix operator*(const MatrixExpr<L>& fst, const MatrixExpr<R>& snd) {
+  return Multiply(denseOperand(fst.derived()), denseOperand(snd.derived()));
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,336 @@
+#include "matrix_batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "simd.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATRIX_X86 1
+#endif
+
+// Group kernels are force-inlined into one entry point per instruction
+// set, so their loops over the lanes compile to that set's registers
+#define MATRIX_BATCH_INLINE inline __attribute__((always_inline))
+
+namespace {
+
+constexpr size_t kLanes = MatrixBatch::kLanes;
+
+// c = a * b for one group, a is m x k and b is k x n
+MATRIX_BATCH_INLINE void mulGroup(const double* a, const double* b, double* c,
+                                  size_t m, size_t n, size_t k) {
+  for (size_t i = 0; i != m; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      double acc[kLanes] = {};
+      for (size_t p = 0; p != k; ++p) {
+        const double* a_ip = a + (i * k + p) * kLanes;
+        const double* b_pj = b + (p * n + j) * kLanes;
+        for (size_t l = 0; l != kLanes; ++l) acc[l] += a_ip[l] * b_pj[l];
+      }
+      std::copy_n(acc, kLanes, c + (i * n + j) * kLanes);
+    }
+}
+
+// Picks the partial pivot of column k in every lane and swaps it into row
+// k of w (and of x, when given). Pivoting is per lane, the swaps are the
+// only scalar part of the elimination.
+MATRIX_BATCH_INLINE void pivotGroup(double* w, double* x, size_t n, size_t k,
+                                    double* sign) {
+  for (size_t l = 0; l != kLanes; ++l) {
+    size_t p = k;
+    double best = std::fabs(w[(k * n + k) * kLanes + l]);
+    for (size_t r = k + 1; r != n; ++r)
+      if (std::fabs(w[(r * n + k) * kLanes + l]) > best) {
+        best = std::fabs(w[(r * n + k) * kLanes + l]);
+        p = r;
+      }
+    if (p == k) continue;
+    sign[l] = -sign[l];
+    size_t from = k * n * kLanes + l, to = p * n * kLanes + l;
+    for (size_t c = 0; c != n * kLanes; c += kLanes) {
+      std::swap(w[from + c], w[to + c]);
+      if (x) std::swap(x[from + c], x[to + c]);
+    }
+  }
+}
+
+// Gaussian elimination of an n x n group held in w
+MATRIX_BATCH_INLINE void determinantGroup(double* w, size_t n, double* det) {
+  std::fill_n(det, kLanes, 1.0);
+  for (size_t k = 0; k != n; ++k) {
+    pivotGroup(w, nullptr, n, k, det);
+    double inverse[kLanes];
+    const double* pivot_row = w + k * n * kLanes;
+    for (size_t l = 0; l != kLanes; ++l) {
+      double pivot = pivot_row[k * kLanes + l];
+      det[l] *= pivot;
+      inverse[l] = pivot != 0 ? 1 / pivot : 0;
+    }
+    for (size_t r = k + 1; r != n; ++r) {
+      double* row = w + r * n * kLanes;
+      double factor[kLanes];
+      for (size_t l = 0; l != kLanes; ++l)
+        factor[l] = row[k * kLanes + l] * inverse[l];
+      for (size_t c = k + 1; c != n; ++c)
+        for (size_t l = 0; l != kLanes; ++l)
+          row[c * kLanes + l] -= factor[l] * pivot_row[c * kLanes + l];
+    }
+  }
+}
+
+// Gauss-Jordan elimination of the group in w, x starts as the identity
+// and ends as the inverse. Lanes hitting a zero pivot are flagged in
+// singular.
+MATRIX_BATCH_INLINE void inverseGroup(double* w, double* x, size_t n,
+                                      bool* singular) {
+  double sign[kLanes];
+  std::fill_n(sign, kLanes, 1.0);
+  std::fill_n(singular, kLanes, false);
+  for (size_t k = 0; k != n; ++k) {
+    pivotGroup(w, x, n, k, sign);
+    double* w_k = w + k * n * kLanes;
+    double* x_k = x + k * n * kLanes;
+    double inverse[kLanes];
+    for (size_t l = 0; l != kLanes; ++l) {
+      double pivot = w_k[k * kLanes + l];
+      singular[l] = singular[l] || pivot == 0;
+      inverse[l] = pivot != 0 ? 1 / pivot : 0;
+    }
+    for (size_t c = 0; c != n; ++c)
+      for (size_t l = 0; l != kLanes; ++l) {
+        w_k[c * kLanes + l] *= inverse[l];
+        x_k[c * kLanes + l] *= inverse[l];
+      }
+    for (size_t r = 0; r != n; ++r) {
+      if (r == k) continue;
+      double* w_r = w + r * n * kLanes;
+      double* x_r = x + r * n * kLanes;
+      double factor[kLanes];
+      for (size_t l = 0; l != kLanes; ++l) factor[l] = w_r[k * kLanes + l];
+      for (size_t c = 0; c != n; ++c)
+        for (size_t l = 0; l != kLanes; ++l) {
+          w_r[c * kLanes + l] -= factor[l] * w_k[c * kLanes + l];
+          x_r[c * kLanes + l] -= factor[l] * x_k[c * kLanes + l];
+        }
+    }
+  }
+}
+
+struct BatchKernels {
+  void (*mul)(const double* a, const double* b, double* c, size_t m,
+              size_t n, size_t k);
+  void (*determinant)(double* w, size_t n, double* det);
+  void (*inverse)(double* w, double* x, size_t n, bool* singular);
+};
+
+void mulDefault(const double* a, const double* b, double* c, size_t m,
+                size_t n, size_t k) {
+  mulGroup(a, b, c, m, n, k);
+}
+
+void determinantDefault(double* w, size_t n, double* det) {
+  determinantGroup(w, n, det);
+}
+
+void inverseDefault(double* w, double* x, size_t n, bool* singular) {
+  inverseGroup(w, x, n, singular);
+}
+
+#ifdef MATRIX_X86
+
+__attribute__((target("avx2,fma"))) void mulAvx2(const double* a,
+                                                 const double* b, double* c,
+                                                 size_t m, size_t n,
+                                                 size_t k) {
+  mulGroup(a, b, c, m, n, k);
+}
+
+__attribute__((target("avx2,fma"))) void determinantAvx2(double* w, size_t n,
+                                                         double* det) {
+  determinantGroup(w, n, det);
+}
+
+__attribute__((target("avx2,fma"))) void inverseAvx2(double* w, double* x,
+                                                     size_t n,
+                                                     bool* singular) {
+  inverseGroup(w, x, n, singular);
+}
+
+__attribute__((target("avx512f"))) void mulAvx512(const double* a,
+                                                  const double* b, double* c,
+                                                  size_t m, size_t n,
+                                                  size_t k) {
+  mulGroup(a, b, c, m, n, k);
+}
+
+__attribute__((target("avx512f"))) void determinantAvx512(double* w, size_t n,
+                                                          double* det) {
+  determinantGroup(w, n, det);
+}
+
+__attribute__((target("avx512f"))) void inverseAvx512(double* w, double* x,
+                                                      size_t n,
+                                                      bool* singular) {
+  inverseGroup(w, x, n, singular);
+}
+
+#endif
+
+const BatchKernels& batchKernels() {
+  static const BatchKernels kDefault = {mulDefault, determinantDefault,
+                                        inverseDefault};
+#ifdef MATRIX_X86
+  static const BatchKernels kAvx2 = {mulAvx2, determinantAvx2, inverseAvx2};
+  static const BatchKernels kAvx512 = {mulAvx512, determinantAvx512,
+                                       inverseAvx512};
+  switch (kernels::Active().isa) {
+    case kernels::Isa::kAvx512:
+      return kAvx512;
+    case kernels::Isa::kAvx2:
+      return kAvx2;
+    default:
+      break;
+  }
+#endif
+  return kDefault;
+}
+
+}  // namespace
+
+MatrixBatch::MatrixBatch(size_t count, size_t rows, size_t cols)
+    : count_(count), rows_(rows), cols_(cols),
+      data_((count + kLanes - 1) / kLanes * kLanes * rows * cols, 0.0) {}
+
+size_t MatrixBatch::groups() const { return (count_ + kLanes - 1) / kLanes; }
+
+size_t MatrixBatch::index(size_t b, size_t i, size_t j) const {
+  return ((b / kLanes) * rows_ * cols_ + i * cols_ + j) * kLanes + b % kLanes;
+}
+
+double& MatrixBatch::operator()(size_t b, size_t i, size_t j) {
+  if (b >= count_) throw std::out_of_range("b out greater then batch size");
+  if (i >= rows_) throw std::out_of_range("i out greater then num rows");
+  if (j >= cols_) throw std::out_of_range("j out greater then num columns");
+  return data_[index(b, i, j)];
+}
+
+const double& MatrixBatch::operator()(size_t b, size_t i, size_t j) const {
+  if (b >= count_) throw std::out_of_range("b out greater then batch size");
+  if (i >= rows_) throw std::out_of_range("i out greater then num rows");
+  if (j >= cols_) throw std::out_of_range("j out greater then num columns");
+  return data_[index(b, i, j)];
+}
+
+size_t MatrixBatch::getCount() const { return count_; }
+
+size_t MatrixBatch::getRows() const { return rows_; }
+
+size_t MatrixBatch::getCols() const { return cols_; }
+
+Matrix MatrixBatch::getMatrix(size_t b) const {
+  if (b >= count_) throw std::out_of_range("b out greater then batch size");
+  Matrix matrix(rows_, cols_);
+  for (size_t i = 0; i != rows_; ++i) {
+    double* row = matrix.row(i).data();
+    for (size_t j = 0; j != cols_; ++j) row[j] = data_[index(b, i, j)];
+  }
+  return matrix;
+}
+
+void MatrixBatch::setMatrix(size_t b, const Matrix& matrix) {
+  if (b >= count_) throw std::out_of_range("b out greater then batch size");
+  if (matrix.getRows() != rows_)
+    throw Matrix::DifferentMatrixSize("rows count not equal");
+  if (matrix.getCols() != cols_)
+    throw Matrix::DifferentMatrixSize("cols count not equal");
+  for (size_t i = 0; i != rows_; ++i) {
+    const double* row = matrix.row(i).data();
+    for (size_t j = 0; j != cols_; ++j) data_[index(b, i, j)] = row[j];
+  }
+}
+
+void MatrixBatch::MulMatrix(const MatrixBatch& other) {
+  *this = *this * other;
+}
+
+MatrixBatch MatrixBatch::Transpose() const {
+  MatrixBatch result(count_, cols_, rows_);
+  size_t size = rows_ * cols_ * kLanes;
+  ThreadPool::ParallelFor(groups(), size, [&](size_t first, size_t last) {
+    for (size_t g = first; g != last; ++g) {
+      const double* src = data_.data() + g * size;
+      double* dst = result.data_.data() + g * size;
+      for (size_t i = 0; i != rows_; ++i)
+        for (size_t j = 0; j != cols_; ++j)
+          std::copy_n(src + (i * cols_ + j) * kLanes, kLanes,
+                      dst + (j * rows_ + i) * kLanes);
+    }
+  });
+  return result;
+}
+
+std::vector<double> MatrixBatch::Determinant() const {
+  if (rows_ != cols_) throw Matrix::NotSquare("matrix is not square");
+  std::vector<double> result(groups() * kLanes);
+  auto determinant = batchKernels().determinant;
+  size_t n = rows_, size = n * n * kLanes;
+  ThreadPool::ParallelFor(groups(), size * n, [&](size_t first, size_t last) {
+    std::vector<double> work(size);
+    for (size_t g = first; g != last; ++g) {
+      std::copy_n(data_.data() + g * size, size, work.data());
+      determinant(work.data(), n, result.data() + g * kLanes);
+    }
+  });
+  result.resize(count_);
+  return result;
+}
+
+MatrixBatch MatrixBatch::InverseMatrix() const {
+  if (rows_ != cols_) throw Matrix::NotSquare("matrix is not square");
+  MatrixBatch result(count_, rows_, cols_);
+  auto inverse = batchKernels().inverse;
+  size_t n = rows_, size = n * n * kLanes;
+  ThreadPool::ParallelFor(
+      groups(), 2 * size * n, [&](size_t first, size_t last) {
+        std::vector<double> work(size);
+        bool singular[kLanes];
+        for (size_t g = first; g != last; ++g) {
+          std::copy_n(data_.data() + g * size, size, work.data());
+          double* x = result.data_.data() + g * size;
+          for (size_t i = 0; i != n; ++i)
+            std::fill_n(x + (i * n + i) * kLanes, kLanes, 1.0);
+          inverse(work.data(), x, n, singular);
+          // Padding lanes of the last group are zero matrices
+          size_t lanes = std::min(kLanes, count_ - g * kLanes);
+          for (size_t l = 0; l != lanes; ++l)
+            if (singular[l])
+              throw Matrix::ZeroDeterminant("matrix determinant is 0");
+        }
+      });
+  return result;
+}
+
+MatrixBatch operator*(const MatrixBatch& fst, const MatrixBatch& snd) {
+  if (fst.count_ != snd.count_)
+    throw Matrix::DifferentMatrixSize("batch sizes not equal");
+  if (fst.cols_ != snd.rows_)
+    throw Matrix::DifferentMatrixSize(
+        "cols first op operand not equal rows second op");
+  MatrixBatch result(fst.count_, fst.rows_, snd.cols_);
+  auto mul = batchKernels().mul;
+  size_t a_size = fst.rows_ * fst.cols_ * MatrixBatch::kLanes;
+  size_t b_size = snd.rows_ * snd.cols_ * MatrixBatch::kLanes;
+  size_t c_size = fst.rows_ * snd.cols_ * MatrixBatch::kLanes;
+  ThreadPool::ParallelFor(
+      fst.groups(), 2 * c_size * fst.cols_, [&](size_t first, size_t last) {
+        for (size_t g = first; g != last; ++g)
+          mul(fst.data_.data() + g * a_size, snd.data_.data() + g * b_size,
+              result.data_.data() + g * c_size, fst.rows_, snd.cols_,
+              fst.cols_);
+      });
+  return result;
+}
@@ -0,0 +1,50 @@
+#ifndef MATRIX_BATCH_H
+#define MATRIX_BATCH_H
+#include <cstddef>
+#include <vector>
+
+#include "matrix.h"
+
+// Many matrices of one shape, stored interleaved in groups of kLanes:
+// element (i, j) of matrix b lives at
+//   data[((b / kLanes) * rows * cols + i * cols + j) * kLanes + b % kLanes]
+// so every kernel works on kLanes matrices at once with vector registers
+// running across the batch. Groups are split over the thread pool.
+class MatrixBatch {
+ private:
+  size_t count_, rows_, cols_;
+  std::vector<double> data_;
+
+  size_t groups() const;
+  size_t index(size_t b, size_t i, size_t j) const;
+
+ public:
+  // Matrices per group, the last group is padded with zero matrices
+  static constexpr size_t kLanes = 8;
+
+  // Constructors
+  MatrixBatch(size_t count, size_t rows, size_t cols);
+
+  double& operator()(size_t b, size_t i, size_t j);
+  const double& operator()(size_t b, size_t i, size_t j) const;
+
+  // accessors & mutators
+  size_t getCount() const;
+  size_t getRows() const;
+  size_t getCols() const;
+  Matrix getMatrix(size_t b) const;
+  void setMatrix(size_t b, const Matrix& matrix);
+
+  // Member functions, each applied to every matrix of the batch
+  void MulMatrix(const MatrixBatch& other);
+  MatrixBatch Transpose() const;
+  std::vector<double> Determinant() const;
+  MatrixBatch InverseMatrix() const;
+
+  friend MatrixBatch operator*(const MatrixBatch& fst,
+                               const MatrixBatch& snd);
+};
+
+// Function overloading operators
+MatrixBatch operator*(const MatrixBatch& fst, const MatrixBatch& snd);
+#endif
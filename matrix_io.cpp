@@ -0,0 +1,419 @@
+#include "matrix.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "gemm.h"
+
+namespace {
+
+// File layout, version 1:
+//   FileHeader, written in the byte order of the machine that saved it
+//   zero bytes up to payload_offset, a multiple of Matrix::kAlignment
+//   rows * row_stride elements, row i at payload_offset + i * row_stride * 8,
+//   the row_stride - cols elements past the end of a row are zero
+// The checksum is FNV-1a over the 64-bit words of the payload taken in the
+// byte order of the writer, i.e. over the element bit patterns.
+constexpr char kMagic[8] = {'M', 'A', 'T', 'R', 'I', 'X', '\0', '\0'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+constexpr uint32_t kFloat64 = 1;
+constexpr uint32_t kRowMajor = 0;
+constexpr uint32_t kHasChecksum = 1;
+
+constexpr uint64_t kFnvBasis = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version, byte_order, dtype, layout, flags, reserved;
+  uint64_t rows, cols, row_stride, payload_offset, checksum;
+};
+
+static_assert(sizeof(FileHeader) == 72, "header must not have padding");
+
+constexpr uint64_t kPayloadOffset =
+    (sizeof(FileHeader) + Matrix::kAlignment - 1) / Matrix::kAlignment *
+    Matrix::kAlignment;
+
+void swapHeader(FileHeader& header) {
+  for (uint32_t* field : {&header.version, &header.byte_order, &header.dtype,
+                          &header.layout, &header.flags, &header.reserved})
+    *field = __builtin_bswap32(*field);
+  for (uint64_t* field : {&header.rows, &header.cols, &header.row_stride,
+                          &header.payload_offset, &header.checksum})
+    *field = __builtin_bswap64(*field);
+}
+
+FileHeader makeHeader(size_t rows, size_t cols, size_t row_stride) {
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byte_order = kByteOrderMark;
+  header.dtype = kFloat64;
+  header.layout = kRowMajor;
+  header.rows = rows;
+  header.cols = cols;
+  header.row_stride = row_stride;
+  header.payload_offset = kPayloadOffset;
+  return header;
+}
+
+void swapWords(double* data, size_t count) {
+  for (size_t i = 0; i != count; ++i) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    word = __builtin_bswap64(word);
+    std::memcpy(data + i, &word, sizeof(word));
+  }
+}
+
+uint64_t hashWords(uint64_t hash, const void* data, size_t count,
+                   bool swapped) {
+  const char* bytes = static_cast<const char*>(data);
+  for (size_t i = 0; i != count; ++i) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i * sizeof(word), sizeof(word));
+    hash ^= swapped ? __builtin_bswap64(word) : word;
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+// Owns a mapping of a whole file. The payload is handed to a Matrix as if
+// allocated from this resource: giving it back is a no-op, the pages go
+// away with munmap once the last matrix holding the resource is gone.
+// Buffers the matrix allocates later come from upstream.
+class MappedFile : public std::pmr::memory_resource {
+ private:
+  char* base_;
+  size_t size_;
+  std::pmr::memory_resource* upstream_;
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    return upstream_->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    char* address = static_cast<char*>(p);
+    if (address >= base_ && address < base_ + size_) return;
+    upstream_->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+ public:
+  MappedFile(void* base, size_t size, std::pmr::memory_resource* upstream)
+      : base_(static_cast<char*>(base)), size_(size), upstream_(upstream) {}
+  ~MappedFile() override { munmap(base_, size_); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return base_; }
+  size_t size() const { return size_; }
+};
+
+[[noreturn]] void throwFormat(const std::string& path, const char* what) {
+  throw std::runtime_error(path + ": " + what);
+}
+
+// Validates the header at the start of a file of size bytes and converts
+// it to the native byte order. Returns whether the file is byte-swapped.
+bool readHeader(const std::string& path, const char* data, size_t size,
+                FileHeader& header) {
+  if (size < sizeof(FileHeader)) throwFormat(path, "not a matrix file");
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+    throwFormat(path, "not a matrix file");
+  const bool swapped = header.byte_order == __builtin_bswap32(kByteOrderMark);
+  if (swapped) swapHeader(header);
+  if (header.byte_order != kByteOrderMark)
+    throwFormat(path, "unknown byte order");
+  if (header.version != kVersion) throwFormat(path, "unsupported version");
+  if (header.dtype != kFloat64) throwFormat(path, "element type not double");
+  if (header.layout != kRowMajor || header.row_stride < header.cols)
+    throwFormat(path, "unsupported layout");
+  const uint64_t elements = header.rows * header.row_stride;
+  if (header.row_stride && elements / header.row_stride != header.rows)
+    throwFormat(path, "corrupt shape");
+  if (header.payload_offset > size ||
+      elements > (size - header.payload_offset) / sizeof(double))
+    throwFormat(path, "truncated");
+  return swapped;
+}
+
+[[noreturn]] void throwSystem(const std::string& path) {
+  throw std::system_error(errno, std::generic_category(), path);
+}
+
+// Closes a file descriptor on scope exit
+class FileDescriptor {
+ private:
+  int fd_;
+
+ public:
+  explicit FileDescriptor(int fd) : fd_(fd) {}
+  ~FileDescriptor() {
+    if (fd_ >= 0) close(fd_);
+  }
+  FileDescriptor(const FileDescriptor&) = delete;
+  FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+  int get() const { return fd_; }
+};
+
+void readFully(int fd, const std::string& path, void* data, size_t bytes,
+               uint64_t offset) {
+  char* out = static_cast<char*>(data);
+  while (bytes) {
+    ssize_t done = pread(fd, out, bytes, offset);
+    if (done < 0 && errno == EINTR) continue;
+    if (done < 0) throwSystem(path);
+    if (done == 0) throwFormat(path, "truncated");
+    out += done;
+    bytes -= done;
+    offset += done;
+  }
+}
+
+void writeFully(int fd, const std::string& path, const void* data,
+                size_t bytes, uint64_t offset) {
+  const char* in = static_cast<const char*>(data);
+  while (bytes) {
+    ssize_t done = pwrite(fd, in, bytes, offset);
+    if (done < 0 && errno == EINTR) continue;
+    if (done < 0) throwSystem(path);
+    in += done;
+    bytes -= done;
+    offset += done;
+  }
+}
+
+// Operand file of an out-of-core product, tiles are read with pread
+class TileReader {
+ private:
+  std::string path_;
+  FileDescriptor fd_;
+  FileHeader header_;
+  bool swapped_;
+
+ public:
+  explicit TileReader(const std::string& path)
+      : path_(path), fd_(open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+    if (fd_.get() < 0) throwSystem(path);
+    struct stat status;
+    if (fstat(fd_.get(), &status) != 0) throwSystem(path);
+    char bytes[sizeof(FileHeader)] = {};
+    const size_t size = status.st_size;
+    if (size >= sizeof(bytes))
+      readFully(fd_.get(), path, bytes, sizeof(bytes), 0);
+    swapped_ = readHeader(path, bytes, size, header_);
+  }
+
+  size_t rows() const { return header_.rows; }
+  size_t cols() const { return header_.cols; }
+
+  // rows x cols elements at (row, col) to dst with leading dimension ld
+  void read(size_t row, size_t col, size_t rows, size_t cols, double* dst,
+            size_t ld) const {
+    for (size_t i = 0; i != rows; ++i) {
+      uint64_t element = (row + i) * header_.row_stride + col;
+      readFully(fd_.get(), path_, dst + i * ld, cols * sizeof(double),
+                header_.payload_offset + element * sizeof(double));
+      if (swapped_) swapWords(dst + i * ld, cols);
+    }
+  }
+};
+
+}  // namespace
+
+void Matrix::save(const std::string& path, bool checksum) const {
+  FileHeader header = makeHeader(rows_, cols_, stride_);
+  header.flags = checksum ? kHasChecksum : 0;
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) throw std::system_error(errno, std::generic_category(), path);
+  // The header goes first with a zero checksum and is rewritten at the end,
+  // so the payload is read once
+  const std::vector<char> gap(kPayloadOffset - sizeof(header), 0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(gap.data(), gap.size());
+  const std::vector<double> padding(stride_ - cols_, 0.0);
+  uint64_t hash = kFnvBasis;
+  for (size_t i = 0; i != rows_; ++i) {
+    const double* row = matrix_ + i * stride_;
+    out.write(reinterpret_cast<const char*>(row), cols_ * sizeof(double));
+    out.write(reinterpret_cast<const char*>(padding.data()),
+              padding.size() * sizeof(double));
+    if (checksum) {
+      hash = hashWords(hash, row, cols_, false);
+      hash = hashWords(hash, padding.data(), padding.size(), false);
+    }
+  }
+  if (checksum) {
+    header.checksum = hash;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+  out.close();
+  if (!out) throwFormat(path, "write failed");
+}
+
+Matrix Matrix::mmap(const std::string& path, MapMode mode, bool verify) {
+  void* base;
+  size_t size;
+  {
+    FileDescriptor fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() < 0) throwSystem(path);
+    struct stat status;
+    if (fstat(fd.get(), &status) != 0) throwSystem(path);
+    size = status.st_size;
+    if (size < sizeof(FileHeader)) throwFormat(path, "not a matrix file");
+    // Private writable pages are copied on the first write only
+    base = mode == MapMode::kReadOnly
+               ? ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.get(), 0)
+               : ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                        fd.get(), 0);
+    if (base == MAP_FAILED) throwSystem(path);
+  }
+  auto file = std::make_shared<MappedFile>(base, size, DefaultResource());
+
+  FileHeader header;
+  const bool swapped = readHeader(path, file->data(), size, header);
+  const uint64_t elements = header.rows * header.row_stride;
+  const char* payload = file->data() + header.payload_offset;
+  if (verify && (header.flags & kHasChecksum) &&
+      hashWords(kFnvBasis, payload, elements, swapped) != header.checksum)
+    throwFormat(path, "checksum mismatch");
+
+  if (!swapped && header.row_stride == alignedStride(header.cols) &&
+      header.payload_offset % kAlignment == 0) {
+    double* data = elements ? reinterpret_cast<double*>(
+                                  const_cast<char*>(payload))
+                            : nullptr;
+    return Matrix(header.rows, header.cols, data, std::move(file));
+  }
+  Matrix result(header.rows, header.cols, Uninitialized());
+  for (size_t i = 0; i != result.rows_; ++i) {
+    const char* row = payload + i * header.row_stride * sizeof(double);
+    double* destination = result.matrix_ + i * result.stride_;
+    std::memcpy(destination, row, result.cols_ * sizeof(double));
+    if (swapped) swapWords(destination, result.cols_);
+  }
+  return result;
+}
+
+// C = A * B over tiles: for every tile of C the matching row of A tiles
+// and column of B tiles are streamed through two pairs of buffers, the
+// next pair is read by a background task while the current one goes
+// through Gemm. A tile still held from the previous step is not read again.
+void Matrix::MulMatrixFiles(const std::string& fst, const std::string& snd,
+                            const std::string& result, size_t memory_budget) {
+  const TileReader a(fst), b(snd);
+  const size_t m = a.rows(), k = a.cols(), n = b.cols();
+  if (k != b.rows())
+    throw DifferentMatrixSize(
+        "cols first op operand not equal rows second op");
+  // Square tiles of side t need 5 t^2 elements: the C tile and two A and
+  // two B tiles. When k is short the spare budget widens the C tile.
+  const size_t quantum = kAlignment / sizeof(double);
+  const double budget = static_cast<double>(memory_budget / sizeof(double));
+  const size_t tile = static_cast<size_t>(std::sqrt(budget / 5)) / quantum *
+                      quantum;
+  if (tile == 0) throw std::invalid_argument("memory budget too small");
+  const size_t tk = std::min(tile, k), tk_stride = alignedStride(tk);
+  const size_t side =
+      static_cast<size_t>(std::sqrt(4.0 * tk_stride * tk_stride + budget) -
+                          2.0 * tk_stride) /
+      quantum * quantum;
+  const size_t tm = std::min(side, m), tn = std::min(side, n);
+
+  FileDescriptor out(
+      open(result.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (out.get() < 0) throwSystem(result);
+  const size_t stride = alignedStride(n);
+  const FileHeader header = makeHeader(m, n, stride);
+  writeFully(out.get(), result, &header, sizeof(header), 0);
+  // Zero filled, which also covers k == 0 and the row padding
+  if (ftruncate(out.get(), kPayloadOffset + m * stride * sizeof(double)))
+    throwSystem(result);
+  if (m == 0 || n == 0 || k == 0) return;
+
+  struct Step {
+    size_t i, j, kk;
+  };
+  std::vector<Step> steps;
+  for (size_t i = 0; i < m; i += tm)
+    for (size_t j = 0; j < n; j += tn)
+      for (size_t kk = 0; kk < k; kk += tk) steps.push_back({i, j, kk});
+
+  using Key = std::pair<size_t, size_t>;
+  const Key none(std::numeric_limits<size_t>::max(), 0);
+  Matrix a_tiles[2] = {Matrix(tm, tk), Matrix(tm, tk)};
+  Matrix b_tiles[2] = {Matrix(tk, tn), Matrix(tk, tn)};
+  Key a_held[2] = {none, none}, b_held[2] = {none, none};
+  Matrix c_tile(tm, tn);
+  auto read = [&](const Step& step, size_t a_slot, size_t b_slot,
+                  bool read_a, bool read_b) {
+    size_t h = std::min(tm, m - step.i), w = std::min(tn, n - step.j);
+    size_t d = std::min(tk, k - step.kk);
+    if (read_a)
+      a.read(step.i, step.kk, h, d, a_tiles[a_slot].matrix_,
+             a_tiles[a_slot].stride_);
+    if (read_b)
+      b.read(step.kk, step.j, d, w, b_tiles[b_slot].matrix_,
+             b_tiles[b_slot].stride_);
+  };
+
+  size_t a_slot = 0, b_slot = 0;
+  read(steps[0], a_slot, b_slot, true, true);
+  a_held[0] = {steps[0].i, steps[0].kk};
+  b_held[0] = {steps[0].kk, steps[0].j};
+  for (size_t s = 0; s != steps.size(); ++s) {
+    const Step& step = steps[s];
+    std::future<void> prefetch;
+    size_t a_next = a_slot, b_next = b_slot;
+    if (s + 1 != steps.size()) {
+      const Step& next = steps[s + 1];
+      const Key a_key(next.i, next.kk), b_key(next.kk, next.j);
+      const bool read_a = a_held[a_slot] != a_key;
+      const bool read_b = b_held[b_slot] != b_key;
+      if (read_a) a_held[a_next = 1 - a_slot] = a_key;
+      if (read_b) b_held[b_next = 1 - b_slot] = b_key;
+      if (read_a || read_b)
+        prefetch = std::async(std::launch::async, read, next, a_next, b_next,
+                              read_a, read_b);
+    }
+    const size_t h = std::min(tm, m - step.i), w = std::min(tn, n - step.j);
+    const size_t d = std::min(tk, k - step.kk);
+    kernels::Gemm(h, w, d, 1.0, a_tiles[a_slot].matrix_,
+                  a_tiles[a_slot].stride_, 1, b_tiles[b_slot].matrix_,
+                  b_tiles[b_slot].stride_, 1, step.kk ? 1.0 : 0.0,
+                  c_tile.matrix_, c_tile.stride_);
+    if (step.kk + d == k)
+      for (size_t r = 0; r != h; ++r)
+        writeFully(out.get(), result, c_tile.matrix_ + r * c_tile.stride_,
+                   w * sizeof(double),
+                   kPayloadOffset +
+                       ((step.i + r) * stride + step.j) * sizeof(double));
+    if (prefetch.valid()) prefetch.get();
+    a_slot = a_next;
+    b_slot = b_next;
+  }
+}
@@ -0,0 +1,340 @@
+#include "qr.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "gemm.h"
+#include "instrument.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Reflectors per block, each block is applied to the rest of the matrix
+// with two GEMM calls
+constexpr size_t kBlock = 32;
+
+// Turns x, count elements apart by stride, into the reflector
+// H = I - tau * v * v^T with H * x = beta * e_0: x[0] becomes beta and
+// the rest becomes v below its implicit leading 1. Returns tau, 0 when x
+// is already a multiple of e_0.
+double makeReflector(double* x, size_t count, size_t stride) {
+  double tail = 0;
+  for (size_t i = 1; i < count; ++i) tail += x[i * stride] * x[i * stride];
+  if (tail == 0) return 0;
+  const double alpha = x[0];
+  const double beta = -std::copysign(std::sqrt(alpha * alpha + tail), alpha);
+  const double scale = 1 / (alpha - beta);
+  for (size_t i = 1; i < count; ++i) x[i * stride] *= scale;
+  x[0] = beta;
+  return (beta - alpha) / beta;
+}
+
+// Applies H_j * ... * H_{j+jb-1} = I - V * T * V^T, or its transpose, to
+// rows j..m of the ncols columns at c. V is read from the columns j..j+jb
+// of the factored matrix a.
+void applyBlock(const double* a, size_t ld, size_t m, size_t j, size_t jb,
+                const double* tau, bool transpose, double* c, size_t ncols,
+                size_t ldc) {
+  const size_t rows = m - j;
+  std::vector<double> v(rows * jb, 0.0), t(jb * jb, 0.0), column(jb),
+      w(jb * ncols);
+  for (size_t i = 0; i != rows; ++i) {
+    const double* row = a + (j + i) * ld + j;
+    double* v_row = v.data() + i * jb;
+    std::copy_n(row, std::min(i, jb), v_row);
+    if (i < jb) v_row[i] = 1;
+  }
+  // T is upper triangular, column l is -tau_l * T * V^T * v_l over the
+  // columns before l
+  for (size_t l = 0; l != jb; ++l) {
+    std::fill_n(column.begin(), l, 0.0);
+    for (size_t i = l; i != rows; ++i) {
+      const double* v_row = v.data() + i * jb;
+      const double factor = tau[l] * v_row[l];
+      for (size_t p = 0; p != l; ++p) column[p] -= factor * v_row[p];
+    }
+    for (size_t p = 0; p != l; ++p) {
+      double sum = 0;
+      for (size_t q = p; q != l; ++q) sum += t[p * jb + q] * column[q];
+      t[p * jb + l] = sum;
+    }
+    t[l * jb + l] = tau[l];
+  }
+  // W = V^T * C, W = T^T * W or T * W, C -= V * W
+  kernels::Gemm(jb, ncols, rows, 1.0, v.data(), 1, jb, c, ldc, 1, 0.0,
+                w.data(), ncols);
+  for (size_t step = 0; step != jb; ++step) {
+    // In place: T^T * W needs rows up to i, T * W rows from i
+    const size_t i = transpose ? jb - 1 - step : step;
+    double* w_row = w.data() + i * ncols;
+    const double diagonal = t[i * jb + i];
+    for (size_t col = 0; col != ncols; ++col) w_row[col] *= diagonal;
+    const size_t first = transpose ? 0 : i + 1, last = transpose ? i : jb;
+    for (size_t l = first; l != last; ++l) {
+      const double factor = transpose ? t[l * jb + i] : t[i * jb + l];
+      const double* other = w.data() + l * ncols;
+      for (size_t col = 0; col != ncols; ++col)
+        w_row[col] += factor * other[col];
+    }
+  }
+  kernels::Gemm(rows, ncols, jb, -1.0, v.data(), jb, 1, w.data(), ncols, 1,
+                1.0, c, ldc);
+}
+
+}  // namespace
+
+QR::QR(const Matrix& matrix, bool pivoting)
+    : qr_(matrix), tau_(std::min(matrix.getRows(), matrix.getCols())),
+      perm_(matrix.getCols()), rank_(0), pivoting_(pivoting) {
+  std::iota(perm_.begin(), perm_.end(), 0);
+  if (pivoting)
+    factorizePivoted();
+  else
+    factorize();
+  findRank();
+}
+
+// Each panel is reduced column by column, the reflectors updating only
+// the panel; the rest of the matrix then gets the whole block at once.
+void QR::factorize() {
+  const size_t m = qr_.getRows(), n = qr_.getCols(), ld = qr_.getStride();
+  const size_t k = std::min(m, n);
+  double* a = qr_.view().data();
+  std::vector<double> w(kBlock);
+  for (size_t j = 0; j < k; j += kBlock) {
+    const size_t end = std::min(j + kBlock, k);
+    for (size_t c = j; c != end; ++c) {
+      const double tau = tau_[c] = makeReflector(a + c * ld + c, m - c, ld);
+      if (tau == 0 || c + 1 == end) continue;
+      // w = v^T * A(c:m, c+1:end), then A -= tau * v * w
+      double* pivot_row = a + c * ld;
+      std::copy(pivot_row + c + 1, pivot_row + end, w.begin());
+      for (size_t i = c + 1; i != m; ++i) {
+        const double* row = a + i * ld;
+        for (size_t col = c + 1; col != end; ++col)
+          w[col - c - 1] += row[c] * row[col];
+      }
+      for (size_t col = c + 1; col != end; ++col)
+        pivot_row[col] -= tau * w[col - c - 1];
+      for (size_t i = c + 1; i != m; ++i) {
+        double* row = a + i * ld;
+        const double factor = tau * row[c];
+        for (size_t col = c + 1; col != end; ++col)
+          row[col] -= factor * w[col - c - 1];
+      }
+    }
+    if (end != n)
+      applyBlock(a, ld, m, j, end - j, tau_.data() + j, true,
+                 a + j * ld + end, n - end, ld);
+  }
+}
+
+// Blocked column pivoting after LAPACK's xLAQPS. Choosing a pivot needs
+// the norms of the trailing columns, so within a panel only the pivot
+// column and row are brought up to date; the rest of the matrix collects
+// the panel's reflectors in F = A^T * V * T and is updated by one GEMM
+// when the panel ends. A panel also ends early when a downdated norm has
+// lost too much accuracy, which is then recomputed.
+void QR::factorizePivoted() {
+  const size_t m = qr_.getRows(), n = qr_.getCols(), ld = qr_.getStride();
+  const size_t k = std::min(m, n);
+  double* a = qr_.view().data();
+  // Running and last exactly computed norm of every column
+  std::vector<double> norms(n, 0.0), exact(n);
+  for (size_t i = 0; i != m; ++i) {
+    const double* row = a + i * ld;
+    for (size_t col = 0; col != n; ++col) norms[col] += row[col] * row[col];
+  }
+  for (size_t col = 0; col != n; ++col)
+    norms[col] = exact[col] = std::sqrt(norms[col]);
+  const double tolerance = std::sqrt(std::numeric_limits<double>::epsilon());
+  // Row col of F holds column col of A^T * V * T for the current panel
+  std::vector<double> f(n * kBlock), w(kBlock), product(n);
+  std::vector<size_t> stale;
+  for (size_t j = 0; j < k;) {
+    const size_t nb = std::min(kBlock, k - j);
+    std::fill(f.begin() + j * kBlock, f.end(), 0.0);
+    size_t kb = 0;
+    while (kb != nb && stale.empty()) {
+      const size_t c = j + kb;
+      const size_t p =
+          std::max_element(norms.begin() + c, norms.end()) - norms.begin();
+      if (p != c) {
+        for (size_t i = 0; i != m; ++i)
+          std::swap(a[i * ld + c], a[i * ld + p]);
+        std::swap_ranges(f.begin() + c * kBlock, f.begin() + c * kBlock + kb,
+                         f.begin() + p * kBlock);
+        std::swap(perm_[c], perm_[p]);
+        norms[p] = norms[c];
+        exact[p] = exact[c];
+      }
+      // A(c:m, c) -= A(c:m, j:c) * F(c, 0:kb)^T
+      const double* f_pivot = f.data() + c * kBlock;
+      for (size_t i = c; i != m; ++i) {
+        double* row = a + i * ld;
+        double sum = 0;
+        for (size_t l = 0; l != kb; ++l) sum += row[j + l] * f_pivot[l];
+        row[c] -= sum;
+      }
+      const double tau = tau_[c] = makeReflector(a + c * ld + c, m - c, ld);
+      const double diagonal = a[c * ld + c];
+      a[c * ld + c] = 1;
+      // F(c+1:n, kb) = tau * (A(c:m, c+1:n)^T * v
+      //                       - F(c+1:n, 0:kb) * V(c:m, 0:kb)^T * v)
+      if (tau != 0) {
+        // Rows of A are streamed once per column, into a contiguous row
+        // instead of the strided column of F
+        ThreadPool::ParallelFor(
+            n - c - 1, 2 * (m - c), [&](size_t first, size_t last) {
+              double* sum = product.data() + c + 1;
+              std::fill(sum + first, sum + last, 0.0);
+              for (size_t i = c; i != m; ++i) {
+                const double* row = a + i * ld + c + 1;
+                const double v = tau * row[-1];
+                for (size_t col = first; col != last; ++col)
+                  sum[col] += v * row[col];
+              }
+            });
+        std::fill_n(w.begin(), kb, 0.0);
+        for (size_t i = c; i != m; ++i) {
+          const double* row = a + i * ld;
+          const double v = tau * row[c];
+          for (size_t l = 0; l != kb; ++l) w[l] -= v * row[j + l];
+        }
+        for (size_t col = c + 1; col != n; ++col) {
+          double* f_row = f.data() + col * kBlock;
+          double sum = product[col];
+          for (size_t l = 0; l != kb; ++l) sum += f_row[l] * w[l];
+          f_row[kb] = sum;
+        }
+      }
+      // A(c, c+1:n) -= A(c, j:c+1) * F(c+1:n, 0:kb+1)^T
+      double* pivot_row = a + c * ld;
+      for (size_t col = c + 1; col != n; ++col) {
+        const double* f_row = f.data() + col * kBlock;
+        double sum = 0;
+        for (size_t l = 0; l <= kb; ++l) sum += pivot_row[j + l] * f_row[l];
+        pivot_row[col] -= sum;
+      }
+      pivot_row[c] = diagonal;
+      for (size_t col = c + 1; col != n; ++col) {
+        if (norms[col] == 0) continue;
+        double ratio = std::fabs(pivot_row[col]) / norms[col];
+        ratio = std::max(0.0, (1 + ratio) * (1 - ratio));
+        const double drift = norms[col] / exact[col];
+        if (ratio * drift * drift <= tolerance)
+          stale.push_back(col);
+        else
+          norms[col] *= std::sqrt(ratio);
+      }
+      ++kb;
+    }
+    const size_t end = j + kb;
+    // A(end:m, end:n) -= A(end:m, j:end) * F(end:n, 0:kb)^T
+    if (end < m && end < n)
+      kernels::Gemm(m - end, n - end, kb, -1.0, a + end * ld + j, ld, 1,
+                    f.data() + end * kBlock, 1, kBlock, 1.0,
+                    a + end * ld + end, ld);
+    for (size_t col : stale) {
+      double sum = 0;
+      for (size_t i = end; i < m; ++i) sum += a[i * ld + col] * a[i * ld + col];
+      norms[col] = exact[col] = std::sqrt(sum);
+    }
+    stale.clear();
+    j = end;
+  }
+}
+
+void QR::findRank() {
+  const size_t k = tau_.size(), ld = qr_.getStride();
+  const double* a = qr_.view().data();
+  if (k == 0) return;
+  const double tolerance = std::max(qr_.getRows(), qr_.getCols()) *
+                           std::numeric_limits<double>::epsilon() *
+                           std::fabs(a[0]);
+  for (size_t i = 0; i != k; ++i)
+    if (std::fabs(a[i * ld + i]) > tolerance) ++rank_;
+}
+
+void QR::applyQ(Matrix& c, bool transpose) const {
+  const size_t m = qr_.getRows(), ld = qr_.getStride(), k = tau_.size();
+  const double* a = qr_.view().data();
+  double* data = c.view().data();
+  const size_t blocks = (k + kBlock - 1) / kBlock;
+  for (size_t step = 0; step != blocks; ++step) {
+    // Q^T = H_k * ... * H_1 starts from the first block, Q from the last
+    const size_t j = (transpose ? step : blocks - 1 - step) * kBlock;
+    const size_t jb = std::min(kBlock, k - j);
+    applyBlock(a, ld, m, j, jb, tau_.data() + j, transpose,
+               data + j * c.getStride(), c.getCols(), c.getStride());
+  }
+}
+
+size_t QR::getRows() const { return qr_.getRows(); }
+
+size_t QR::getCols() const { return qr_.getCols(); }
+
+const std::vector<size_t>& QR::getPermutation() const { return perm_; }
+
+size_t QR::getRank() const { return rank_; }
+
+Matrix QR::getQ() const {
+  const size_t k = tau_.size();
+  Matrix q(qr_.getRows(), k);
+  for (size_t i = 0; i != k; ++i) q(i, i) = 1;
+  applyQ(q, false);
+  return q;
+}
+
+Matrix QR::getR() const {
+  const size_t k = tau_.size(), n = qr_.getCols();
+  Matrix r(k, n);
+  for (size_t i = 0; i != k; ++i) {
+    const double* row = qr_.row(i).data();
+    std::copy(row + i, row + n, r.row(i).data() + i);
+  }
+  return r;
+}
+
+Matrix QR::LeastSquares(const Matrix& b) const {
+  const size_t m = qr_.getRows(), n = qr_.getCols(), ld = qr_.getStride();
+  if (b.getRows() != m)
+    throw Matrix::DifferentMatrixSize("rows count not equal");
+  if (m < n)
+    throw Matrix::DifferentMatrixSize("rows count less than columns count");
+  if (!pivoting_ && rank_ != n)
+    throw Matrix::ZeroDeterminant("matrix is rank deficient");
+  Matrix y(b);
+  applyQ(y, true);
+  // R(0:r, 0:r) * Z = Y(0:r), rows of X follow the permutation and the
+  // dependent columns stay zero
+  const size_t r = rank_, nrhs = b.getCols(), ldy = y.getStride();
+  const double* a = qr_.view().data();
+  double* z = y.view().data();
+  ThreadPool::ParallelFor(nrhs, r * r, [&](size_t first, size_t last) {
+    for (size_t i = r; i-- != 0;) {
+      double* row = z + i * ldy;
+      for (size_t l = i + 1; l != r; ++l) {
+        const double u = a[i * ld + l];
+        const double* z_row = z + l * ldy;
+        for (size_t col = first; col != last; ++col)
+          row[col] -= u * z_row[col];
+      }
+      const double pivot = a[i * ld + i];
+      for (size_t col = first; col != last; ++col) row[col] /= pivot;
+    }
+  });
+  Matrix x(n, nrhs);
+  for (size_t i = 0; i != r; ++i)
+    std::copy_n(y.row(i).data(), nrhs, x.row(perm_[i]).data());
+  return x;
+}
+
+Matrix Matrix::LeastSquares(const Matrix& b) const {
+  MATRIX_INSTRUMENT_OP(kLeastSquares, 2 * rows_ * cols_ * (cols_ + 2 * b.cols_),
+                       (rows_ * cols_ + b.rows_ * b.cols_ + cols_ * b.cols_) *
+                           sizeof(double));
+  return QR(*this).LeastSquares(b);
+}
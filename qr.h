@@ -0,0 +1,51 @@
+#ifndef QR_H
+#define QR_H
+#include <cstddef>
+#include <vector>
+
+#include "matrix.h"
+
+// Householder QR factorization A * P = Q * R of an m x n matrix, Q
+// orthogonal and R upper triangular. R and the Householder vectors share
+// one matrix; Q is never formed unless asked for. Reflectors are applied
+// kBlock at a time in the compact WY form I - V * T * V^T, so most of the
+// work is GEMM.
+//
+// With column pivoting the largest remaining column is moved forward at
+// every step, |R(0, 0)| >= |R(1, 1)| >= ..., and the rank can be read off
+// the diagonal. Without it P is the identity.
+class QR {
+ private:
+  Matrix qr_;
+  std::vector<double> tau_;
+  // Column j of A * P is column perm_[j] of A
+  std::vector<size_t> perm_;
+  size_t rank_;
+  bool pivoting_;
+
+  void factorize();
+  void factorizePivoted();
+  void findRank();
+  // c = Q^T * c when transpose, otherwise c = Q * c, for m-row c
+  void applyQ(Matrix& c, bool transpose) const;
+
+ public:
+  explicit QR(const Matrix& matrix, bool pivoting = false);
+
+  size_t getRows() const;
+  size_t getCols() const;
+  const std::vector<size_t>& getPermutation() const;
+  // Number of diagonal entries of R above max(m, n) * eps * |R(0, 0)|
+  size_t getRank() const;
+  // First min(m, n) columns of Q
+  Matrix getQ() const;
+  // min(m, n) x n
+  Matrix getR() const;
+
+  // X minimizing ||A * X - B|| for every column of B, A with at least as
+  // many rows as columns. A rank deficient A needs column pivoting, the
+  // result then has zeros for the dependent columns; without pivoting it
+  // throws ZeroDeterminant.
+  Matrix LeastSquares(const Matrix& b) const;
+};
+#endif
@@ -0,0 +1,471 @@
+#include "simd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATRIX_X86 1
+#include <immintrin.h>
+#endif
+
+namespace kernels {
+namespace {
+
+// Scalar kernels, also used for the tails of the vector kernels
+
+void addScalar(double* dst, const double* src, size_t n) {
+  for (size_t i = 0; i != n; ++i) dst[i] += src[i];
+}
+
+void subScalar(double* dst, const double* src, size_t n) {
+  for (size_t i = 0; i != n; ++i) dst[i] -= src[i];
+}
+
+void scaleScalar(double* dst, double num, size_t n) {
+  for (size_t i = 0; i != n; ++i) dst[i] *= num;
+}
+
+void fillScalar(double* dst, double value, size_t n) {
+  std::fill_n(dst, n, value);
+}
+
+bool equalScalar(const double* a, const double* b, size_t n) {
+  for (size_t i = 0; i != n; ++i)
+    if (a[i] != b[i]) return false;
+  return true;
+}
+
+template <typename T, size_t NR>
+void storeTile(const T (&acc)[kGemmMR][NR], T* c, size_t rsc, size_t mr,
+               size_t nr) {
+  for (size_t i = 0; i != mr; ++i)
+    for (size_t j = 0; j != nr; ++j) c[i * rsc + j] += acc[i][j];
+}
+
+template <typename T, size_t NR>
+void gemmTileScalar(size_t kc, const T* a, const T* b, T* c, size_t rsc,
+                    size_t mr, size_t nr) {
+  T acc[kGemmMR][NR] = {};
+  for (size_t p = 0; p != kc; ++p) {
+    for (size_t i = 0; i != kGemmMR; ++i)
+      for (size_t j = 0; j != NR; ++j) acc[i][j] += a[i] * b[j];
+    a += kGemmMR;
+    b += NR;
+  }
+  storeTile(acc, c, rsc, mr, nr);
+}
+
+void transposeTileScalar(const double* src, size_t lds, double* dst,
+                         size_t ldd) {
+  for (size_t i = 0; i != kTransposeTile; ++i)
+    for (size_t j = 0; j != kTransposeTile; ++j)
+      dst[j * ldd + i] = src[i * lds + j];
+}
+
+#ifdef MATRIX_X86
+
+// SSE2
+
+__attribute__((target("sse2"))) void addSse2(double* dst, const double* src,
+                                             size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(dst + i,
+                  _mm_add_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+  addScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2"))) void subSse2(double* dst, const double* src,
+                                             size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(dst + i,
+                  _mm_sub_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+  subScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2"))) void scaleSse2(double* dst, double num,
+                                               size_t n) {
+  __m128d factor = _mm_set1_pd(num);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(dst + i), factor));
+  scaleScalar(dst + i, num, n - i);
+}
+
+__attribute__((target("sse2"))) void fillSse2(double* dst, double value,
+                                              size_t n) {
+  __m128d v = _mm_set1_pd(value);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) _mm_storeu_pd(dst + i, v);
+  fillScalar(dst + i, value, n - i);
+}
+
+__attribute__((target("sse2"))) bool equalSse2(const double* a,
+                                               const double* b, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    if (_mm_movemask_pd(_mm_cmpneq_pd(_mm_loadu_pd(a + i),
+                                      _mm_loadu_pd(b + i))))
+      return false;
+  return equalScalar(a + i, b + i, n - i);
+}
+
+// 4x4 tile as four 2x2 blocks, each transposed with one unpack pair
+__attribute__((target("sse2"))) void transposeTileSse2(const double* src,
+                                                       size_t lds,
+                                                       double* dst,
+                                                       size_t ldd) {
+  static_assert(kTransposeTile == 4, "tile shape is hard-coded");
+  for (size_t i = 0; i != kTransposeTile; i += 2)
+    for (size_t j = 0; j != kTransposeTile; j += 2) {
+      __m128d r0 = _mm_loadu_pd(src + i * lds + j);
+      __m128d r1 = _mm_loadu_pd(src + (i + 1) * lds + j);
+      _mm_storeu_pd(dst + j * ldd + i, _mm_unpacklo_pd(r0, r1));
+      _mm_storeu_pd(dst + (j + 1) * ldd + i, _mm_unpackhi_pd(r0, r1));
+    }
+}
+
+// AVX2
+
+__attribute__((target("avx2"))) void addAvx2(double* dst, const double* src,
+                                             size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(dst + i),
+                                            _mm256_loadu_pd(src + i)));
+  addScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) void subAvx2(double* dst, const double* src,
+                                             size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(dst + i, _mm256_sub_pd(_mm256_loadu_pd(dst + i),
+                                            _mm256_loadu_pd(src + i)));
+  subScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) void scaleAvx2(double* dst, double num,
+                                               size_t n) {
+  __m256d factor = _mm256_set1_pd(num);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(dst + i), factor));
+  scaleScalar(dst + i, num, n - i);
+}
+
+__attribute__((target("avx2"))) void fillAvx2(double* dst, double value,
+                                              size_t n) {
+  __m256d v = _mm256_set1_pd(value);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) _mm256_storeu_pd(dst + i, v);
+  fillScalar(dst + i, value, n - i);
+}
+
+__attribute__((target("avx2"))) bool equalAvx2(const double* a,
+                                               const double* b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    if (_mm256_movemask_pd(_mm256_cmp_pd(
+            _mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _CMP_NEQ_UQ)))
+      return false;
+  return equalScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) void gemmTileAvx2(
+    size_t kc, const double* a, const double* b, double* c, size_t rsc,
+    size_t mr, size_t nr) {
+  static_assert(kGemmMR == 4 && kGemmNR == 8, "tile shape is hard-coded");
+  __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+  __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+  __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+  __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+  for (size_t p = 0; p != kc; ++p) {
+    __m256d b0 = _mm256_load_pd(b);
+    __m256d b1 = _mm256_load_pd(b + 4);
+    __m256d ai = _mm256_broadcast_sd(a);
+    c00 = _mm256_fmadd_pd(ai, b0, c00);
+    c01 = _mm256_fmadd_pd(ai, b1, c01);
+    ai = _mm256_broadcast_sd(a + 1);
+    c10 = _mm256_fmadd_pd(ai, b0, c10);
+    c11 = _mm256_fmadd_pd(ai, b1, c11);
+    ai = _mm256_broadcast_sd(a + 2);
+    c20 = _mm256_fmadd_pd(ai, b0, c20);
+    c21 = _mm256_fmadd_pd(ai, b1, c21);
+    ai = _mm256_broadcast_sd(a + 3);
+    c30 = _mm256_fmadd_pd(ai, b0, c30);
+    c31 = _mm256_fmadd_pd(ai, b1, c31);
+    a += kGemmMR;
+    b += kGemmNR;
+  }
+  if (mr == kGemmMR && nr == kGemmNR) {
+    const __m256d rows[kGemmMR][2] = {
+        {c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+    for (size_t i = 0; i != kGemmMR; ++i) {
+      double* row = c + i * rsc;
+      _mm256_storeu_pd(row, _mm256_add_pd(_mm256_loadu_pd(row), rows[i][0]));
+      _mm256_storeu_pd(row + 4,
+                       _mm256_add_pd(_mm256_loadu_pd(row + 4), rows[i][1]));
+    }
+  } else {
+    double acc[kGemmMR][kGemmNR];
+    _mm256_storeu_pd(acc[0], c00);
+    _mm256_storeu_pd(acc[0] + 4, c01);
+    _mm256_storeu_pd(acc[1], c10);
+    _mm256_storeu_pd(acc[1] + 4, c11);
+    _mm256_storeu_pd(acc[2], c20);
+    _mm256_storeu_pd(acc[2] + 4, c21);
+    _mm256_storeu_pd(acc[3], c30);
+    _mm256_storeu_pd(acc[3] + 4, c31);
+    storeTile(acc, c, rsc, mr, nr);
+  }
+}
+
+// The double tile with eight floats per register
+__attribute__((target("avx2,fma"))) void gemmTileFloatAvx2(
+    size_t kc, const float* a, const float* b, float* c, size_t rsc,
+    size_t mr, size_t nr) {
+  static_assert(kGemmMR == 4 && kGemmNRFloat == 16,
+                "tile shape is hard-coded");
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+  for (size_t p = 0; p != kc; ++p) {
+    __m256 b0 = _mm256_load_ps(b);
+    __m256 b1 = _mm256_load_ps(b + 8);
+    __m256 ai = _mm256_broadcast_ss(a);
+    c00 = _mm256_fmadd_ps(ai, b0, c00);
+    c01 = _mm256_fmadd_ps(ai, b1, c01);
+    ai = _mm256_broadcast_ss(a + 1);
+    c10 = _mm256_fmadd_ps(ai, b0, c10);
+    c11 = _mm256_fmadd_ps(ai, b1, c11);
+    ai = _mm256_broadcast_ss(a + 2);
+    c20 = _mm256_fmadd_ps(ai, b0, c20);
+    c21 = _mm256_fmadd_ps(ai, b1, c21);
+    ai = _mm256_broadcast_ss(a + 3);
+    c30 = _mm256_fmadd_ps(ai, b0, c30);
+    c31 = _mm256_fmadd_ps(ai, b1, c31);
+    a += kGemmMR;
+    b += kGemmNRFloat;
+  }
+  if (mr == kGemmMR && nr == kGemmNRFloat) {
+    const __m256 rows[kGemmMR][2] = {
+        {c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+    for (size_t i = 0; i != kGemmMR; ++i) {
+      float* row = c + i * rsc;
+      _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), rows[i][0]));
+      _mm256_storeu_ps(row + 8,
+                       _mm256_add_ps(_mm256_loadu_ps(row + 8), rows[i][1]));
+    }
+  } else {
+    float acc[kGemmMR][kGemmNRFloat];
+    _mm256_storeu_ps(acc[0], c00);
+    _mm256_storeu_ps(acc[0] + 8, c01);
+    _mm256_storeu_ps(acc[1], c10);
+    _mm256_storeu_ps(acc[1] + 8, c11);
+    _mm256_storeu_ps(acc[2], c20);
+    _mm256_storeu_ps(acc[2] + 8, c21);
+    _mm256_storeu_ps(acc[3], c30);
+    _mm256_storeu_ps(acc[3] + 8, c31);
+    storeTile(acc, c, rsc, mr, nr);
+  }
+}
+
+__attribute__((target("avx2"))) void transposeTileAvx2(const double* src,
+                                                       size_t lds,
+                                                       double* dst,
+                                                       size_t ldd) {
+  static_assert(kTransposeTile == 4, "tile shape is hard-coded");
+  __m256d r0 = _mm256_loadu_pd(src);
+  __m256d r1 = _mm256_loadu_pd(src + lds);
+  __m256d r2 = _mm256_loadu_pd(src + 2 * lds);
+  __m256d r3 = _mm256_loadu_pd(src + 3 * lds);
+  // t0 = (r0[0], r1[0], r0[2], r1[2]), t1 = (r0[1], r1[1], r0[3], r1[3])
+  __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+  __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+  __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+  __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+  _mm256_storeu_pd(dst, _mm256_permute2f128_pd(t0, t2, 0x20));
+  _mm256_storeu_pd(dst + ldd, _mm256_permute2f128_pd(t1, t3, 0x20));
+  _mm256_storeu_pd(dst + 2 * ldd, _mm256_permute2f128_pd(t0, t2, 0x31));
+  _mm256_storeu_pd(dst + 3 * ldd, _mm256_permute2f128_pd(t1, t3, 0x31));
+}
+
+// AVX-512, tails are handled with masked loads and stores
+
+__attribute__((target("avx512f"))) __mmask8 tailMask(size_t n) {
+  return static_cast<__mmask8>((1u << n) - 1);
+}
+
+__attribute__((target("avx512f"))) void addAvx512(double* dst,
+                                                  const double* src,
+                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(dst + i, _mm512_add_pd(_mm512_loadu_pd(dst + i),
+                                            _mm512_loadu_pd(src + i)));
+  if (i != n) {
+    __mmask8 mask = tailMask(n - i);
+    _mm512_mask_storeu_pd(
+        dst + i, mask,
+        _mm512_add_pd(_mm512_maskz_loadu_pd(mask, dst + i),
+                      _mm512_maskz_loadu_pd(mask, src + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) void subAvx512(double* dst,
+                                                  const double* src,
+                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(dst + i, _mm512_sub_pd(_mm512_loadu_pd(dst + i),
+                                            _mm512_loadu_pd(src + i)));
+  if (i != n) {
+    __mmask8 mask = tailMask(n - i);
+    _mm512_mask_storeu_pd(
+        dst + i, mask,
+        _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, dst + i),
+                      _mm512_maskz_loadu_pd(mask, src + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) void scaleAvx512(double* dst, double num,
+                                                    size_t n) {
+  __m512d factor = _mm512_set1_pd(num);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(dst + i, _mm512_mul_pd(_mm512_loadu_pd(dst + i), factor));
+  if (i != n) {
+    __mmask8 mask = tailMask(n - i);
+    _mm512_mask_storeu_pd(
+        dst + i, mask,
+        _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, dst + i), factor));
+  }
+}
+
+__attribute__((target("avx512f"))) void fillAvx512(double* dst, double value,
+                                                   size_t n) {
+  __m512d v = _mm512_set1_pd(value);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) _mm512_storeu_pd(dst + i, v);
+  if (i != n) _mm512_mask_storeu_pd(dst + i, tailMask(n - i), v);
+}
+
+__attribute__((target("avx512f"))) bool equalAvx512(const double* a,
+                                                    const double* b,
+                                                    size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    if (_mm512_cmp_pd_mask(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i),
+                           _CMP_NEQ_UQ))
+      return false;
+  if (i != n) {
+    __mmask8 mask = tailMask(n - i);
+    return !_mm512_mask_cmp_pd_mask(mask, _mm512_maskz_loadu_pd(mask, a + i),
+                                    _mm512_maskz_loadu_pd(mask, b + i),
+                                    _CMP_NEQ_UQ);
+  }
+  return true;
+}
+
+#endif
+
+constexpr auto gemmTileDouble = gemmTileScalar<double, kGemmNR>;
+constexpr auto gemmTileFloat = gemmTileScalar<float, kGemmNRFloat>;
+
+constexpr KernelTable kScalarTable = {
+    Isa::kScalar, addScalar,   subScalar,      scaleScalar,
+    fillScalar,   equalScalar, gemmTileDouble, gemmTileFloat,
+    transposeTileScalar};
+#ifdef MATRIX_X86
+constexpr KernelTable kSse2Table = {
+    Isa::kSse2, addSse2,   subSse2,        scaleSse2,
+    fillSse2,   equalSse2, gemmTileDouble, gemmTileFloat,
+    transposeTileSse2};
+constexpr KernelTable kAvx2Table = {
+    Isa::kAvx2, addAvx2,   subAvx2,      scaleAvx2,
+    fillAvx2,   equalAvx2, gemmTileAvx2, gemmTileFloatAvx2,
+    transposeTileAvx2};
+// The 4x8 GEMM tile is already register-bound on AVX2, and the 4x4
+// transpose tile matches it, so AVX-512 hosts keep the AVX2 tiles and
+// use 512-bit element-wise kernels
+constexpr KernelTable kAvx512Table = {
+    Isa::kAvx512, addAvx512,   subAvx512,    scaleAvx512,
+    fillAvx512,   equalAvx512, gemmTileAvx2, gemmTileFloatAvx2,
+    transposeTileAvx2};
+#endif
+
+const KernelTable* tableFor(Isa isa) {
+#ifdef MATRIX_X86
+  switch (isa) {
+    case Isa::kAvx512:
+      return &kAvx512Table;
+    case Isa::kAvx2:
+      return &kAvx2Table;
+    case Isa::kSse2:
+      return &kSse2Table;
+    case Isa::kScalar:
+      break;
+  }
+#else
+  (void)isa;
+#endif
+  return &kScalarTable;
+}
+
+Isa requestedIsa() {
+  const char* env = std::getenv("MATRIX_ISA");
+  if (!env) return Isa::kAvx512;
+  for (Isa isa : {Isa::kScalar, Isa::kSse2, Isa::kAvx2, Isa::kAvx512})
+    if (std::strcmp(env, IsaName(isa)) == 0) return isa;
+  return Isa::kAvx512;
+}
+
+std::atomic<const KernelTable*>& activeTable() {
+  static std::atomic<const KernelTable*> table{
+      tableFor(std::min(requestedIsa(), DetectIsa()))};
+  return table;
+}
+
+}  // namespace
+
+Isa DetectIsa() {
+#ifdef MATRIX_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return Isa::kAvx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return Isa::kAvx2;
+  if (__builtin_cpu_supports("sse2")) return Isa::kSse2;
+#endif
+  return Isa::kScalar;
+}
+
+const KernelTable& Active() {
+  return *activeTable().load(std::memory_order_relaxed);
+}
+
+Isa SetIsa(Isa isa) {
+  const KernelTable* table = tableFor(std::min(isa, DetectIsa()));
+  activeTable().store(table, std::memory_order_relaxed);
+  return table->isa;
+}
+
+const char* IsaName(Isa isa) {
+  switch (isa) {
+    case Isa::kAvx512:
+      return "avx512";
+    case Isa::kAvx2:
+      return "avx2";
+    case Isa::kSse2:
+      return "sse2";
+    case Isa::kScalar:
+      break;
+  }
+  return "scalar";
+}
+
+}  // namespace kernels
@@ -0,0 +1,51 @@
+#ifndef SIMD_H
+#define SIMD_H
+#include <cstddef>
+
+namespace kernels {
+
+// Instruction sets with dedicated kernels, ordered from weakest to strongest
+enum class Isa { kScalar, kSse2, kAvx2, kAvx512 };
+
+// Register block shared by every GEMM micro-kernel and the packing routines
+constexpr size_t kGemmMR = 4;
+constexpr size_t kGemmNR = 8;
+// Float tiles span as many bytes per row, twice the columns
+constexpr size_t kGemmNRFloat = 16;
+// Side of the square tiles handled by transpose_tile
+constexpr size_t kTransposeTile = 4;
+
+// Kernels of one instruction set. Element-wise kernels work on n
+// contiguous doubles, so callers iterate over rows.
+struct KernelTable {
+  Isa isa;
+  void (*add)(double* dst, const double* src, size_t n);
+  void (*sub)(double* dst, const double* src, size_t n);
+  void (*scale)(double* dst, double num, size_t n);
+  void (*fill)(double* dst, double value, size_t n);
+  bool (*equal)(const double* a, const double* b, size_t n);
+  // C[0:mr, 0:nr] += A * B for a packed kGemmMR x kc sliver of A and a
+  // packed kc x kGemmNR sliver of B
+  void (*gemm_tile)(size_t kc, const double* a, const double* b, double* c,
+                    size_t rsc, size_t mr, size_t nr);
+  // The same on floats, with a kc x kGemmNRFloat sliver of B
+  void (*gemm_tile_float)(size_t kc, const float* a, const float* b,
+                          float* c, size_t rsc, size_t mr, size_t nr);
+  // dst[j * ldd + i] = src[i * lds + j] on one kTransposeTile square tile
+  void (*transpose_tile)(const double* src, size_t lds, double* dst,
+                         size_t ldd);
+};
+
+// Strongest instruction set supported by the host CPU
+Isa DetectIsa();
+// Kernels in use. Selected on first call from the host CPU, the MATRIX_ISA
+// environment variable (scalar, sse2, avx2 or avx512) caps the choice.
+const KernelTable& Active();
+// Switches kernels at runtime, clamped to what the CPU supports, and
+// returns the instruction set actually selected. Not safe to call while
+// other threads run matrix operations.
+Isa SetIsa(Isa isa);
+const char* IsaName(Isa isa);
+
+}  // namespace kernels
+#endif
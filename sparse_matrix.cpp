@@ -0,0 +1,309 @@
+#include "sparse_matrix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#include "thread_pool.h"
+
+namespace {
+
+constexpr size_t kNone = std::numeric_limits<size_t>::max();
+
+}  // namespace
+
+SparseMatrix::SparseMatrix() : SparseMatrix(0, 0) {}
+
+SparseMatrix::SparseMatrix(size_t rows, size_t cols)
+    : rows_(rows), cols_(cols), row_offsets_(rows + 1, 0) {}
+
+SparseMatrix::SparseMatrix(size_t rows, size_t cols,
+                           std::vector<Triplet> triplets)
+    : SparseMatrix(rows, cols) {
+  for (const Triplet& triplet : triplets)
+    if (triplet.row >= rows || triplet.col >= cols)
+      throw std::out_of_range("triplet out of matrix bounds");
+  std::sort(triplets.begin(), triplets.end(),
+            [](const Triplet& fst, const Triplet& snd) {
+              return fst.row != snd.row ? fst.row < snd.row : fst.col < snd.col;
+            });
+  columns_.reserve(triplets.size());
+  values_.reserve(triplets.size());
+  for (size_t k = 0; k != triplets.size(); ++k) {
+    const Triplet& triplet = triplets[k];
+    if (k && triplets[k - 1].row == triplet.row &&
+        triplets[k - 1].col == triplet.col) {
+      values_.back() += triplet.value;
+      continue;
+    }
+    columns_.push_back(triplet.col);
+    values_.push_back(triplet.value);
+    ++row_offsets_[triplet.row + 1];
+  }
+  std::partial_sum(row_offsets_.begin(), row_offsets_.end(),
+                   row_offsets_.begin());
+}
+
+SparseMatrix::SparseMatrix(const Matrix& dense, double threshold)
+    : SparseMatrix(dense.getRows(), dense.getCols()) {
+  for (size_t i = 0; i != rows_; ++i) {
+    const double* row = dense.row(i).data();
+    for (size_t j = 0; j != cols_; ++j)
+      if (std::fabs(row[j]) > threshold) {
+        columns_.push_back(j);
+        values_.push_back(row[j]);
+      }
+    row_offsets_[i + 1] = columns_.size();
+  }
+}
+
+double SparseMatrix::operator()(size_t i, size_t j) const {
+  if (i >= rows_) throw std::out_of_range("i out greater then num rows");
+  if (j >= cols_) throw std::out_of_range("j out greater then num columns");
+  auto first = columns_.begin() + row_offsets_[i];
+  auto last = columns_.begin() + row_offsets_[i + 1];
+  auto it = std::lower_bound(first, last, j);
+  return it != last && *it == j ? values_[it - columns_.begin()] : 0;
+}
+
+size_t SparseMatrix::getRows() const { return rows_; }
+
+size_t SparseMatrix::getCols() const { return cols_; }
+
+size_t SparseMatrix::getNonZeros() const { return values_.size(); }
+
+const std::vector<size_t>& SparseMatrix::getRowOffsets() const {
+  return row_offsets_;
+}
+
+const std::vector<size_t>& SparseMatrix::getColumns() const {
+  return columns_;
+}
+
+const std::vector<double>& SparseMatrix::getValues() const { return values_; }
+
+Matrix SparseMatrix::ToDense() const {
+  Matrix dense(rows_, cols_);
+  for (size_t i = 0; i != rows_; ++i) {
+    double* row = dense.row(i).data();
+    for (size_t p = row_offsets_[i]; p != row_offsets_[i + 1]; ++p)
+      row[columns_[p]] = values_[p];
+  }
+  return dense;
+}
+
+// Counting sort by column, rows come out in ascending order
+SparseMatrix SparseMatrix::Transpose() const {
+  SparseMatrix result(cols_, rows_);
+  for (size_t col : columns_) ++result.row_offsets_[col + 1];
+  std::partial_sum(result.row_offsets_.begin(), result.row_offsets_.end(),
+                   result.row_offsets_.begin());
+  result.columns_.resize(values_.size());
+  result.values_.resize(values_.size());
+  std::vector<size_t> next(result.row_offsets_.begin(),
+                           result.row_offsets_.end() - 1);
+  for (size_t i = 0; i != rows_; ++i)
+    for (size_t p = row_offsets_[i]; p != row_offsets_[i + 1]; ++p) {
+      size_t q = next[columns_[p]]++;
+      result.columns_[q] = i;
+      result.values_[q] = values_[p];
+    }
+  return result;
+}
+
+std::vector<double> SparseMatrix::MulVector(
+    const std::vector<double>& x) const {
+  if (x.size() != cols_)
+    throw Matrix::DifferentMatrixSize("vector size not equal cols count");
+  std::vector<double> y(rows_);
+  size_t cost = values_.size() / std::max<size_t>(rows_, 1) + 1;
+  ThreadPool::ParallelFor(rows_, 2 * cost, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i) {
+      double sum = 0;
+      for (size_t p = row_offsets_[i]; p != row_offsets_[i + 1]; ++p)
+        sum += values_[p] * x[columns_[p]];
+      y[i] = sum;
+    }
+  });
+  return y;
+}
+
+Matrix SparseMatrix::MulDense(const Matrix& dense) const {
+  if (cols_ != dense.getRows())
+    throw Matrix::DifferentMatrixSize(
+        "cols first op operand not equal rows second op");
+  size_t n = dense.getCols();
+  Matrix result(rows_, n);
+  if (n == 0) return result;
+  MatrixView c = result.view();
+  ConstMatrixView b = dense.view();
+  size_t cost = (values_.size() / std::max<size_t>(rows_, 1) + 1) * n;
+  ThreadPool::ParallelFor(rows_, 2 * cost, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i) {
+      double* c_row = c.data() + i * c.getRowStride();
+      for (size_t p = row_offsets_[i]; p != row_offsets_[i + 1]; ++p) {
+        const double* b_row = b.data() + columns_[p] * b.getRowStride();
+        double a = values_[p];
+        for (size_t j = 0; j != n; ++j) c_row[j] += a * b_row[j];
+      }
+    }
+  });
+  return result;
+}
+
+// Gustavson's row-by-row product: a symbolic pass sizes every row of the
+// result, a numeric pass accumulates it in a dense scratch row
+SparseMatrix SparseMatrix::MulSparse(const SparseMatrix& other) const {
+  if (cols_ != other.rows_)
+    throw Matrix::DifferentMatrixSize(
+        "cols first op operand not equal rows second op");
+  SparseMatrix result(rows_, other.cols_);
+  size_t cost = (values_.size() / std::max<size_t>(rows_, 1) + 1) *
+                (other.values_.size() / std::max<size_t>(other.rows_, 1) + 1);
+  ThreadPool::ParallelFor(rows_, cost, [&](size_t first, size_t last) {
+    std::vector<size_t> mark(other.cols_, kNone);
+    for (size_t i = first; i != last; ++i) {
+      size_t count = 0;
+      for (size_t p = row_offsets_[i]; p != row_offsets_[i + 1]; ++p) {
+        size_t k = columns_[p];
+        for (size_t q = other.row_offsets_[k]; q != other.row_offsets_[k + 1];
+             ++q)
+          if (mark[other.columns_[q]] != i) {
+            mark[other.columns_[q]] = i;
+            ++count;
+          }
+      }
+      result.row_offsets_[i + 1] = count;
+    }
+  });
+  std::partial_sum(result.row_offsets_.begin(), result.row_offsets_.end(),
+                   result.row_offsets_.begin());
+  result.columns_.resize(result.row_offsets_.back());
+  result.values_.resize(result.row_offsets_.back());
+  ThreadPool::ParallelFor(rows_, 2 * cost, [&](size_t first, size_t last) {
+    std::vector<size_t> mark(other.cols_, kNone);
+    std::vector<double> accumulator(other.cols_);
+    for (size_t i = first; i != last; ++i) {
+      size_t begin = result.row_offsets_[i], end = begin;
+      for (size_t p = row_offsets_[i]; p != row_offsets_[i + 1]; ++p) {
+        size_t k = columns_[p];
+        double a = values_[p];
+        for (size_t q = other.row_offsets_[k]; q != other.row_offsets_[k + 1];
+             ++q) {
+          size_t j = other.columns_[q];
+          if (mark[j] != i) {
+            mark[j] = i;
+            result.columns_[end++] = j;
+            accumulator[j] = a * other.values_[q];
+          } else {
+            accumulator[j] += a * other.values_[q];
+          }
+        }
+      }
+      std::sort(result.columns_.begin() + begin, result.columns_.begin() + end);
+      for (size_t q = begin; q != end; ++q)
+        result.values_[q] = accumulator[result.columns_[q]];
+    }
+  });
+  return result;
+}
+
+// Left-looking LU (Gilbert-Peierls). Column j is solved against the
+// columns of L computed so far; a depth-first search over L finds the
+// rows it reaches, so the work is proportional to the flops rather than
+// to n. Only the diagonal of U is kept.
+double SparseMatrix::Determinant() const {
+  if (rows_ != cols_) throw Matrix::NotSquare("matrix is not square");
+  size_t n = rows_;
+  SparseMatrix columns = Transpose();
+  // Column k of L, rows numbered as in the input matrix
+  std::vector<size_t> l_offsets{0}, l_rows;
+  std::vector<double> l_values;
+  // Step at which a row became pivot, and the pivot row of every step
+  std::vector<size_t> pivot_step(n, kNone), pivot_row(n);
+  std::vector<double> x(n, 0.0);
+  std::vector<size_t> visited(n, kNone), order;
+  std::vector<std::pair<size_t, size_t>> stack;
+  double result = 1;
+  for (size_t j = 0; j != n; ++j) {
+    order.clear();
+    for (size_t p = columns.row_offsets_[j]; p != columns.row_offsets_[j + 1];
+         ++p) {
+      size_t start = columns.columns_[p];
+      x[start] = columns.values_[p];
+      if (visited[start] == j) continue;
+      visited[start] = j;
+      stack.push_back({start, 0});
+      while (!stack.empty()) {
+        size_t node = stack.back().first, pos = stack.back().second;
+        size_t k = pivot_step[node], child = kNone;
+        if (k != kNone)
+          for (; l_offsets[k] + pos != l_offsets[k + 1]; ++pos)
+            if (visited[l_rows[l_offsets[k] + pos]] != j) {
+              child = l_rows[l_offsets[k] + pos++];
+              break;
+            }
+        if (child == kNone) {
+          order.push_back(node);
+          stack.pop_back();
+        } else {
+          stack.back().second = pos;
+          visited[child] = j;
+          stack.push_back({child, 0});
+        }
+      }
+    }
+    // Reverse post-order is a topological order of the reached rows
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      size_t k = pivot_step[*it];
+      if (k == kNone) continue;
+      double u = x[*it];
+      for (size_t q = l_offsets[k]; q != l_offsets[k + 1]; ++q)
+        x[l_rows[q]] -= l_values[q] * u;
+    }
+    size_t pivot = kNone;
+    for (size_t row : order)
+      if (pivot_step[row] == kNone &&
+          (pivot == kNone || std::fabs(x[row]) > std::fabs(x[pivot])))
+        pivot = row;
+    if (pivot == kNone || x[pivot] == 0) return 0;
+    result *= x[pivot];
+    pivot_step[pivot] = j;
+    pivot_row[j] = pivot;
+    for (size_t row : order) {
+      if (pivot_step[row] == kNone && x[row] != 0) {
+        l_rows.push_back(row);
+        l_values.push_back(x[row] / x[pivot]);
+      }
+    }
+    l_offsets.push_back(l_rows.size());
+    for (size_t row : order) x[row] = 0;
+  }
+  // Every cycle of length c in the row permutation contributes c - 1
+  // transpositions
+  std::vector<bool> seen(n, false);
+  for (size_t i = 0; i != n; ++i) {
+    if (seen[i]) continue;
+    for (size_t k = i; !seen[k]; k = pivot_row[k]) {
+      seen[k] = true;
+      if (pivot_row[k] != i) result = -result;
+    }
+  }
+  return result;
+}
+
+std::vector<double> operator*(const SparseMatrix& fst,
+                              const std::vector<double>& snd) {
+  return fst.MulVector(snd);
+}
+
+Matrix operator*(const SparseMatrix& fst, const Matrix& snd) {
+  return fst.MulDense(snd);
+}
+
+SparseMatrix operator*(const SparseMatrix& fst, const SparseMatrix& snd) {
+  return fst.MulSparse(snd);
+}
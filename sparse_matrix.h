@@ -0,0 +1,58 @@
+#ifndef SPARSE_MATRIX_H
+#define SPARSE_MATRIX_H
+#include <cstddef>
+#include <vector>
+
+#include "matrix.h"
+
+// Matrix in compressed sparse row (CSR) form: the nonzeros of row i are
+// values_[row_offsets_[i] .. row_offsets_[i + 1]) at columns sorted in
+// ascending order. The compressed column (CSC) form of a matrix is the
+// CSR form of its transpose.
+class SparseMatrix {
+ private:
+  size_t rows_, cols_;
+  std::vector<size_t> row_offsets_;
+  std::vector<size_t> columns_;
+  std::vector<double> values_;
+
+ public:
+  struct Triplet {
+    size_t row, col;
+    double value;
+  };
+
+  // Constructors
+  SparseMatrix();
+  SparseMatrix(size_t rows, size_t cols);
+  // Duplicate entries are summed
+  SparseMatrix(size_t rows, size_t cols, std::vector<Triplet> triplets);
+  // Keeps the elements whose magnitude exceeds threshold
+  explicit SparseMatrix(const Matrix& dense, double threshold = 0);
+
+  double operator()(size_t i, size_t j) const;
+
+  // accessors
+  size_t getRows() const;
+  size_t getCols() const;
+  size_t getNonZeros() const;
+  const std::vector<size_t>& getRowOffsets() const;
+  const std::vector<size_t>& getColumns() const;
+  const std::vector<double>& getValues() const;
+
+  // Member functions
+  Matrix ToDense() const;
+  SparseMatrix Transpose() const;
+  std::vector<double> MulVector(const std::vector<double>& x) const;
+  Matrix MulDense(const Matrix& dense) const;
+  SparseMatrix MulSparse(const SparseMatrix& other) const;
+  // Sparse LU with partial pivoting, columns in natural order
+  double Determinant() const;
+};
+
+// Function overloading operators
+std::vector<double> operator*(const SparseMatrix& fst,
+                              const std::vector<double>& snd);
+Matrix operator*(const SparseMatrix& fst, const Matrix& snd);
+SparseMatrix operator*(const SparseMatrix& fst, const SparseMatrix& snd);
+#endif
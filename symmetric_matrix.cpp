@@ -0,0 +1,170 @@
+#include "symmetric_matrix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "lu.h"
+#include "thread_pool.h"
+
+namespace {
+
+const double* packedRow(const std::vector<double>& data, size_t i) {
+  return data.data() + i * (i + 1) / 2;
+}
+
+double* packedRow(std::vector<double>& data, size_t i) {
+  return data.data() + i * (i + 1) / 2;
+}
+
+// Overwrites the packed lower triangle of an n x n matrix with its
+// Cholesky factor L, row by row. Every entry is one dot product of two
+// contiguous row prefixes. False when a pivot is not positive.
+bool packedCholesky(std::vector<double>& data, size_t n) {
+  for (size_t i = 0; i != n; ++i) {
+    double* row = packedRow(data, i);
+    for (size_t j = 0; j <= i; ++j) {
+      const double* pivot_row = packedRow(data, j);
+      double sum = row[j];
+      for (size_t k = 0; k != j; ++k) sum -= row[k] * pivot_row[k];
+      if (j != i) {
+        row[j] = sum / pivot_row[j];
+      } else {
+        if (!(sum > 0)) return false;
+        row[i] = std::sqrt(sum);
+      }
+    }
+  }
+  return true;
+}
+
+// L^-1 of a packed lower factor, packed the same way: row i of the
+// inverse is (e_i - sum over k < i of L(i, k) * row k) / L(i, i)
+std::vector<double> packedInverseLower(const std::vector<double>& lower,
+                                       size_t n) {
+  std::vector<double> inverse(lower.size(), 0.0);
+  for (size_t i = 0; i != n; ++i) {
+    const double* l = packedRow(lower, i);
+    double* row = packedRow(inverse, i);
+    for (size_t k = 0; k != i; ++k) {
+      const double* other = packedRow(inverse, k);
+      for (size_t j = 0; j <= k; ++j) row[j] -= l[k] * other[j];
+    }
+    row[i] = 1;
+    for (size_t j = 0; j <= i; ++j) row[j] /= l[i];
+  }
+  return inverse;
+}
+
+}  // namespace
+
+SymmetricMatrix::SymmetricMatrix() : SymmetricMatrix(0) {}
+
+SymmetricMatrix::SymmetricMatrix(size_t size)
+    : size_(size), data_(size * (size + 1) / 2, 0.0) {}
+
+SymmetricMatrix::SymmetricMatrix(const Matrix& matrix)
+    : SymmetricMatrix(matrix.getRows()) {
+  if (matrix.getRows() != matrix.getCols())
+    throw Matrix::NotSquare("matrix is not square");
+  for (size_t i = 0; i != size_; ++i) {
+    const double* row = matrix.row(i).data();
+    std::copy_n(row, i + 1, data_.begin() + index(i, 0));
+  }
+}
+
+size_t SymmetricMatrix::index(size_t i, size_t j) const {
+  if (i < j) std::swap(i, j);
+  return i * (i + 1) / 2 + j;
+}
+
+double& SymmetricMatrix::operator()(size_t i, size_t j) {
+  if (i >= size_) throw std::out_of_range("i out greater then num rows");
+  if (j >= size_) throw std::out_of_range("j out greater then num columns");
+  return data_[index(i, j)];
+}
+
+const double& SymmetricMatrix::operator()(size_t i, size_t j) const {
+  if (i >= size_) throw std::out_of_range("i out greater then num rows");
+  if (j >= size_) throw std::out_of_range("j out greater then num columns");
+  return data_[index(i, j)];
+}
+
+size_t SymmetricMatrix::getSize() const { return size_; }
+
+const std::vector<double>& SymmetricMatrix::getPacked() const {
+  return data_;
+}
+
+Matrix SymmetricMatrix::ToDense() const {
+  Matrix dense(size_, size_);
+  MatrixView view = dense.view();
+  for (size_t i = 0; i != size_; ++i) {
+    const double* packed = data_.data() + index(i, 0);
+    double* row = view.data() + i * view.getRowStride();
+    for (size_t j = 0; j <= i; ++j)
+      row[j] = view.data()[j * view.getRowStride() + i] = packed[j];
+  }
+  return dense;
+}
+
+void SymmetricMatrix::SumMatrix(const SymmetricMatrix& other) {
+  if (size_ != other.size_) throw Matrix::DifferentMatrixSize("size not equal");
+  for (size_t p = 0; p != data_.size(); ++p) data_[p] += other.data_[p];
+}
+
+void SymmetricMatrix::SubMatrix(const SymmetricMatrix& other) {
+  if (size_ != other.size_) throw Matrix::DifferentMatrixSize("size not equal");
+  for (size_t p = 0; p != data_.size(); ++p) data_[p] -= other.data_[p];
+}
+
+void SymmetricMatrix::MulNumber(const double num) {
+  for (double& value : data_) value *= num;
+}
+
+bool SymmetricMatrix::EqMatrix(const SymmetricMatrix& other) const {
+  return size_ == other.size_ && data_ == other.data_;
+}
+
+double SymmetricMatrix::Determinant() const {
+  std::vector<double> lower = data_;
+  if (!packedCholesky(lower, size_)) return LU(ToDense()).Determinant();
+  double result = 1;
+  for (size_t i = 0; i != size_; ++i) {
+    double l = lower[index(i, i)];
+    result *= l * l;
+  }
+  return result;
+}
+
+// A^-1 = L^-T * L^-1: element (i, j), j <= i, sums V(k, i) * V(k, j) over
+// k >= i with V = L^-1, so row i of the result accumulates the prefixes
+// of rows k >= i of V. Rows of the result are independent.
+SymmetricMatrix SymmetricMatrix::InverseMatrix() const {
+  std::vector<double> lower = data_;
+  if (!packedCholesky(lower, size_))
+    return SymmetricMatrix(LU(ToDense()).InverseMatrix());
+  const size_t n = size_;
+  const std::vector<double> v = packedInverseLower(lower, n);
+  SymmetricMatrix result(n);
+  ThreadPool::ParallelFor(n, n * n / 2, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i) {
+      double* row = packedRow(result.data_, i);
+      for (size_t k = i; k != n; ++k) {
+        const double* v_row = packedRow(v, k);
+        const double scale = v_row[i];
+        for (size_t j = 0; j <= i; ++j) row[j] += scale * v_row[j];
+      }
+    }
+  });
+  return result;
+}
+
+bool operator==(const SymmetricMatrix& fst, const SymmetricMatrix& snd) {
+  return fst.EqMatrix(snd);
+}
+
+bool operator!=(const SymmetricMatrix& fst, const SymmetricMatrix& snd) {
+  return !(fst == snd);
+}
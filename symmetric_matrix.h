@@ -0,0 +1,47 @@
+#ifndef SYMMETRIC_MATRIX_H
+#define SYMMETRIC_MATRIX_H
+#include <cstddef>
+#include <vector>
+
+#include "matrix.h"
+
+// Symmetric n x n matrix with only the lower triangle stored, packed by
+// rows: element (i, j), j <= i, lives at data_[i * (i + 1) / 2 + j] and
+// (j, i) refers to the same element. Half the memory of a Matrix.
+class SymmetricMatrix {
+ private:
+  size_t size_;
+  std::vector<double> data_;
+
+  size_t index(size_t i, size_t j) const;
+
+ public:
+  // Constructors
+  SymmetricMatrix();
+  explicit SymmetricMatrix(size_t size);
+  // Takes the lower triangle of a square matrix
+  explicit SymmetricMatrix(const Matrix& matrix);
+
+  double& operator()(size_t i, size_t j);
+  const double& operator()(size_t i, size_t j) const;
+
+  // accessors
+  size_t getSize() const;
+  const std::vector<double>& getPacked() const;
+
+  // Member functions
+  Matrix ToDense() const;
+  void SumMatrix(const SymmetricMatrix& other);
+  void SubMatrix(const SymmetricMatrix& other);
+  void MulNumber(const double num);
+  bool EqMatrix(const SymmetricMatrix& other) const;
+  // Through a Cholesky factor kept packed like the matrix when positive
+  // definite, otherwise through LU on a dense copy
+  double Determinant() const;
+  SymmetricMatrix InverseMatrix() const;
+};
+
+// Function overloading operators
+bool operator==(const SymmetricMatrix& fst, const SymmetricMatrix& snd);
+bool operator!=(const SymmetricMatrix& fst, const SymmetricMatrix& snd);
+#endif
@@ -1,9 +1,35 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory_resource>
+#include <numeric>
 #include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include <utility>
 
+#include "cholesky.h"
+#include "fixed_matrix.h"
+#include "gemm.h"
+#include "instrument.h"
+#include "lu.h"
 #include "matrix.h"
+#include "matrix_batch.h"
+#include "qr.h"
+#include "simd.h"
+#include "sparse_matrix.h"
+#include "symmetric_matrix.h"
+#include "thread_pool.h"
 
 namespace testing {
 AssertionResult AssertionSuccess();
@@ -29,6 +55,26 @@ testing::AssertionResult MatrixIsEqual(const Matrix& cls,
   return testing::AssertionSuccess();
 }
 
+template <size_t R, size_t C>
+testing::AssertionResult MatrixIsNear(const Matrix& cls,
+                                      double (&matrix)[R][C],
+                                      double eps = 1e-9) {
+  if (cls.getRows() != R)
+    return testing::AssertionFailure()
+           << "Class rows_: " << cls.getRows() << "!=" << R;
+  if (cls.getCols() != C)
+    return testing::AssertionFailure()
+           << "Class cols_: " << cls.getCols() << "!=" << C;
+
+  for (size_t i = 0; i != R; ++i)
+    for (size_t j = 0; j != C; ++j)
+      if (std::fabs(cls(i, j) - matrix[i][j]) > eps)
+        return testing::AssertionFailure()
+               << "Matrix element(" << i << "," << j << ") = " << cls(i, j)
+               << "!=" << matrix[i][j];
+  return testing::AssertionSuccess();
+}
+
 TEST(MatrixConstructorTest, TestBaseConstructor) {
   Matrix matrix;
   double m[2][2] = {{0, 0}, {0, 0}};
@@ -512,7 +558,7 @@ TEST(MatrixMemberFunctionTest, TestCompliment) {
   Matrix compliment_matrix = matrix.CalcComplements();
   EXPECT_TRUE(MatrixIsEqual(matrix, m));
   double m_compl[3][3] = {{-1, 2, -1}, {2, -4, 2}, {-1, 2, -1}};
-  EXPECT_TRUE(MatrixIsEqual(compliment_matrix, m_compl));
+  EXPECT_TRUE(MatrixIsNear(compliment_matrix, m_compl));
   EXPECT_EQ(compliment_matrix.getRows(), 3);
   EXPECT_EQ(compliment_matrix.getCols(), 3);
   EXPECT_EQ(matrix.getRows(), 3);
@@ -711,4 +757,1840 @@ TEST(MatrixExternalOperatorTest, TestMulMatrixOverloadDifferentSize) {
   } catch (const Matrix::DifferentMatrixSize& ex) {
     EXPECT_STREQ("cols first op operand not equal rows second op", ex.what());
   }
-}
\ No newline at end of file
+}
+
+TEST(MatrixStorageTest, TestContiguousAlignedRows) {
+  Matrix matrix(3, 5);
+  EXPECT_GE(matrix.getStride(), matrix.getCols());
+  EXPECT_EQ(matrix.getStride() * sizeof(double) % Matrix::kAlignment, 0);
+  for (size_t i = 0; i != 3; ++i) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&matrix(i, 0)) % Matrix::kAlignment,
+              0);
+    EXPECT_EQ(&matrix(i, 4) - &matrix(0, 0),
+              static_cast<ptrdiff_t>(i * matrix.getStride() + 4));
+  }
+}
+
+TEST(MatrixStorageTest, TestSetColsOverStride) {
+  Matrix matrix(2, 3);
+  for (size_t i = 0; i != 2; ++i)
+    for (size_t j = 0; j != 3; ++j) matrix(i, j) = i * 3 + j + 1;
+  matrix.setCols(11);
+  EXPECT_GE(matrix.getStride(), 11);
+  double m[2][11] = {{1, 2, 3, 0, 0, 0, 0, 0, 0, 0, 0},
+                     {4, 5, 6, 0, 0, 0, 0, 0, 0, 0, 0}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m));
+  matrix.setCols(2);
+  matrix.setCols(4);
+  double m_2[2][4] = {{1, 2, 0, 0}, {4, 5, 0, 0}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m_2));
+}
+
+TEST(MatrixStorageTest, TestSelfAssignment) {
+  Matrix matrix(2, 2);
+  matrix(0, 1) = 3;
+  Matrix& link = matrix;
+  matrix = link;
+  double m[2][2] = {{0, 3}, {0, 0}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m));
+}
+
+TEST(MatrixGemmTest, TestBlockedMulMatchesNaive) {
+  const size_t m = 131, k = 277, n = 67;
+  Matrix matrix(m, k);
+  Matrix matrix_2(k, n);
+  for (size_t i = 0; i != m; ++i)
+    for (size_t j = 0; j != k; ++j) matrix(i, j) = (i * 7 + j * 3) % 11 - 5;
+  for (size_t i = 0; i != k; ++i)
+    for (size_t j = 0; j != n; ++j) matrix_2(i, j) = (i * 5 + j) % 13 - 6;
+  Matrix product = matrix * matrix_2;
+  ASSERT_EQ(product.getRows(), m);
+  ASSERT_EQ(product.getCols(), n);
+  for (size_t i = 0; i != m; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      double expected = 0;
+      for (size_t p = 0; p != k; ++p) expected += matrix(i, p) * matrix_2(p, j);
+      EXPECT_EQ(product(i, j), expected);
+    }
+}
+
+TEST(MatrixGemmTest, TestBlockedMulIdentity) {
+  const size_t n = 300;
+  Matrix matrix(n, n);
+  Matrix identity(n, n);
+  for (size_t i = 0; i != n; ++i) {
+    identity(i, i) = 1;
+    for (size_t j = 0; j != n; ++j) matrix(i, j) = i * 0.5 - j * 0.25;
+  }
+  Matrix product = matrix;
+  product *= identity;
+  EXPECT_TRUE(product == matrix);
+  product = identity * matrix;
+  EXPECT_TRUE(product == matrix);
+}
+
+class MatrixIsaTest : public ::testing::TestWithParam<kernels::Isa> {
+ protected:
+  void SetUp() override {
+    previous_ = kernels::Active().isa;
+    if (kernels::SetIsa(GetParam()) != GetParam())
+      GTEST_SKIP() << kernels::IsaName(GetParam()) << " is not supported";
+  }
+  void TearDown() override { kernels::SetIsa(previous_); }
+
+ private:
+  kernels::Isa previous_;
+};
+
+TEST_P(MatrixIsaTest, TestElementwiseKernels) {
+  const size_t rows = 5, cols = 19;
+  Matrix matrix(rows, cols);
+  Matrix matrix_2(rows, cols);
+  for (size_t i = 0; i != rows; ++i)
+    for (size_t j = 0; j != cols; ++j) {
+      matrix(i, j) = i * 0.5 + j;
+      matrix_2(i, j) = j * 0.25 - i;
+    }
+  Matrix sum = matrix;
+  sum.SumMatrix(matrix_2);
+  Matrix sub = matrix;
+  sub.SubMatrix(matrix_2);
+  Matrix mul = matrix;
+  mul.MulNumber(-1.5);
+  for (size_t i = 0; i != rows; ++i)
+    for (size_t j = 0; j != cols; ++j) {
+      EXPECT_EQ(sum(i, j), matrix(i, j) + matrix_2(i, j));
+      EXPECT_EQ(sub(i, j), matrix(i, j) - matrix_2(i, j));
+      EXPECT_EQ(mul(i, j), matrix(i, j) * -1.5);
+    }
+  Matrix copy = matrix;
+  EXPECT_TRUE(copy.EqMatrix(matrix));
+  copy(rows - 1, cols - 1) += 1;
+  EXPECT_FALSE(copy.EqMatrix(matrix));
+  copy = matrix;
+  copy(0, 0) = NAN;
+  EXPECT_FALSE(copy.EqMatrix(copy));
+  Matrix zero(rows, cols);
+  for (size_t i = 0; i != rows; ++i)
+    for (size_t j = 0; j != cols; ++j) EXPECT_EQ(zero(i, j), 0);
+}
+
+TEST_P(MatrixIsaTest, TestGemmKernel) {
+  const size_t n = 45;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) matrix(i, j) = (i + 2 * j) % 7 - 3;
+  Matrix product = matrix * matrix;
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      double expected = 0;
+      for (size_t p = 0; p != n; ++p) expected += matrix(i, p) * matrix(p, j);
+      EXPECT_EQ(product(i, j), expected);
+    }
+}
+
+TEST_P(MatrixIsaTest, TestTransposeKernel) {
+  const size_t shapes[][2] = {{1, 1}, {4, 4}, {37, 53}, {70, 70}, {5, 129}};
+  for (const auto& shape : shapes) {
+    size_t rows = shape[0], cols = shape[1];
+    Matrix matrix(rows, cols);
+    for (size_t i = 0; i != rows; ++i)
+      for (size_t j = 0; j != cols; ++j) matrix(i, j) = i * 1000.0 + j;
+    Matrix transposed = matrix.Transpose();
+    ASSERT_EQ(transposed.getRows(), cols);
+    ASSERT_EQ(transposed.getCols(), rows);
+    for (size_t i = 0; i != rows; ++i)
+      for (size_t j = 0; j != cols; ++j)
+        EXPECT_EQ(transposed(j, i), matrix(i, j));
+    // kernels rely on zero padding between getCols() and getStride()
+    for (size_t j = 0; j != cols; ++j)
+      for (size_t i = rows; i != transposed.getStride(); ++i)
+        EXPECT_EQ(transposed.rowPtr(j)[i], 0);
+    matrix.TransposeInPlace();
+    EXPECT_TRUE(matrix == transposed);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    AllIsa, MatrixIsaTest,
+    ::testing::Values(kernels::Isa::kScalar, kernels::Isa::kSse2,
+                      kernels::Isa::kAvx2, kernels::Isa::kAvx512),
+    [](const ::testing::TestParamInfo<kernels::Isa>& info) {
+      return std::string(kernels::IsaName(info.param));
+    });
+
+class MatrixThreadPoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    threads_ = ThreadPool::ThreadCount();
+    grain_ = ThreadPool::GrainSize();
+    ThreadPool::SetThreadCount(4);
+    ThreadPool::SetGrainSize(64);
+  }
+  void TearDown() override {
+    ThreadPool::SetThreadCount(threads_);
+    ThreadPool::SetGrainSize(grain_);
+  }
+
+ private:
+  size_t threads_, grain_;
+};
+
+TEST_F(MatrixThreadPoolTest, TestParallelForCoversRange) {
+  std::vector<std::atomic<int>> visits(1000);
+  ThreadPool::ParallelFor(visits.size(), 1000, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i) visits[i]++;
+  });
+  for (const auto& visit : visits) EXPECT_EQ(visit.load(), 1);
+}
+
+TEST_F(MatrixThreadPoolTest, TestParallelForNestedAndExceptions) {
+  std::atomic<size_t> total{0};
+  ThreadPool::ParallelFor(16, 1000, [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i)
+      ThreadPool::ParallelFor(16, 1000, [&](size_t inner, size_t inner_last) {
+        total += inner_last - inner;
+      });
+  });
+  EXPECT_EQ(total.load(), 16 * 16);
+  EXPECT_THROW(ThreadPool::ParallelFor(100, 1000,
+                                       [](size_t first, size_t) {
+                                         if (first != 0)
+                                           throw std::runtime_error("chunk");
+                                       }),
+               std::runtime_error);
+}
+
+TEST_F(MatrixThreadPoolTest, TestParallelOperationsMatchSerial) {
+  const size_t n = 150;
+  Matrix matrix(n, n);
+  Matrix matrix_2(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      matrix(i, j) = (i * 3 + j * 7) % 17 - 8;
+      matrix_2(i, j) = (i == j) * 3.0 + (i + j) % 5 * 0.5;
+    }
+  Matrix sum = matrix + matrix_2;
+  Matrix product = matrix * matrix_2;
+  Matrix transpose = matrix.Transpose();
+  double det = matrix_2.Determinant();
+  ThreadPool::SetThreadCount(1);
+  EXPECT_TRUE(sum == matrix + matrix_2);
+  EXPECT_TRUE(product == matrix * matrix_2);
+  EXPECT_TRUE(transpose == matrix.Transpose());
+  EXPECT_EQ(det, matrix_2.Determinant());
+}
+
+TEST(MatrixLUTest, TestFactorsReproduceMatrix) {
+  const size_t n = 150;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = std::sin(i * 1.7 + j * 0.3) + (i == j) * 0.1;
+  LU lu(matrix);
+  EXPECT_FALSE(lu.isSingular());
+  Matrix product = lu.getLower() * lu.getUpper();
+  const std::vector<size_t>& perm = lu.getPermutation();
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      EXPECT_NEAR(product(i, j), matrix(perm[i], j), 1e-12);
+}
+
+TEST(MatrixLUTest, TestDeterminantAndInverse) {
+  Matrix matrix(3, 3);
+  double m[3][3] = {{2, 5, 7}, {6, 3, 4}, {5, -2, -3}};
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 3; ++j) matrix(i, j) = m[i][j];
+  LU lu(matrix);
+  EXPECT_NEAR(lu.Determinant(), -1, 1e-12);
+  EXPECT_NEAR(matrix.Determinant(), -1, 1e-12);
+  double m_inv[3][3] = {{1, -1, 1}, {-38, 41, -34}, {27, -29, 24}};
+  EXPECT_TRUE(MatrixIsNear(lu.InverseMatrix(), m_inv));
+  EXPECT_TRUE(MatrixIsNear(matrix.InverseMatrix(), m_inv));
+}
+
+TEST(MatrixLUTest, TestSolveReusesFactors) {
+  Matrix matrix(3, 3);
+  double m[3][3] = {{0, 2, 1}, {1, 1, 1}, {2, 1, 0}};
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 3; ++j) matrix(i, j) = m[i][j];
+  LU lu(matrix);
+  Matrix rhs(3, 2);
+  double x[3][2] = {{1, -1}, {2, 0}, {3, 4}};
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 2; ++j) rhs(i, j) = x[i][j];
+  Matrix solution = lu.Solve(matrix * rhs);
+  EXPECT_TRUE(MatrixIsNear(solution, x));
+  EXPECT_THROW(lu.Solve(Matrix(2, 2)), Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixLUTest, TestSingular) {
+  Matrix matrix(3, 3);
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 3; ++j) matrix(i, j) = i + j;
+  LU lu(matrix);
+  EXPECT_EQ(lu.Determinant(), 0);
+  EXPECT_THROW(lu.InverseMatrix(), Matrix::ZeroDeterminant);
+  EXPECT_THROW(lu.Solve(matrix), Matrix::ZeroDeterminant);
+  EXPECT_THROW(LU(Matrix(2, 3)), Matrix::NotSquare);
+}
+
+TEST(MatrixLUTest, TestBlockedSolve) {
+  // Several panels, and row pivoting on every one of them
+  const size_t n = 200, m = 37;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = std::sin(i * 0.7 + j * 1.3) + (i == j);
+  Matrix rhs(n, m);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != m; ++j) rhs(i, j) = std::cos(i * 0.3 - j * 0.5);
+  Matrix solution = matrix.Solve(rhs);
+  Matrix product = matrix * solution;
+  Matrix expected = matrix.InverseMatrix() * rhs;
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != m; ++j) {
+      EXPECT_NEAR(product(i, j), rhs(i, j), 1e-9);
+      EXPECT_NEAR(solution(i, j), expected(i, j), 1e-9);
+    }
+  EXPECT_THROW(matrix.Solve(Matrix(n - 1, 1)), Matrix::DifferentMatrixSize);
+  EXPECT_THROW(Matrix(2, 3).Solve(Matrix(2, 1)), Matrix::NotSquare);
+}
+
+TEST(MatrixLUTest, TestSolveInPlace) {
+  const size_t n = 90;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = std::cos(i * 0.9 + j * 1.1) + (i == j) * 3;
+  Matrix column(n, 1);
+  for (size_t i = 0; i != n; ++i) column(i, 0) = i * 0.5 - 7;
+  Matrix expected = LU(matrix).Solve(column);
+  const double* storage = column.view().data();
+  matrix.SolveInPlace(column);
+  EXPECT_EQ(column.view().data(), storage);
+  for (size_t i = 0; i != n; ++i)
+    EXPECT_NEAR(column(i, 0), expected(i, 0), 1e-12);
+  Matrix singular(2, 2);
+  EXPECT_THROW(singular.SolveInPlace(column), Matrix::DifferentMatrixSize);
+  Matrix rhs(2, 1);
+  EXPECT_THROW(singular.SolveInPlace(rhs), Matrix::ZeroDeterminant);
+}
+
+TEST(MatrixAdjugateTest, TestComplementsNonSingular) {
+  const size_t n = 40;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = std::cos(i * 0.9 + j * 1.1) + (i == j) * 3;
+  double det = matrix.Determinant();
+  Matrix product = matrix * matrix.CalcComplements().Transpose();
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      EXPECT_NEAR(product(i, j), (i == j) * det, std::fabs(det) * 1e-10);
+}
+
+TEST(MatrixAdjugateTest, TestComplementsRankDeficient) {
+  // rank 3 with an exactly zero third pivot, the rank-one path must agree
+  // with cofactor expansion
+  Matrix matrix(4, 4);
+  double m[4][4] = {
+      {-3, -2, -2, -2}, {-4, 1, 1, 0}, {0, 2, 2, -4}, {-7, -1, -1, -2}};
+  for (size_t i = 0; i != 4; ++i)
+    for (size_t j = 0; j != 4; ++j) matrix(i, j) = m[i][j];
+  EXPECT_TRUE(LU(matrix).isSingular());
+  Matrix complements = matrix.CalcComplements();
+  for (size_t i = 0; i != 4; ++i)
+    for (size_t j = 0; j != 4; ++j) {
+      Matrix minor(3, 3);
+      for (size_t r = 0, a = 0; r != 4; ++r) {
+        if (r == i) continue;
+        for (size_t c = 0, b = 0; c != 4; ++c)
+          if (c != j) minor(a, b++) = m[r][c];
+        ++a;
+      }
+      double expected = ((i + j) % 2 ? -1 : 1) * minor.Determinant();
+      EXPECT_NEAR(complements(i, j), expected, 1e-9);
+    }
+
+  Matrix matrix_2(2, 2);
+  matrix_2(0, 1) = 1;
+  double m_compl_2[2][2] = {{0, 0}, {-1, 0}};
+  EXPECT_TRUE(MatrixIsEqual(matrix_2.CalcComplements(), m_compl_2));
+}
+
+TEST(MatrixAdjugateTest, TestComplementsSeveralZeroPivots) {
+  // Strictly upper triangular with a unit superdiagonal: every pivot is
+  // zero, the rank is n - 1 and the only nonzero cofactor is at (n - 1, 0)
+  const size_t n = 150;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = i + 1; j != n; ++j)
+      matrix(i, j) = j == i + 1 ? 1 : std::cos(i * 0.7 + j * 1.3) / n;
+  // Rows in another order keep the pivots exactly zero
+  Matrix shuffled(n, n);
+  for (size_t i = 0; i != n; ++i)
+    shuffled.row((i * 7) % n) = matrix.row(i);
+  auto start = std::chrono::steady_clock::now();
+  Matrix complements = matrix.CalcComplements();
+  Matrix shuffled_complements = shuffled.CalcComplements();
+  Matrix zero_complements = Matrix(n, n).CalcComplements();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  // A cofactor expansion of every minor takes seconds here
+  EXPECT_LT(elapsed.count(), 1.0);
+  ASSERT_EQ(complements.getRows(), n);
+  ASSERT_EQ(complements.getCols(), n);
+  EXPECT_TRUE(zero_complements == Matrix(n, n));
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      double expected = i == n - 1 && j == 0 ? (n % 2 ? 1 : -1) : 0;
+      EXPECT_NEAR(complements(i, j), expected, 1e-9);
+      // Moving row i to (7 * i) % n moves its cofactors along and flips
+      // the sign with the parity of the permutation
+      double sign = shuffled_complements((7 * (n - 1)) % n, 0) /
+                    complements(n - 1, 0);
+      EXPECT_NEAR(shuffled_complements((7 * i) % n, j),
+                  sign * complements(i, j), 1e-9);
+    }
+  // A second zero column leaves rank n - 2
+  Matrix low_rank = shuffled;
+  for (size_t i = 0; i != n; ++i) low_rank(i, 5) = 0;
+  EXPECT_TRUE(low_rank.CalcComplements() == Matrix(n, n));
+}
+
+TEST(MatrixAdjugateTest, TestInverseLarge) {
+  const size_t n = 300;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = std::sin(i * 0.37 + j * 1.91) + (i == j) * n;
+  Matrix product = matrix * matrix.InverseMatrix();
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      EXPECT_NEAR(product(i, j), i == j ? 1.0 : 0.0, 1e-12);
+}
+
+TEST(MatrixExpressionTest, TestFusedExpression) {
+  Matrix matrix(3, 5);
+  Matrix matrix_2(3, 5);
+  Matrix matrix_3(3, 5);
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 5; ++j) {
+      matrix(i, j) = i + j;
+      matrix_2(i, j) = i * j;
+      matrix_3(i, j) = 0.5 * j;
+    }
+  auto expr = Lazy(matrix) + matrix_2 - 2.0 * Lazy(matrix_3);
+  static_assert(!std::is_same<decltype(expr), Matrix>::value,
+                "lazy operands build lazy expressions");
+  EXPECT_EQ(expr.getRows(), 3);
+  EXPECT_EQ(expr.getCols(), 5);
+  Matrix result = expr;
+  Matrix result_2;
+  result_2 = (Lazy(matrix_3) * 4 - matrix) * -1.0 + matrix_2;
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 5; ++j) {
+      EXPECT_EQ(result(i, j), matrix(i, j) + matrix_2(i, j) - 1.0 * j);
+      EXPECT_EQ(result_2(i, j), matrix(i, j) - 2.0 * j + matrix_2(i, j));
+    }
+}
+
+TEST(MatrixExpressionTest, TestResultsAreMatrices) {
+  Matrix matrix(2, 2);
+  Matrix matrix_2(2, 2);
+  for (size_t i = 0; i != 2; ++i)
+    for (size_t j = 0; j != 2; ++j) {
+      matrix(i, j) = i * 2 + j + 1;
+      matrix_2(i, j) = i == j;
+    }
+  EXPECT_NEAR((matrix + matrix_2).Determinant(), 4, 1e-12);
+  EXPECT_EQ((matrix - matrix_2)(1, 1), 3);
+  EXPECT_EQ((2.0 * matrix)(0, 1), 4);
+  auto sum = matrix + matrix_2;
+  sum.MulNumber(2);
+  double m[2][2] = {{4, 4}, {6, 10}};
+  EXPECT_TRUE(MatrixIsEqual(sum, m));
+  auto scaled = matrix * 0.5;
+  scaled.setRows(3);
+  EXPECT_EQ(scaled(2, 1), 0);
+  static_assert(std::is_same<decltype(matrix.view() + matrix), Matrix>::value,
+                "views evaluate like matrices");
+}
+
+TEST(MatrixExpressionTest, TestAliasingAndCompound) {
+  Matrix matrix(2, 2);
+  Matrix matrix_2(2, 2);
+  for (size_t i = 0; i != 2; ++i)
+    for (size_t j = 0; j != 2; ++j) {
+      matrix(i, j) = i + j;
+      matrix_2(i, j) = 1;
+    }
+  matrix = matrix + matrix * 2.0;
+  double m[2][2] = {{0, 3}, {3, 6}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m));
+  matrix += matrix_2 - 3.0 * matrix_2;
+  double m_2[2][2] = {{-2, 1}, {1, 4}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m_2));
+  matrix -= matrix_2 + matrix_2;
+  double m_3[2][2] = {{-4, -1}, {-1, 2}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m_3));
+  EXPECT_THROW(matrix += Matrix(3, 2) * 2.0, Matrix::DifferentMatrixSize);
+  EXPECT_THROW(matrix -= Matrix(2, 3) * 2.0, Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixExpressionTest, TestReshapeAndProduct) {
+  Matrix matrix(2, 3);
+  for (size_t i = 0; i != 2; ++i)
+    for (size_t j = 0; j != 3; ++j) matrix(i, j) = i + j;
+  Matrix result;
+  result = matrix + matrix;
+  double m[2][3] = {{0, 2, 4}, {2, 4, 6}};
+  EXPECT_TRUE(MatrixIsEqual(result, m));
+  Matrix product = (matrix + matrix) * (0.5 * matrix.Transpose());
+  double m_mul[2][2] = {{5, 8}, {8, 14}};
+  EXPECT_TRUE(MatrixIsEqual(product, m_mul));
+  EXPECT_THROW(matrix + matrix.Transpose() * 2.0, Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixFixedTest, TestConstexprKernels) {
+  constexpr FixedMatrix<3, 3> matrix({{2, 5, 7}, {6, 3, 4}, {5, -2, -3}});
+  static_assert(matrix.Determinant() == -1, "determinant at compile time");
+  constexpr FixedMatrix<3, 3> inverse = matrix.InverseMatrix();
+  static_assert(inverse(0, 0) == 1 && inverse(2, 2) == 24,
+                "inverse at compile time");
+  constexpr FixedMatrix<2, 3> lhs({{1, 2, 3}, {4, 5, 6}});
+  constexpr auto product = lhs * lhs.Transpose();
+  static_assert(product == FixedMatrix<2, 2>({{14, 32}, {32, 77}}),
+                "product at compile time");
+  static_assert(sizeof(FixedMatrix<4, 4>) == 16 * sizeof(double),
+                "storage is inline");
+  double m[3][3] = {{-1, 1, -1}, {38, -41, 34}, {-27, 29, -24}};
+  EXPECT_TRUE(MatrixIsEqual(Matrix(matrix.CalcComplements().Transpose()), m));
+}
+
+TEST(MatrixFixedTest, TestMatchesDynamic) {
+  FixedMatrix<2, 2> fixed_2({{3, -1}, {2, 5}});
+  FixedMatrix<4, 4> fixed_4(
+      {{4, 1, 0, 2}, {1, 3, -1, 0}, {0, 2, 5, 1}, {3, 0, 1, 6}});
+  FixedMatrix<5, 5> fixed_5({{6, 1, 0, 2, 1},
+                             {1, 7, -1, 0, 3},
+                             {0, 2, 5, 1, 0},
+                             {3, 0, 1, 8, 2},
+                             {1, 1, 0, 2, 9}});
+  EXPECT_EQ(fixed_2.Determinant(), 17);
+  EXPECT_NEAR(fixed_4.Determinant(), Matrix(fixed_4).Determinant(), 1e-9);
+  EXPECT_NEAR(fixed_5.Determinant(), Matrix(fixed_5).Determinant(), 1e-9);
+  Matrix inverse_4 = Matrix(fixed_4).InverseMatrix();
+  Matrix inverse_5 = Matrix(fixed_5).InverseMatrix();
+  FixedMatrix<4, 4> fixed_inverse_4 = fixed_4.InverseMatrix();
+  FixedMatrix<5, 5> fixed_inverse_5 = fixed_5.InverseMatrix();
+  for (size_t i = 0; i != 4; ++i)
+    for (size_t j = 0; j != 4; ++j)
+      EXPECT_NEAR(fixed_inverse_4(i, j), inverse_4(i, j), 1e-12);
+  for (size_t i = 0; i != 5; ++i)
+    for (size_t j = 0; j != 5; ++j)
+      EXPECT_NEAR(fixed_inverse_5(i, j), inverse_5(i, j), 1e-12);
+  Matrix complements = Matrix(fixed_4).CalcComplements();
+  FixedMatrix<4, 4> fixed_complements = fixed_4.CalcComplements();
+  for (size_t i = 0; i != 4; ++i)
+    for (size_t j = 0; j != 4; ++j)
+      EXPECT_NEAR(fixed_complements(i, j), complements(i, j), 1e-9);
+  FixedMatrix<4, 4> singular;
+  EXPECT_EQ(singular.Determinant(), 0);
+  EXPECT_THROW(singular.InverseMatrix(), Matrix::ZeroDeterminant);
+  FixedMatrix<5, 5> singular_5;
+  EXPECT_THROW(singular_5.InverseMatrix(), Matrix::ZeroDeterminant);
+}
+
+TEST(MatrixFixedTest, TestMixedOperands) {
+  FixedMatrix<2, 2> fixed({{1, 2}, {3, 4}});
+  Matrix matrix(2, 2);
+  for (size_t i = 0; i != 2; ++i)
+    for (size_t j = 0; j != 2; ++j) matrix(i, j) = 1;
+  FixedMatrix<2, 2> sum = fixed + fixed * 2.0;
+  double m_sum[2][2] = {{3, 6}, {9, 12}};
+  EXPECT_TRUE(MatrixIsEqual(Matrix(sum), m_sum));
+  Matrix mixed = matrix + fixed - 2.0 * matrix;
+  double m_mixed[2][2] = {{0, 1}, {2, 3}};
+  EXPECT_TRUE(MatrixIsEqual(mixed, m_mixed));
+  Matrix product = fixed * matrix;
+  double m_mul[2][2] = {{3, 3}, {7, 7}};
+  EXPECT_TRUE(MatrixIsEqual(product, m_mul));
+  matrix += fixed;
+  double m_add[2][2] = {{2, 3}, {4, 5}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m_add));
+  FixedMatrix<2, 2> back(matrix);
+  EXPECT_EQ(back(1, 1), 5);
+  using Tall = FixedMatrix<3, 2>;
+  using Wide = FixedMatrix<2, 3>;
+  EXPECT_THROW(Tall{matrix}, Matrix::DifferentMatrixSize);
+  EXPECT_THROW(Wide{matrix}, Matrix::DifferentMatrixSize);
+  EXPECT_THROW(fixed(2, 0), std::out_of_range);
+  EXPECT_THROW(Matrix(3, 3) + fixed, Matrix::DifferentMatrixSize);
+}
+
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  size_t allocations = 0, deallocations = 0, bytes = 0;
+
+ private:
+  void* do_allocate(size_t size, size_t alignment) override {
+    ++allocations;
+    bytes += size;
+    return std::pmr::new_delete_resource()->allocate(size, alignment);
+  }
+  void do_deallocate(void* p, size_t size, size_t alignment) override {
+    ++deallocations;
+    bytes -= size;
+    std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+  }
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+TEST(MatrixResourceTest, TestExplicitResource) {
+  CountingResource resource;
+  {
+    Matrix matrix(3, 5, &resource);
+    EXPECT_EQ(matrix.getResource(), &resource);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&matrix(0, 0)) % Matrix::kAlignment,
+              0);
+    matrix.setRows(6);
+    matrix.setCols(9);
+    Matrix copy = matrix;
+    EXPECT_EQ(copy.getResource(), Matrix::DefaultResource());
+    Matrix moved = std::move(matrix);
+    EXPECT_EQ(moved.getResource(), &resource);
+    Matrix square(9, 9);
+    moved *= square;
+    EXPECT_EQ(moved.getResource(), &resource);
+    EXPECT_EQ(resource.allocations, 4);
+  }
+  EXPECT_EQ(resource.allocations, resource.deallocations);
+  EXPECT_EQ(resource.bytes, 0);
+}
+
+TEST(MatrixResourceTest, TestScopedResource) {
+  CountingResource outer, inner;
+  std::pmr::memory_resource* global = Matrix::DefaultResource();
+  {
+    Matrix::ResourceScope outer_scope(&outer);
+    Matrix matrix(3, 3);
+    {
+      Matrix::ResourceScope inner_scope(&inner);
+      EXPECT_EQ(Matrix::DefaultResource(), &inner);
+      double m[3][3] = {{2, 5, 7}, {6, 3, 4}, {5, -2, -3}};
+      for (size_t i = 0; i != 3; ++i)
+        for (size_t j = 0; j != 3; ++j) matrix(i, j) = m[i][j];
+      Matrix result = matrix * matrix + matrix.Transpose() * 2.0;
+      EXPECT_NEAR(matrix.Determinant(), -1, 1e-12);
+      EXPECT_EQ(result.getResource(), &inner);
+    }
+    EXPECT_EQ(Matrix::DefaultResource(), &outer);
+    EXPECT_EQ(matrix.getResource(), &outer);
+    EXPECT_EQ(outer.allocations, 1);
+    EXPECT_GT(inner.allocations, 2);
+    EXPECT_EQ(inner.allocations, inner.deallocations);
+  }
+  EXPECT_EQ(Matrix::DefaultResource(), global);
+  EXPECT_EQ(outer.allocations, outer.deallocations);
+}
+
+TEST(MatrixResourceTest, TestArena) {
+  CountingResource upstream;
+  std::pmr::monotonic_buffer_resource arena(1 << 16, &upstream);
+  {
+    Matrix::ResourceScope scope(&arena);
+    Matrix matrix(20, 20);
+    for (size_t i = 0; i != 20; ++i) matrix(i, i) = 2;
+    Matrix inverse = matrix.InverseMatrix();
+    EXPECT_EQ(inverse(7, 7), 0.5);
+    EXPECT_EQ(Matrix(matrix * inverse)(3, 3), 1);
+  }
+  size_t chunks = upstream.allocations;
+  EXPECT_GE(chunks, 1);
+  EXPECT_EQ(upstream.deallocations, 0);
+  arena.release();
+  EXPECT_EQ(upstream.deallocations, chunks);
+}
+
+class MatrixStrassenTest : public ::testing::Test {
+ protected:
+  void SetUp() override { cutoff_ = kernels::StrassenCutoff(); }
+  void TearDown() override { kernels::SetStrassenCutoff(cutoff_); }
+
+ private:
+  size_t cutoff_;
+};
+
+TEST_F(MatrixStrassenTest, TestPaddedShapesMatchNaive) {
+  const size_t shapes[][3] = {{64, 64, 64}, {67, 91, 45}, {33, 17, 129}};
+  kernels::SetStrassenCutoff(8);
+  for (const auto& shape : shapes) {
+    size_t m = shape[0], n = shape[1], k = shape[2];
+    Matrix matrix(m, k);
+    Matrix matrix_2(k, n);
+    for (size_t i = 0; i != m; ++i)
+      for (size_t j = 0; j != k; ++j) matrix(i, j) = (i * 7 + j * 3) % 11 - 5;
+    for (size_t i = 0; i != k; ++i)
+      for (size_t j = 0; j != n; ++j) matrix_2(i, j) = (i * 5 + j) % 13 - 6;
+    // Integer entries keep every Strassen intermediate exact
+    Matrix product = matrix * matrix_2;
+    for (size_t i = 0; i != m; ++i)
+      for (size_t j = 0; j != n; ++j) {
+        double expected = 0;
+        for (size_t p = 0; p != k; ++p)
+          expected += matrix(i, p) * matrix_2(p, j);
+        EXPECT_EQ(product(i, j), expected);
+      }
+  }
+}
+
+TEST_F(MatrixStrassenTest, TestWorkspaceFromScopedResource) {
+  const size_t n = 67;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i) matrix(i, (i * 5) % n) = 1;
+  kernels::SetStrassenCutoff(8);
+  CountingResource resource;
+  {
+    Matrix::ResourceScope scope(&resource);
+    Matrix product = matrix * matrix;
+    EXPECT_EQ(product(1, 25), 1);
+    // the product and one workspace holding the padded copies
+    EXPECT_EQ(resource.allocations, 2);
+  }
+  EXPECT_EQ(resource.allocations, resource.deallocations);
+  EXPECT_EQ(resource.bytes, 0);
+}
+
+TEST_F(MatrixStrassenTest, TestCutoffOptOut) {
+  const size_t n = 150;
+  Matrix matrix(n, n);
+  Matrix matrix_2(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      matrix(i, j) = std::sin(i * 0.37 + j * 0.11);
+      matrix_2(i, j) = std::cos(i * 0.05 - j * 0.23);
+    }
+  kernels::SetStrassenCutoff(0);
+  Matrix stable = matrix * matrix_2;
+  Matrix reference(n, n);
+  kernels::Gemm(n, n, n, 1.0, &matrix(0, 0), matrix.getStride(), 1,
+                &matrix_2(0, 0), matrix_2.getStride(), 1, 0.0,
+                &reference(0, 0), reference.getStride());
+  EXPECT_TRUE(stable == reference);
+  kernels::SetStrassenCutoff(16);
+  Matrix fast = matrix * matrix_2;
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      EXPECT_NEAR(fast(i, j), reference(i, j), 1e-10);
+}
+
+TEST(MatrixViewTest, TestBlocksShareStorage) {
+  Matrix matrix(4, 5);
+  for (size_t i = 0; i != 4; ++i)
+    for (size_t j = 0; j != 5; ++j) matrix(i, j) = i * 10 + j;
+  MatrixView block = matrix.block(1, 2, 2, 3);
+  EXPECT_EQ(block.getRows(), 2);
+  EXPECT_EQ(block.getCols(), 3);
+  EXPECT_EQ(block(1, 2), 24);
+  block(0, 0) = -1;
+  EXPECT_EQ(matrix(1, 2), -1);
+  EXPECT_EQ(matrix.row(3)(0, 4), 34);
+  EXPECT_EQ(matrix.col(4).getRows(), 4);
+  EXPECT_EQ(matrix.col(4)(2, 0), 24);
+  ConstMatrixView transposed = static_cast<const Matrix&>(matrix).transposed();
+  EXPECT_EQ(transposed.getRows(), 5);
+  EXPECT_EQ(transposed(4, 3), 34);
+  EXPECT_EQ(transposed.block(1, 1, 2, 2)(0, 1), 21);
+  EXPECT_THROW(matrix.block(3, 0, 2, 1), std::out_of_range);
+  EXPECT_THROW(matrix.row(4), std::out_of_range);
+  EXPECT_THROW(matrix.col(5), std::out_of_range);
+  EXPECT_THROW(block(2, 0), std::out_of_range);
+}
+
+TEST(MatrixViewTest, TestArithmeticThroughViews) {
+  Matrix matrix(3, 3);
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 3; ++j) matrix(i, j) = i * 3 + j;
+  matrix.row(0) = matrix.row(1) + matrix.row(2);
+  double m[3][3] = {{9, 11, 13}, {3, 4, 5}, {6, 7, 8}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m));
+  matrix.col(2) -= matrix.col(0) * 2.0;
+  matrix.block(1, 0, 2, 2) *= 10;
+  double m_2[3][3] = {{9, 11, -5}, {30, 40, -1}, {60, 70, -4}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m_2));
+  Matrix copy = matrix.transposed() + matrix;
+  double m_sum[3][3] = {{18, 41, 55}, {41, 80, 69}, {55, 69, -8}};
+  EXPECT_TRUE(MatrixIsEqual(copy, m_sum));
+  matrix.block(0, 0, 2, 2) = matrix.block(1, 1, 2, 2).transposed();
+  double m_3[3][3] = {{40, 70, -5}, {-1, -4, -1}, {60, 70, -4}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m_3));
+  EXPECT_THROW(matrix.row(0) += matrix.col(0), Matrix::DifferentMatrixSize);
+  EXPECT_THROW(matrix.row(0) = matrix, Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixViewTest, TestAssignFromOverlappingView) {
+  Matrix matrix(3, 3), other(3, 3);
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 3; ++j) {
+      matrix(i, j) = i * 3 + j + 1;
+      other(i, j) = i == j;
+    }
+  const Matrix original = matrix;
+  matrix = matrix.transposed();
+  EXPECT_TRUE(matrix == original.Transpose());
+  matrix = original;
+  matrix = matrix.transposed() + other;
+  EXPECT_TRUE(matrix == original.Transpose() + other);
+  matrix = original;
+  matrix += matrix.transposed();
+  EXPECT_TRUE(matrix == original + original.Transpose());
+  matrix = original;
+  matrix -= 2.0 * matrix.transposed();
+  EXPECT_TRUE(matrix == original - 2.0 * original.Transpose());
+
+  matrix = original;
+  matrix.view() = matrix.transposed();
+  EXPECT_TRUE(matrix == original.Transpose());
+  matrix = original;
+  MatrixView view = matrix.view();
+  view += view.transposed();
+  EXPECT_TRUE(matrix == original + original.Transpose());
+  matrix = original;
+  view -= view.transposed() * 2.0 - other;
+  EXPECT_TRUE(matrix == original - (2.0 * original.Transpose() - other));
+  // Shifted blocks of the same storage
+  matrix = original;
+  matrix.block(1, 0, 2, 3) = matrix.block(0, 0, 2, 3);
+  double m[3][3] = {{1, 2, 3}, {1, 2, 3}, {4, 5, 6}};
+  EXPECT_TRUE(MatrixIsEqual(matrix, m));
+}
+
+TEST(MatrixViewTest, TestProductAndDeterminant) {
+  Matrix matrix(5, 4);
+  for (size_t i = 0; i != 5; ++i)
+    for (size_t j = 0; j != 4; ++j) matrix(i, j) = (i * 3 + j * 7) % 5 + i;
+  Matrix gram = matrix.transposed() * matrix;
+  Matrix expected = matrix.Transpose() * matrix;
+  EXPECT_TRUE(gram == expected);
+  Matrix product = matrix.block(1, 1, 3, 2) * matrix.block(0, 2, 2, 2);
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 2; ++j)
+      EXPECT_EQ(product(i, j), matrix(i + 1, 1) * matrix(0, j + 2) +
+                                   matrix(i + 1, 2) * matrix(1, j + 2));
+  Matrix outer = matrix.col(0) * matrix.row(0);
+  EXPECT_EQ(outer.getRows(), 5);
+  EXPECT_EQ(outer(4, 3), matrix(4, 0) * matrix(0, 3));
+  Matrix square(3, 3);
+  square.block(0, 0, 3, 3) = matrix.block(2, 1, 3, 3);
+  EXPECT_EQ(matrix.block(2, 1, 3, 3).Determinant(), square.Determinant());
+  EXPECT_THROW(matrix.row(0) * matrix.row(1), Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixTransposeTest, TestInPlaceKeepsBuffer) {
+  const size_t shapes[][2] = {{67, 67}, {16, 24}, {40, 8}};
+  for (const auto& shape : shapes) {
+    size_t rows = shape[0], cols = shape[1];
+    Matrix matrix(rows, cols);
+    for (size_t i = 0; i != rows; ++i)
+      for (size_t j = 0; j != cols; ++j) matrix(i, j) = i * 0.5 - j * 3.0;
+    Matrix expected = matrix.Transpose();
+    const double* data = &matrix(0, 0);
+    matrix.TransposeInPlace();
+    EXPECT_EQ(&matrix(0, 0), data);
+    EXPECT_EQ(matrix.getRows(), cols);
+    EXPECT_EQ(matrix.getCols(), rows);
+    EXPECT_TRUE(matrix == expected);
+    matrix.TransposeInPlace();
+    EXPECT_TRUE(matrix == expected.Transpose());
+  }
+}
+
+TEST(MatrixTransposeTest, TestInPlaceGrowsWhenNeeded) {
+  Matrix matrix(3, 5);
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 5; ++j) matrix(i, j) = i * 5 + j;
+  matrix.TransposeInPlace();
+  double m[5][3] = {{0, 5, 10}, {1, 6, 11}, {2, 7, 12}, {3, 8, 13},
+                    {4, 9, 14}};
+  ASSERT_EQ(matrix.getRows(), 5);
+  for (size_t i = 0; i != 5; ++i)
+    for (size_t j = 0; j != 3; ++j) EXPECT_EQ(matrix(i, j), m[i][j]);
+  matrix.setCols(4);
+  EXPECT_EQ(matrix(4, 3), 0);
+}
+
+namespace {
+
+// Deterministic pattern with about one nonzero in eight
+Matrix SparsePattern(size_t rows, size_t cols, size_t seed) {
+  Matrix matrix(rows, cols);
+  for (size_t i = 0; i != rows; ++i)
+    for (size_t j = 0; j != cols; ++j) {
+      size_t hash = (i * 73 + j * 151 + seed * 31) % 64;
+      if (hash < 8) matrix(i, j) = (hash % 5) - 2.0 + 0.25 * (i % 3);
+    }
+  return matrix;
+}
+
+}  // namespace
+
+TEST(MatrixSparseTest, TestConstruction) {
+  SparseMatrix sparse(3, 4, {{2, 1, 5}, {0, 3, -1}, {2, 1, 2}, {0, 0, 4}});
+  EXPECT_EQ(sparse.getNonZeros(), 3);
+  EXPECT_EQ(sparse(2, 1), 7);
+  EXPECT_EQ(sparse(0, 3), -1);
+  EXPECT_EQ(sparse(1, 1), 0);
+  std::vector<size_t> offsets = {0, 2, 2, 3};
+  EXPECT_EQ(sparse.getRowOffsets(), offsets);
+  double m[3][4] = {{4, 0, 0, -1}, {0, 0, 0, 0}, {0, 7, 0, 0}};
+  EXPECT_TRUE(MatrixIsEqual(sparse.ToDense(), m));
+  Matrix dense = sparse.ToDense();
+  dense(1, 2) = 1e-12;
+  EXPECT_EQ(SparseMatrix(dense).getNonZeros(), 4);
+  EXPECT_EQ(SparseMatrix(dense, 1e-9).getNonZeros(), 3);
+  SparseMatrix transposed = sparse.Transpose();
+  EXPECT_TRUE(transposed.ToDense() == sparse.ToDense().Transpose());
+  EXPECT_THROW(SparseMatrix(2, 2, {{2, 0, 1}}), std::out_of_range);
+  EXPECT_THROW(sparse(3, 0), std::out_of_range);
+}
+
+TEST(MatrixSparseTest, TestProductsMatchDense) {
+  Matrix a = SparsePattern(57, 43, 1);
+  Matrix b = SparsePattern(43, 61, 2);
+  SparseMatrix sparse_a(a), sparse_b(b);
+  std::vector<double> x(43);
+  for (size_t i = 0; i != x.size(); ++i) x[i] = std::sin(i * 0.7);
+  std::vector<double> y = sparse_a * x;
+  for (size_t i = 0; i != 57; ++i) {
+    double expected = 0;
+    for (size_t j = 0; j != 43; ++j) expected += a(i, j) * x[j];
+    EXPECT_NEAR(y[i], expected, 1e-12);
+  }
+  Matrix expected = a * b;
+  EXPECT_TRUE(sparse_a * b == expected);
+  SparseMatrix product = sparse_a * sparse_b;
+  EXPECT_TRUE(product.ToDense() == expected);
+  for (size_t i = 0; i != product.getRows(); ++i)
+    for (size_t p = product.getRowOffsets()[i] + 1;
+         p < product.getRowOffsets()[i + 1]; ++p)
+      EXPECT_LT(product.getColumns()[p - 1], product.getColumns()[p]);
+  EXPECT_THROW(sparse_a * sparse_a, Matrix::DifferentMatrixSize);
+  EXPECT_THROW(sparse_a * a, Matrix::DifferentMatrixSize);
+  EXPECT_THROW(sparse_b * x, Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixSparseTest, TestDeterminant) {
+  const size_t n = 90;
+  Matrix dense = SparsePattern(n, n, 3);
+  // Zero diagonal forces row exchanges, the off-diagonal band keeps the
+  // matrix nonsingular
+  for (size_t i = 0; i != n; ++i) {
+    dense(i, i) = 0;
+    dense(i, (i + 1) % n) = 3 + i % 4;
+  }
+  SparseMatrix sparse(dense);
+  double expected = dense.Determinant();
+  EXPECT_NE(expected, 0);
+  EXPECT_NEAR(sparse.Determinant() / expected, 1, 1e-9);
+  double m[3][3] = {{0, 2, 0}, {3, 0, 0}, {0, 0, 4}};
+  Matrix small(3, 3);
+  for (size_t i = 0; i != 3; ++i)
+    for (size_t j = 0; j != 3; ++j) small(i, j) = m[i][j];
+  EXPECT_EQ(SparseMatrix(small).Determinant(), -24);
+  small(2, 2) = 0;
+  EXPECT_EQ(SparseMatrix(small).Determinant(), 0);
+  EXPECT_THROW(SparseMatrix(3, 4).Determinant(), Matrix::NotSquare);
+}
+
+namespace {
+
+// Batch of count n x n matrices with diagonally dominant and indefinite
+// members mixed
+MatrixBatch SampleBatch(size_t count, size_t n) {
+  MatrixBatch batch(count, n, n);
+  for (size_t b = 0; b != count; ++b)
+    for (size_t i = 0; i != n; ++i)
+      for (size_t j = 0; j != n; ++j)
+        batch(b, i, j) = std::sin(b * 1.3 + i * 0.7 + j * j * 0.11) +
+                         (i == (j + b) % n ? 2.0 + b % 3 : 0.0);
+  return batch;
+}
+
+}  // namespace
+
+TEST(MatrixBatchTest, TestRoundTripAndTranspose) {
+  MatrixBatch batch(11, 2, 3);
+  Matrix matrix(2, 3);
+  for (size_t i = 0; i != 2; ++i)
+    for (size_t j = 0; j != 3; ++j) matrix(i, j) = i * 3 + j + 1;
+  batch.setMatrix(9, matrix);
+  EXPECT_TRUE(batch.getMatrix(9) == matrix);
+  EXPECT_TRUE(batch.getMatrix(8) == Matrix(2, 3));
+  MatrixBatch transposed = batch.Transpose();
+  EXPECT_EQ(transposed.getRows(), 3);
+  EXPECT_TRUE(transposed.getMatrix(9) == matrix.Transpose());
+  EXPECT_THROW(batch.setMatrix(0, Matrix(3, 2)), Matrix::DifferentMatrixSize);
+  EXPECT_THROW(batch(11, 0, 0), std::out_of_range);
+  EXPECT_THROW(batch.getMatrix(11), std::out_of_range);
+}
+
+TEST(MatrixBatchTest, TestKernelsMatchMatrix) {
+  for (size_t n : {1, 3, 4, 7, 16}) {
+    const size_t count = 21;
+    MatrixBatch batch = SampleBatch(count, n);
+    MatrixBatch product = batch * batch.Transpose();
+    std::vector<double> determinants = batch.Determinant();
+    MatrixBatch inverse = batch.InverseMatrix();
+    ASSERT_EQ(determinants.size(), count);
+    for (size_t b = 0; b != count; ++b) {
+      Matrix matrix = batch.getMatrix(b);
+      Matrix expected = matrix * matrix.Transpose();
+      Matrix expected_inverse = matrix.InverseMatrix();
+      for (size_t i = 0; i != n; ++i)
+        for (size_t j = 0; j != n; ++j) {
+          EXPECT_NEAR(product(b, i, j), expected(i, j), 1e-12);
+          EXPECT_NEAR(inverse(b, i, j), expected_inverse(i, j), 1e-9);
+        }
+      double det = matrix.Determinant();
+      EXPECT_NEAR(determinants[b], det, 1e-9 * std::max(1.0, std::fabs(det)));
+    }
+  }
+}
+
+TEST(MatrixBatchTest, TestSingularAndShapes) {
+  MatrixBatch batch = SampleBatch(10, 3);
+  for (size_t j = 0; j != 3; ++j) batch(4, 2, j) = 2 * batch(4, 0, j);
+  std::vector<double> determinants = batch.Determinant();
+  EXPECT_NEAR(determinants[4], 0, 1e-12);
+  for (size_t j = 0; j != 3; ++j) batch(4, 2, j) = 0;
+  EXPECT_EQ(batch.Determinant()[4], 0);
+  EXPECT_THROW(batch.InverseMatrix(), Matrix::ZeroDeterminant);
+  EXPECT_THROW(MatrixBatch(4, 2, 3).Determinant(), Matrix::NotSquare);
+  EXPECT_THROW(batch * MatrixBatch(9, 3, 3), Matrix::DifferentMatrixSize);
+  EXPECT_THROW(batch * MatrixBatch(10, 2, 3), Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixElementTypeTest, TestIntegerDeterminantIsExact) {
+  // Product of unit triangular factors, determinant exactly 1 and an
+  // integer inverse
+  const size_t n = 6;
+  BasicMatrix<long long> lower(n, n), upper(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      if (i > j) lower(i, j) = (7 * i + 3 * j) % 11 - 5;
+      if (i < j) upper(i, j) = (5 * i + 2 * j) % 7 - 3;
+    }
+  for (size_t i = 0; i != n; ++i) lower(i, i) = upper(i, i) = 1;
+  BasicMatrix<long long> matrix = lower * upper;
+  EXPECT_EQ(matrix.Determinant(), 1);
+  BasicMatrix<long long> identity(n, n);
+  for (size_t i = 0; i != n; ++i) identity(i, i) = 1;
+  EXPECT_TRUE(matrix * matrix.InverseMatrix() == identity);
+  BasicMatrix<int> small(3, 3);
+  int values[] = {2, -3, 1, 2, 0, -1, 1, 4, 5};
+  for (size_t p = 0; p != 9; ++p) small(p / 3, p % 3) = values[p];
+  EXPECT_EQ(small.Determinant(), 49);
+  BasicMatrix<int> complements = small.CalcComplements();
+  EXPECT_EQ(complements(0, 0), 4);
+  EXPECT_EQ(complements(1, 2), -11);
+  EXPECT_THROW(small.InverseMatrix(), std::domain_error);
+  small(2, 0) = 4;
+  small(2, 1) = -6;
+  small(2, 2) = 2;
+  EXPECT_EQ(small.Determinant(), 0);
+  EXPECT_THROW(small.InverseMatrix(), Matrix::ZeroDeterminant);
+}
+
+TEST(MatrixElementTypeTest, TestComplementsByElimination) {
+  // Cofactors straight from the definition
+  auto cofactors = [](const BasicMatrix<long long>& matrix) {
+    const size_t n = matrix.getRows();
+    BasicMatrix<long long> result(n, n);
+    for (size_t s = 0; s != n; ++s)
+      for (size_t k = 0; k != n; ++k) {
+        BasicMatrix<long long> minor(n - 1, n - 1);
+        for (size_t i = 0, a = 0; i != n; ++i) {
+          if (i == s) continue;
+          for (size_t j = 0, b = 0; j != n; ++j)
+            if (j != k) minor(a, b++) = matrix(i, j);
+          ++a;
+        }
+        result(s, k) = (s + k) % 2 ? -minor.Determinant() : minor.Determinant();
+      }
+    return result;
+  };
+  const size_t n = 7;
+  BasicMatrix<long long> matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = (3 * i * i + 5 * j + 2 * i * j * j) % 13 - 6;
+  // A zero leading pivot forces a row swap
+  matrix(0, 0) = 0;
+  ASSERT_NE(matrix.Determinant(), 0);
+  EXPECT_TRUE(matrix.CalcComplements() == cofactors(matrix));
+  // Rank n - 1, the singular fallback
+  for (size_t j = 0; j != n; ++j) matrix(n - 1, j) = matrix(0, j) * 2;
+  ASSERT_EQ(matrix.Determinant(), 0);
+  EXPECT_TRUE(matrix.CalcComplements() == cofactors(matrix));
+  // Rank n - 2, every minor vanishes
+  for (size_t j = 0; j != n; ++j)
+    matrix(n - 2, j) = matrix(1, j) - matrix(0, j);
+  EXPECT_TRUE(matrix.CalcComplements() == BasicMatrix<long long>(n, n));
+
+  Matrix dense(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      dense(i, j) = std::cos(i * 0.9 + j * 0.4) + (i == j) * 2.0;
+  Matrix expected = dense.CalcComplements();
+  Matrix single(BasicMatrix<float>(dense).CalcComplements());
+  BasicMatrix<std::complex<double>> complex_matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) complex_matrix(i, j) = dense(i, j);
+  BasicMatrix<std::complex<double>> complex_complements =
+      complex_matrix.CalcComplements();
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      EXPECT_NEAR(single(i, j), expected(i, j), 1e-3);
+      EXPECT_NEAR(std::abs(complex_complements(i, j) - expected(i, j)), 0,
+                  1e-10);
+    }
+}
+
+TEST(MatrixElementTypeTest, TestSingularComplementsLarge) {
+  // Unit upper bidiagonal with the last row replaced by the first: rank
+  // n - 1 and cofactors of magnitude at most 1
+  const size_t n = 120;
+  BasicMatrix<long long> matrix(n, n);
+  for (size_t i = 0; i != n; ++i) {
+    matrix(i, i) = 1;
+    if (i + 1 != n) matrix(i, i + 1) = 1;
+  }
+  for (size_t j = 0; j != n; ++j) matrix(n - 1, j) = matrix(0, j);
+  auto start = std::chrono::steady_clock::now();
+  BasicMatrix<long long> complements = matrix.CalcComplements();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  // A determinant per minor takes seconds here
+  EXPECT_LT(elapsed.count(), 1.0);
+  ASSERT_EQ(complements.getRows(), n);
+  // A * adj(A) = det(A) * I = 0, adj(A) = C^T
+  BasicMatrix<long long> product = matrix * complements.Transpose();
+  EXPECT_TRUE(product == BasicMatrix<long long>(n, n));
+  BasicMatrix<long long> minor(n - 1, n - 1);
+  for (size_t i = 0; i + 1 != n; ++i)
+    for (size_t j = 0; j + 1 != n; ++j) minor(i, j) = matrix(i, j + 1);
+  EXPECT_EQ(complements(n - 1, 0), (n % 2 ? 1 : -1) * minor.Determinant());
+  EXPECT_NE(complements(n - 1, 0), 0);
+
+  // A zero column stops floating point elimination at rank n - 1 too,
+  // small enough for the cofactors to stay within float range
+  const size_t m = 30;
+  BasicMatrix<std::complex<float>> complex_matrix(m, m);
+  Matrix dense(m, m);
+  for (size_t i = 0; i != m; ++i)
+    for (size_t j = 1; j != m; ++j)
+      complex_matrix(i, j) = dense(i, j) =
+          std::sin(i * 0.37 + j * 1.11) + (i == j) * 4.0;
+  Matrix expected = dense.CalcComplements();
+  BasicMatrix<std::complex<float>> complex_complements =
+      complex_matrix.CalcComplements();
+  double scale = std::fabs(expected(0, 0));
+  for (size_t i = 0; i != m; ++i)
+    for (size_t j = 0; j != m; ++j)
+      EXPECT_NEAR(std::abs(complex_complements(i, j) - float(expected(i, j))),
+                  0, 1e-4 * scale);
+}
+
+TEST(MatrixElementTypeTest, TestFloatMatchesDouble) {
+  const size_t n = 37;
+  Matrix matrix(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      matrix(i, j) = std::sin(i * 0.37 + j * 1.11) + (i == j) * 4.0;
+  BasicMatrix<float> single(matrix);
+  Matrix product = matrix * matrix;
+  Matrix single_product(single * single);
+  Matrix single_inverse(single.InverseMatrix());
+  Matrix inverse = matrix.InverseMatrix();
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      EXPECT_NEAR(single_product(i, j), product(i, j), 1e-4);
+      EXPECT_NEAR(single_inverse(i, j), inverse(i, j), 1e-5);
+    }
+  double det = matrix.Determinant();
+  EXPECT_NEAR(single.Determinant(), det, std::fabs(det) * 1e-4);
+  BasicMatrix<float> sum = single + single - 0.5f * single;
+  EXPECT_FLOAT_EQ(sum(3, 5), 1.5f * single(3, 5));
+  EXPECT_THROW(BasicMatrix<float>(2, 3).Determinant(), Matrix::NotSquare);
+  EXPECT_THROW(single + BasicMatrix<float>(n, n + 1),
+               Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixElementTypeTest, TestComplex) {
+  using Complex = std::complex<double>;
+  BasicMatrix<Complex> matrix(2, 2);
+  matrix(0, 0) = matrix(1, 1) = Complex(0, 1);
+  matrix(0, 1) = matrix(1, 0) = 1;
+  Complex det = matrix.Determinant();
+  EXPECT_NEAR(det.real(), -2, 1e-12);
+  EXPECT_NEAR(det.imag(), 0, 1e-12);
+  BasicMatrix<Complex> identity = matrix * matrix.InverseMatrix();
+  for (size_t i = 0; i != 2; ++i)
+    for (size_t j = 0; j != 2; ++j)
+      EXPECT_NEAR(std::abs(identity(i, j) - Complex(i == j)), 0, 1e-12);
+  BasicMatrix<Complex> transposed = matrix.Transpose();
+  transposed.setCols(3);
+  EXPECT_EQ(transposed(1, 1), Complex(0, 1));
+  EXPECT_EQ(transposed(1, 2), Complex(0));
+}
+
+namespace {
+
+Matrix SampleMatrix(size_t rows, size_t cols) {
+  Matrix matrix(rows, cols);
+  for (size_t i = 0; i != rows; ++i)
+    for (size_t j = 0; j != cols; ++j) matrix(i, j) = i * 1.5 - j * 0.25;
+  return matrix;
+}
+
+}  // namespace
+
+TEST(MatrixFileTest, TestSaveAndMap) {
+  const std::string path = testing::TempDir() + "matrix_file_test.bin";
+  Matrix matrix = SampleMatrix(13, 11);
+  matrix.save(path, true);
+  Matrix mapped = Matrix::mmap(path);
+  EXPECT_TRUE(mapped == matrix);
+  EXPECT_NE(mapped.getResource(), Matrix::DefaultResource());
+  EXPECT_TRUE(Matrix::mmap(path, Matrix::MapMode::kReadOnly, true) == matrix);
+  // Reallocating operations leave the mapping
+  mapped.MulMatrix(matrix.Transpose());
+  EXPECT_TRUE(mapped == matrix * matrix.Transpose());
+
+  Matrix private_copy = Matrix::mmap(path, Matrix::MapMode::kCopyOnWrite);
+  private_copy(2, 3) = 100;
+  private_copy += matrix;
+  EXPECT_EQ(private_copy(2, 3), 100 + matrix(2, 3));
+  EXPECT_TRUE(Matrix::mmap(path) == matrix);
+
+  Matrix empty(0, 0);
+  empty.save(path);
+  Matrix mapped_empty = Matrix::mmap(path);
+  EXPECT_EQ(mapped_empty.getRows(), 0);
+  std::remove(path.c_str());
+}
+
+TEST(MatrixFileTest, TestMappedOutlivesFile) {
+  const std::string path = testing::TempDir() + "matrix_file_unlink.bin";
+  Matrix matrix = SampleMatrix(4, 9);
+  matrix.save(path);
+  Matrix mapped = Matrix::mmap(path);
+  std::remove(path.c_str());
+  Matrix moved = std::move(mapped);
+  EXPECT_TRUE(moved == matrix);
+  EXPECT_TRUE(moved.Transpose() == matrix.Transpose());
+}
+
+TEST(MatrixFileTest, TestReadOnlyMappingIsCopiedOnWrite) {
+  const std::string path = testing::TempDir() + "matrix_file_readonly.bin";
+  const Matrix matrix = SampleMatrix(3, 5);
+  matrix.save(path);
+  Matrix wider = Matrix::mmap(path), narrower = Matrix::mmap(path);
+  wider.setCols(6);
+  narrower.setCols(3);
+  EXPECT_EQ(wider(2, 5), 0);
+  EXPECT_EQ(wider(2, 4), matrix(2, 4));
+  EXPECT_EQ(narrower(2, 2), matrix(2, 2));
+  Matrix taller = Matrix::mmap(path), copied = Matrix::mmap(path);
+  taller.setRows(4);
+  copied = matrix;
+  EXPECT_TRUE(copied.EqMatrix(matrix));
+  // Storage taken over from the mapping belongs to the matrix from then on
+  for (const Matrix* m : {&wider, &narrower, &taller, &copied}) {
+    EXPECT_FALSE(m->isMapped());
+    EXPECT_EQ(m->getResource(), Matrix::DefaultResource());
+  }
+  const double* storage = copied.view().data();
+  const Matrix smaller = SampleMatrix(2, 5);
+  copied = smaller;
+  EXPECT_EQ(copied.view().data(), storage);
+
+  Matrix sum = Matrix::mmap(path), difference = Matrix::mmap(path);
+  sum += matrix;
+  difference -= 2 * matrix;
+  EXPECT_TRUE(sum.EqMatrix(2 * matrix));
+  EXPECT_TRUE(difference.EqMatrix(-1 * matrix));
+  Matrix scaled = Matrix::mmap(path), assigned = Matrix::mmap(path);
+  scaled *= 3;
+  assigned = matrix + matrix;
+  EXPECT_TRUE(scaled.EqMatrix(3 * matrix));
+  EXPECT_TRUE(assigned.EqMatrix(2 * matrix));
+  Matrix transposed = Matrix::mmap(path);
+  transposed.TransposeInPlace();
+  EXPECT_TRUE(transposed.EqMatrix(matrix.Transpose()));
+
+  Matrix diagonal(3, 3);
+  for (size_t i = 0; i != 3; ++i) diagonal(i, i) = 2;
+  Matrix solved = Matrix::mmap(path);
+  diagonal.SolveInPlace(solved);
+  EXPECT_TRUE(solved.EqMatrix(0.5 * matrix));
+  EXPECT_TRUE(Matrix::mmap(path).EqMatrix(matrix));
+  std::remove(path.c_str());
+}
+
+TEST(MatrixFileTest, TestRejectsBadFiles) {
+  const std::string path = testing::TempDir() + "matrix_file_bad.bin";
+  EXPECT_THROW(Matrix::mmap(path + ".missing"), std::system_error);
+  SampleMatrix(5, 5).save(path, true);
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(200);
+    file.put('\x7f');
+  }
+  EXPECT_NO_THROW(Matrix::mmap(path));
+  EXPECT_THROW(Matrix::mmap(path, Matrix::MapMode::kReadOnly, true),
+               std::runtime_error);
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.write("NOTMATRX", 8);
+  }
+  EXPECT_THROW(Matrix::mmap(path), std::runtime_error);
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << "MATRIX";
+  EXPECT_THROW(Matrix::mmap(path), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(MatrixFileTest, TestForeignByteOrder) {
+  const std::string path = testing::TempDir() + "matrix_file_swapped.bin";
+  Matrix matrix = SampleMatrix(3, 10);
+  matrix.save(path, true);
+  std::vector<char> bytes;
+  {
+    std::ifstream file(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(file),
+                 std::istreambuf_iterator<char>());
+  }
+  // Header fields after the magic are six 32-bit and five 64-bit words,
+  // the payload starts at byte 128
+  for (size_t p = 8; p != 32; p += 4) std::reverse(&bytes[p], &bytes[p + 4]);
+  for (size_t p = 32; p != 72; p += 8) std::reverse(&bytes[p], &bytes[p + 8]);
+  for (size_t p = 128; p != bytes.size(); p += 8)
+    std::reverse(&bytes[p], &bytes[p + 8]);
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      .write(bytes.data(), bytes.size());
+  Matrix loaded = Matrix::mmap(path, Matrix::MapMode::kReadOnly, true);
+  EXPECT_TRUE(loaded == matrix);
+  EXPECT_EQ(loaded.getResource(), Matrix::DefaultResource());
+  std::remove(path.c_str());
+}
+
+TEST(MatrixFileTest, TestOutOfCoreProduct) {
+  const std::string dir = testing::TempDir();
+  const std::string fst = dir + "ooc_fst.bin", snd = dir + "ooc_snd.bin",
+                    result = dir + "ooc_result.bin";
+  // Budgets from the smallest possible tiles to everything in one tile,
+  // the shapes leave partial tiles on every edge
+  for (size_t budget : {2560, 40000, 1 << 24}) {
+    Matrix a = SampleMatrix(37, 29), b = SampleMatrix(29, 45);
+    a.save(fst);
+    b.save(snd);
+    Matrix::MulMatrixFiles(fst, snd, result, budget);
+    Matrix product = Matrix::mmap(result), expected = a * b;
+    ASSERT_EQ(product.getRows(), 37);
+    ASSERT_EQ(product.getCols(), 45);
+    for (size_t i = 0; i != 37; ++i)
+      for (size_t j = 0; j != 45; ++j)
+        EXPECT_NEAR(product(i, j), expected(i, j), 1e-9);
+  }
+  // Short inner dimension and an empty one
+  Matrix a = SampleMatrix(50, 3), b = SampleMatrix(3, 70);
+  a.save(fst);
+  b.save(snd);
+  Matrix::MulMatrixFiles(fst, snd, result, 4096);
+  Matrix product = Matrix::mmap(result), expected = a * b;
+  for (size_t i = 0; i != 50; ++i)
+    for (size_t j = 0; j != 70; ++j)
+      EXPECT_NEAR(product(i, j), expected(i, j), 1e-9);
+  Matrix(4, 0).save(fst);
+  Matrix(0, 0).save(snd);
+  Matrix::MulMatrixFiles(fst, snd, result, 4096);
+  EXPECT_EQ(Matrix::mmap(result).getRows(), 4);
+  for (const std::string& path : {fst, snd, result}) std::remove(path.c_str());
+}
+
+TEST(MatrixFileTest, TestOutOfCoreErrors) {
+  const std::string dir = testing::TempDir();
+  const std::string fst = dir + "ooc_err_fst.bin",
+                    snd = dir + "ooc_err_snd.bin",
+                    result = dir + "ooc_err_result.bin";
+  SampleMatrix(4, 5).save(fst);
+  SampleMatrix(4, 5).save(snd);
+  EXPECT_THROW(Matrix::MulMatrixFiles(fst, snd, result, 1 << 20),
+               Matrix::DifferentMatrixSize);
+  SampleMatrix(5, 4).save(snd);
+  EXPECT_THROW(Matrix::MulMatrixFiles(fst, snd, result, 1000),
+               std::invalid_argument);
+  EXPECT_THROW(Matrix::MulMatrixFiles(fst, dir + "ooc_missing.bin", result,
+                                      1 << 20),
+               std::system_error);
+  for (const std::string& path : {fst, snd, result}) std::remove(path.c_str());
+}
+
+TEST(MatrixInstrumentTest, TestCountsOperations) {
+  using instrument::Op;
+  const size_t n = 16;
+  Matrix a = SampleMatrix(n, n), b = SampleMatrix(n, n);
+  instrument::Reset();
+  Matrix sum = Lazy(a) + Lazy(b) * 2.0;
+  sum.SumMatrix(a);
+  Matrix product = a * b;
+  instrument::Snapshot snapshot = instrument::Collect();
+  if (!instrument::kEnabled) {
+    EXPECT_EQ(snapshot[Op::kSum].calls, 0);
+    EXPECT_EQ(snapshot.allocations, 0);
+    return;
+  }
+  EXPECT_EQ(snapshot[Op::kEvaluate].calls, 1);
+  EXPECT_EQ(snapshot[Op::kSum].calls, 1);
+  EXPECT_EQ(snapshot[Op::kSum].flops, n * n);
+  EXPECT_EQ(snapshot[Op::kSum].bytes, 3 * n * n * sizeof(double));
+  EXPECT_EQ(snapshot[Op::kMulMatrix].calls, 1);
+  EXPECT_EQ(snapshot[Op::kMulMatrix].flops, 2 * n * n * n);
+  EXPECT_EQ(snapshot[Op::kConstruct].calls, 2);
+  EXPECT_EQ(snapshot.allocations, 2);
+  EXPECT_EQ(snapshot.allocated_bytes, 2 * n * n * sizeof(double));
+  EXPECT_STREQ(instrument::OpName(Op::kMulMatrix), "mul_matrix");
+}
+
+TEST(MatrixInstrumentTest, TestThreadsAndHook) {
+  using instrument::Op;
+  if (!instrument::kEnabled) GTEST_SKIP() << "built without MATRIX_INSTRUMENT";
+  Matrix a = SampleMatrix(8, 8);
+  instrument::Reset();
+  a.MulNumber(2);
+  std::thread worker([&a] {
+    Matrix copy(a);
+    copy.MulNumber(2);
+  });
+  worker.join();
+  std::vector<instrument::Snapshot> published;
+  instrument::SetHook([&published](const instrument::Snapshot& snapshot) {
+    published.push_back(snapshot);
+  });
+  instrument::Publish();
+  instrument::SetHook(nullptr);
+  ASSERT_EQ(published.size(), 1);
+  EXPECT_EQ(published[0][Op::kMulNumber].calls, 2);
+  EXPECT_EQ(published[0][Op::kCopy].calls, 1);
+  instrument::Reset();
+  EXPECT_EQ(instrument::Collect()[Op::kMulNumber].calls, 0);
+}
+
+namespace {
+
+// B * B^T + n * I with B well mixed, symmetric positive definite
+Matrix SpdMatrix(size_t n) {
+  Matrix b(n, n);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) b(i, j) = std::sin(i * 0.7 + j * 1.3);
+  Matrix result = b * b.Transpose();
+  for (size_t i = 0; i != n; ++i) result(i, i) += n;
+  return result;
+}
+
+}  // namespace
+
+TEST(MatrixCholeskyTest, TestFactorAndSolve) {
+  const size_t n = 150;
+  Matrix matrix = SpdMatrix(n);
+  Cholesky cholesky(matrix);
+  const Matrix& lower = cholesky.getLower();
+  Matrix product = lower * lower.Transpose();
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      if (j > i) {
+        EXPECT_EQ(lower(i, j), 0);
+      }
+      EXPECT_NEAR(product(i, j), matrix(i, j), 1e-9);
+    }
+  EXPECT_TRUE(matrix.CalcCholesky().EqMatrix(lower));
+  EXPECT_TRUE(matrix.IsPositiveDefinite());
+  // The determinant itself overflows at this size
+  EXPECT_TRUE(std::isinf(LU(matrix).Determinant()));
+  Matrix medium = SpdMatrix(40);
+  EXPECT_NEAR(Cholesky(medium).LogDeterminant(),
+              std::log(medium.Determinant()), 1e-9);
+  Matrix small = SpdMatrix(5);
+  EXPECT_NEAR(Cholesky(small).Determinant(), small.Determinant(),
+              1e-9 * small.Determinant());
+  Matrix rhs = SampleMatrix(n, 7);
+  Matrix residual = matrix * cholesky.Solve(rhs);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != 7; ++j)
+      EXPECT_NEAR(residual(i, j), rhs(i, j), 1e-9);
+  Matrix inverse = cholesky.InverseMatrix(), expected = matrix.InverseMatrix();
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      EXPECT_NEAR(inverse(i, j), expected(i, j), 1e-12);
+      EXPECT_EQ(inverse(i, j), inverse(j, i));
+    }
+}
+
+TEST(MatrixCholeskyTest, TestRejectsNotPositiveDefinite) {
+  Matrix indefinite(2, 2);
+  indefinite(0, 0) = 1;
+  indefinite(0, 1) = indefinite(1, 0) = 2;
+  indefinite(1, 1) = 1;
+  EXPECT_THROW(Cholesky{indefinite}, Matrix::NotPositiveDefinite);
+  EXPECT_FALSE(indefinite.IsPositiveDefinite());
+  Matrix asymmetric = SpdMatrix(3);
+  asymmetric(0, 2) += 1;
+  EXPECT_THROW(asymmetric.CalcCholesky(), Matrix::NotPositiveDefinite);
+  EXPECT_FALSE(Matrix(2, 3).IsPositiveDefinite());
+  EXPECT_THROW(Cholesky{Matrix(2, 3)}, Matrix::NotSquare);
+}
+
+TEST(MatrixCholeskyTest, TestSymmetricMatrix) {
+  const size_t n = 70;
+  Matrix dense = SpdMatrix(n);
+  SymmetricMatrix packed(dense);
+  EXPECT_EQ(packed.getSize(), n);
+  EXPECT_EQ(packed.getPacked().size(), n * (n + 1) / 2);
+  EXPECT_TRUE(packed.ToDense().EqMatrix(dense));
+  packed(3, 5) = 42;
+  EXPECT_EQ(packed(5, 3), 42);
+  EXPECT_THROW(packed(n, 0), std::out_of_range);
+  packed = SymmetricMatrix(dense);
+  EXPECT_NEAR(packed.Determinant() / dense.Determinant(), 1, 1e-9);
+  Matrix inverse = dense.InverseMatrix();
+  SymmetricMatrix packed_inverse = packed.InverseMatrix();
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j <= i; ++j)
+      EXPECT_NEAR(packed_inverse(i, j), inverse(i, j), 1e-12);
+  SymmetricMatrix other = packed;
+  other.SumMatrix(packed);
+  packed.MulNumber(2);
+  EXPECT_TRUE(other == packed);
+  other.SubMatrix(packed);
+  EXPECT_TRUE(other == SymmetricMatrix(n));
+  EXPECT_THROW(other.SumMatrix(SymmetricMatrix(2)),
+               Matrix::DifferentMatrixSize);
+  // Indefinite falls back to LU
+  SymmetricMatrix indefinite(2);
+  indefinite(0, 0) = indefinite(1, 1) = 1;
+  indefinite(0, 1) = 2;
+  EXPECT_NEAR(indefinite.Determinant(), -3, 1e-12);
+  SymmetricMatrix indefinite_inverse = indefinite.InverseMatrix();
+  EXPECT_NEAR(indefinite_inverse(0, 1), 2.0 / 3, 1e-12);
+  EXPECT_NEAR(indefinite_inverse(1, 1), -1.0 / 3, 1e-12);
+}
+
+namespace {
+
+Matrix TallMatrix(size_t rows, size_t cols) {
+  Matrix matrix(rows, cols);
+  for (size_t i = 0; i != rows; ++i)
+    for (size_t j = 0; j != cols; ++j)
+      matrix(i, j) = std::sin(i * 0.37 + j * 1.9) + (i == j);
+  return matrix;
+}
+
+}  // namespace
+
+TEST(MatrixQRTest, TestFactorsReproduceMatrix) {
+  for (bool pivoting : {false, true}) {
+    const size_t m = 150, n = 90;
+    Matrix matrix = TallMatrix(m, n);
+    QR qr(matrix, pivoting);
+    Matrix q = qr.getQ(), r = qr.getR();
+    ASSERT_EQ(q.getRows(), m);
+    ASSERT_EQ(q.getCols(), n);
+    Matrix product = q * r, gram = q.Transpose() * q;
+    const std::vector<size_t>& perm = qr.getPermutation();
+    for (size_t i = 0; i != m; ++i)
+      for (size_t j = 0; j != n; ++j)
+        EXPECT_NEAR(product(i, j), matrix(i, perm[j]), 1e-12);
+    for (size_t i = 0; i != n; ++i)
+      for (size_t j = 0; j != n; ++j) {
+        EXPECT_NEAR(gram(i, j), i == j, 1e-12);
+        if (j < i) {
+          EXPECT_EQ(r(i, j), 0);
+        }
+      }
+    if (pivoting) {
+      for (size_t i = 1; i != n; ++i)
+        EXPECT_GE(std::fabs(r(i - 1, i - 1)), std::fabs(r(i, i)));
+    }
+    EXPECT_EQ(qr.getRank(), n);
+  }
+  // Wide matrices factor too
+  Matrix wide = TallMatrix(40, 70);
+  QR qr(wide, true);
+  Matrix product = qr.getQ() * qr.getR();
+  for (size_t i = 0; i != 40; ++i)
+    for (size_t j = 0; j != 70; ++j)
+      EXPECT_NEAR(product(i, j), wide(i, qr.getPermutation()[j]), 1e-12);
+}
+
+TEST(MatrixQRTest, TestLeastSquares) {
+  const size_t m = 300, n = 70;
+  Matrix matrix = TallMatrix(m, n);
+  Matrix b(m, 3);
+  for (size_t i = 0; i != m; ++i)
+    for (size_t j = 0; j != 3; ++j) b(i, j) = std::cos(i * 0.2 + j);
+  // The residual is orthogonal to the columns: A^T * (A * X - B) = 0
+  Matrix x = matrix.LeastSquares(b);
+  Matrix residual = matrix * x - b;
+  Matrix normal = matrix.Transpose() * residual;
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != 3; ++j) EXPECT_NEAR(normal(i, j), 0, 1e-10);
+  Matrix pivoted = QR(matrix, true).LeastSquares(b);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != 3; ++j) EXPECT_NEAR(pivoted(i, j), x(i, j), 1e-10);
+  // Square and consistent: the exact solution
+  Matrix square = TallMatrix(n, n);
+  Matrix solution = square.LeastSquares(square * x);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != 3; ++j) EXPECT_NEAR(solution(i, j), x(i, j), 1e-9);
+  EXPECT_THROW(matrix.LeastSquares(Matrix(m - 1, 1)),
+               Matrix::DifferentMatrixSize);
+  EXPECT_THROW(matrix.Transpose().LeastSquares(Matrix(n, 1)),
+               Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixQRTest, TestRankDeficient) {
+  // The third column is the sum of the first two
+  const size_t m = 50;
+  Matrix matrix(m, 4);
+  for (size_t i = 0; i != m; ++i) {
+    matrix(i, 0) = std::sin(i * 0.5);
+    matrix(i, 1) = std::cos(i * 0.3);
+    matrix(i, 2) = matrix(i, 0) + matrix(i, 1);
+    matrix(i, 3) = i * 0.1;
+  }
+  QR qr(matrix, true);
+  EXPECT_EQ(qr.getRank(), 3);
+  EXPECT_THROW(matrix.LeastSquares(Matrix(m, 1)), Matrix::ZeroDeterminant);
+  Matrix x(4, 1);
+  x(0, 0) = 1;
+  x(1, 0) = -2;
+  x(3, 0) = 0.5;
+  Matrix b = matrix * x;
+  Matrix solution = qr.LeastSquares(b);
+  // Some basic solution, a single dependent column is left at zero
+  Matrix fitted = matrix * solution;
+  size_t zeros = 0;
+  for (size_t j = 0; j != 4; ++j) zeros += solution(j, 0) == 0;
+  EXPECT_EQ(zeros, 1);
+  for (size_t i = 0; i != m; ++i) EXPECT_NEAR(fitted(i, 0), b(i, 0), 1e-10);
+}
+
+TEST(MatrixGemmTest, TestTransposeFlags) {
+  const size_t m = 37, n = 29, k = 45;
+  Matrix a = SampleMatrix(m, k), b = TallMatrix(k, n);
+  Matrix a_t = a.Transpose(), b_t = b.Transpose();
+  Matrix c = TallMatrix(m, n);
+  Matrix expected = 2.5 * (a * b) - 0.5 * c;
+  for (bool transpose_a : {false, true})
+    for (bool transpose_b : {false, true}) {
+      Matrix result = c;
+      const double* storage = result.view().data();
+      Gemm(2.5, transpose_a ? a_t : a, transpose_a, transpose_b ? b_t : b,
+           transpose_b, -0.5, result);
+      EXPECT_EQ(result.view().data(), storage);
+      for (size_t i = 0; i != m; ++i)
+        for (size_t j = 0; j != n; ++j)
+          EXPECT_NEAR(result(i, j), expected(i, j), 1e-10);
+    }
+  // beta == 0 ignores what C held
+  Matrix result(m, n);
+  result(0, 0) = std::nan("");
+  Gemm(1, a, false, b, false, 0, result);
+  EXPECT_NEAR(result(0, 0), (a * b)(0, 0), 1e-10);
+  EXPECT_THROW(Gemm(1, a, true, b, false, 0, result),
+               Matrix::DifferentMatrixSize);
+  Matrix wide(m, n + 1);
+  EXPECT_THROW(Gemm(1, a, false, b, false, 0, wide),
+               Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixGemmTest, TestViewsAndAliasing) {
+  const size_t n = 24;
+  Matrix a = TallMatrix(n, n), b = SampleMatrix(n, n);
+  // Accumulates into a block of a larger matrix and into a transposed view
+  Matrix big(n + 5, n + 7);
+  Gemm(1, a, false, b, false, 1, big.block(2, 3, n, n));
+  Gemm(1, a, false, b, false, 1, big.block(2, 3, n, n));
+  Matrix columns(n, n);
+  Gemm(1, a, false, b, false, 0, columns.transposed());
+  Matrix product = a * b;
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j) {
+      EXPECT_NEAR(big(i + 2, j + 3), 2 * product(i, j), 1e-10);
+      EXPECT_NEAR(columns(j, i), product(i, j), 1e-10);
+    }
+  EXPECT_EQ(big(0, 0), 0);
+  EXPECT_EQ(big(n + 2, n + 3), 0);
+  // C is also an operand: a = a * a^T + a
+  Matrix expected = a * a.Transpose() + a;
+  Gemm(1, a, false, a, true, 1, a);
+  for (size_t i = 0; i != n; ++i)
+    for (size_t j = 0; j != n; ++j)
+      EXPECT_NEAR(a(i, j), expected(i, j), 1e-10);
+}
+
+TEST(MatrixRvalueTest, TestTemporariesLendStorage) {
+  const size_t n = 20;
+  Matrix a = TallMatrix(n, n), b = SampleMatrix(n, n);
+  Matrix expected = a;
+  expected.MulMatrix(b);
+  expected.SubMatrix(a);
+  expected.MulNumber(2);
+  Matrix product = a * b;
+  const double* storage = product.view().data();
+  Matrix result = 2 * (std::move(product) - a);
+  EXPECT_EQ(result.view().data(), storage);
+  EXPECT_TRUE(result.EqMatrix(expected));
+  // Temporary on the right: a - (a * b) is -(product - a)
+  Matrix other = a * b;
+  storage = other.view().data();
+  Matrix negated = a - std::move(other);
+  EXPECT_EQ(negated.view().data(), storage);
+  negated.MulNumber(-2);
+  EXPECT_TRUE(negated.EqMatrix(expected));
+  Matrix sum = (a * b) + (a * b) * 0.5;
+  Matrix lazy = a * b;
+  lazy = lazy + lazy * 0.5;
+  EXPECT_TRUE(sum.EqMatrix(lazy));
+  EXPECT_THROW(std::move(sum) + Matrix(n, n + 1),
+               Matrix::DifferentMatrixSize);
+}
+
+TEST(MatrixRvalueTest, TestMappedTemporariesAreOnlyRead) {
+  const std::string path = testing::TempDir() + "matrix_rvalue_mapped.bin";
+  const Matrix a = SampleMatrix(6, 6), b = TallMatrix(6, 6);
+  a.save(path);
+  EXPECT_TRUE((Matrix::mmap(path) + b).EqMatrix(a + b));
+  EXPECT_TRUE((b + Matrix::mmap(path)).EqMatrix(a + b));
+  EXPECT_TRUE((Matrix::mmap(path) - b).EqMatrix(a - b));
+  EXPECT_TRUE((b - Matrix::mmap(path)).EqMatrix(b - a));
+  EXPECT_TRUE((Matrix::mmap(path) + Matrix::mmap(path)).EqMatrix(a + a));
+  EXPECT_TRUE((Matrix::mmap(path) - Matrix(b)).EqMatrix(a - b));
+  EXPECT_TRUE((2.0 * Matrix::mmap(path)).EqMatrix(a * 2.0));
+  EXPECT_TRUE((Matrix::mmap(path) * 0.5).EqMatrix(a * 0.5));
+  EXPECT_TRUE(Matrix::mmap(path).EqMatrix(a));
+
+  Matrix assigned = Matrix::mmap(path);
+  assigned = b;
+  ASSERT_FALSE(assigned.isMapped());
+  const double* storage = assigned.view().data();
+  Matrix sum = std::move(assigned) + a;
+  EXPECT_EQ(sum.view().data(), storage);
+  EXPECT_TRUE(sum.EqMatrix(a + b));
+  std::remove(path.c_str());
+}
+
+TEST(MatrixRvalueTest, TestTemporaryReadThroughView) {
+  const Matrix a = TallMatrix(5, 5);
+  Matrix temporary = a;
+  Matrix difference = temporary.transposed() - std::move(temporary);
+  EXPECT_TRUE(difference.EqMatrix(a.Transpose() - a));
+  temporary = a;
+  Matrix sum = temporary.transposed() + std::move(temporary);
+  EXPECT_TRUE(sum.EqMatrix(a.Transpose() + a));
+}
+
+TEST(MatrixRvalueTest, TestAssignmentReusesBuffer) {
+  static_assert(std::is_nothrow_move_assignable<Matrix>::value);
+  static_assert(std::is_nothrow_move_constructible<Matrix>::value);
+  Matrix target = SampleMatrix(10, 12);
+  const double* storage = target.view().data();
+  Matrix same = TallMatrix(10, 12), smaller = TallMatrix(3, 5);
+  target = same;
+  EXPECT_EQ(target.view().data(), storage);
+  EXPECT_TRUE(target.EqMatrix(same));
+  target = smaller;
+  EXPECT_EQ(target.view().data(), storage);
+  EXPECT_TRUE(target.EqMatrix(smaller));
+  Matrix larger = TallMatrix(30, 30);
+  target = larger;
+  EXPECT_TRUE(target.EqMatrix(larger));
+  // Mapped storage is replaced, not written through
+  const std::string path = testing::TempDir() + "matrix_assign_mapped.bin";
+  SampleMatrix(3, 5).save(path);
+  Matrix mapped = Matrix::mmap(path);
+  mapped = smaller;
+  EXPECT_TRUE(mapped.EqMatrix(smaller));
+  EXPECT_TRUE(Matrix::mmap(path).EqMatrix(SampleMatrix(3, 5)));
+  std::remove(path.c_str());
+}
+
+TEST(MatrixRawAccessTest, TestAccessorsAgree) {
+  Matrix matrix = SampleMatrix(5, 11);
+  const Matrix& view = matrix;
+  for (size_t i = 0; i != 5; ++i) {
+    Span<const double> row = view.rowSpan(i);
+    ASSERT_EQ(row.size(), 11);
+    EXPECT_EQ(view.rowPtr(i), view.data() + i * view.getStride());
+    for (size_t j = 0; j != 11; ++j) {
+      EXPECT_EQ(view.atUnchecked(i, j), matrix(i, j));
+      EXPECT_EQ(row[j], matrix(i, j));
+    }
+  }
+  for (double& value : matrix.rowSpan(2)) value = -1;
+  matrix.atUnchecked(4, 10) = 7;
+  EXPECT_EQ(matrix(2, 0), -1);
+  EXPECT_EQ(matrix(2, 10), -1);
+  EXPECT_EQ(matrix(4, 10), 7);
+  BasicMatrix<int> integers(3, 4);
+  std::iota(integers.begin(), integers.end(), 0);
+  EXPECT_EQ(integers.atUnchecked(2, 1), 9);
+  EXPECT_EQ(integers.rowSpan(1)[3], 7);
+  EXPECT_EQ(integers.rowPtr(2), integers.data() + 8);
+}
+
+TEST(MatrixRawAccessTest, TestIterators) {
+  // 11 columns leave padding at the end of every row
+  Matrix matrix(6, 11);
+  ASSERT_GT(matrix.getStride(), matrix.getCols());
+  EXPECT_EQ(std::distance(matrix.begin(), matrix.end()), 66);
+  std::iota(matrix.begin(), matrix.end(), 0.0);
+  for (size_t i = 0; i != 6; ++i) {
+    for (size_t j = 0; j != 11; ++j) EXPECT_EQ(matrix(i, j), i * 11 + j);
+    EXPECT_EQ(matrix.rowPtr(i)[11], 0);
+  }
+  const Matrix& view = matrix;
+  EXPECT_EQ(std::accumulate(view.begin(), view.end(), 0.0), 65 * 66 / 2);
+  Matrix::const_iterator it = matrix.begin();
+  EXPECT_EQ(it[25], 25);
+  EXPECT_EQ(*(it + 25), matrix(2, 3));
+  EXPECT_EQ(*(view.end() - 1), 65);
+  EXPECT_EQ(view.end() - (it + 12), 54);
+  EXPECT_EQ(*(it + 30 - 19), 11);
+  EXPECT_TRUE(it < it + 11 && it + 11 <= view.end() && view.cend() > it);
+  std::sort(matrix.begin(), matrix.end(), std::greater<double>());
+  EXPECT_EQ(matrix(0, 0), 65);
+  EXPECT_EQ(matrix(5, 10), 0);
+  EXPECT_EQ(matrix.rowPtr(3)[11], 0);
+  std::reverse(matrix.begin(), matrix.end());
+  EXPECT_TRUE(std::is_sorted(view.begin(), view.end()));
+  Matrix no_rows(0, 5), no_cols(4, 0);
+  EXPECT_EQ(no_rows.begin(), no_rows.end());
+  EXPECT_EQ(no_cols.begin(), no_cols.end());
+}
+
+TEST(MatrixRawAccessTest, TestCheckedBuild) {
+  if (!MatrixBase::kChecked) GTEST_SKIP() << "built without MATRIX_CHECKED";
+  Matrix matrix(2, 3);
+  EXPECT_THROW(matrix.atUnchecked(2, 0), std::out_of_range);
+  EXPECT_THROW(matrix.atUnchecked(0, 3), std::out_of_range);
+  EXPECT_THROW(matrix.rowPtr(2), std::out_of_range);
+  EXPECT_THROW(matrix.rowSpan(0)[3], std::out_of_range);
+  EXPECT_THROW(*matrix.end(), std::out_of_range);
+  BasicMatrix<float> floats(2, 2);
+  EXPECT_THROW(floats.atUnchecked(0, 2), std::out_of_range);
+}
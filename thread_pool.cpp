@@ -0,0 +1,219 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t kDefaultGrainSize = 1 << 16;
+// Chunks per thread, more chunks give stealing room to balance load
+constexpr size_t kChunksPerThread = 4;
+
+// True on pool workers and on callers while they execute chunks, nested
+// parallel loops then run inline instead of waiting on the pool
+thread_local bool in_parallel_region = false;
+
+struct Job {
+  const std::function<void(size_t, size_t)>* body;
+  std::atomic<size_t> remaining;
+  std::mutex mutex;
+  std::condition_variable done;
+  std::exception_ptr error;
+};
+
+struct Task {
+  Job* job;
+  size_t begin, end;
+};
+
+class Pool {
+ public:
+  explicit Pool(size_t threads) : queues_(threads ? threads - 1 : 0) {
+    for (size_t i = 0; i != queues_.size(); ++i)
+      workers_.emplace_back([this, i] { workerLoop(i); });
+  }
+
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) worker.join();
+  }
+
+  size_t threads() const { return queues_.size() + 1; }
+
+  void run(size_t count, size_t chunk,
+           const std::function<void(size_t, size_t)>& body) {
+    Job job;
+    job.body = &body;
+    size_t tasks = (count + chunk - 1) / chunk;
+    job.remaining.store(tasks, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      pending_ += tasks;
+    }
+    size_t target = next_queue_.fetch_add(1, std::memory_order_relaxed);
+    for (size_t begin = 0; begin < count; begin += chunk) {
+      Queue& queue = queues_[target++ % queues_.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back({&job, begin, std::min(count, begin + chunk)});
+    }
+    wake_.notify_all();
+
+    in_parallel_region = true;
+    Task task{};
+    while (job.remaining.load(std::memory_order_acquire) != 0 &&
+           steal(queues_.size(), task))
+      execute(task);
+    in_parallel_region = false;
+
+    std::unique_lock<std::mutex> lock(job.mutex);
+    job.done.wait(lock, [&job] {
+      return job.remaining.load(std::memory_order_acquire) == 0;
+    });
+    if (job.error) std::rethrow_exception(job.error);
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Owner pops from the back of its deque, thieves take from the front
+  bool popOwn(size_t index, Task& task) {
+    Queue& queue = queues_[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(size_t self, Task& task) {
+    for (size_t offset = 1; offset <= queues_.size(); ++offset) {
+      Queue& queue = queues_[(self + offset) % queues_.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()) continue;
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  void execute(const Task& task) {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      --pending_;
+    }
+    Job* job = task.job;
+    std::exception_ptr error;
+    try {
+      (*job->body)(task.begin, task.end);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    // The owner may destroy the job as soon as remaining drops to zero, so
+    // the job is not touched after the lock is released
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (error && !job->error) job->error = error;
+    if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      job->done.notify_all();
+  }
+
+  void workerLoop(size_t index) {
+    in_parallel_region = true;
+    Task task{};
+    for (;;) {
+      if (popOwn(index, task) || steal(index, task)) {
+        execute(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_.wait(lock, [this] { return stop_ || pending_ != 0; });
+      if (stop_) return;
+    }
+  }
+
+  std::vector<Queue> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> next_queue_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  size_t pending_ = 0;
+  bool stop_ = false;
+};
+
+size_t resolveThreadCount(size_t count) {
+  if (count == 0) count = std::thread::hardware_concurrency();
+  return std::max<size_t>(count, 1);
+}
+
+size_t defaultThreadCount() {
+  const char* env = std::getenv("MATRIX_NUM_THREADS");
+  return resolveThreadCount(env ? std::strtoul(env, nullptr, 10) : 0);
+}
+
+std::atomic<size_t> grain_size{kDefaultGrainSize};
+
+std::unique_ptr<Pool>& pool() {
+  static std::unique_ptr<Pool> instance;
+  return instance;
+}
+
+std::atomic<size_t>& threadCount() {
+  static std::atomic<size_t> count{defaultThreadCount()};
+  return count;
+}
+
+std::mutex pool_mutex;
+
+Pool& activePool() {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  auto& instance = pool();
+  size_t threads = threadCount().load();
+  if (!instance || instance->threads() != threads)
+    instance = std::make_unique<Pool>(threads);
+  return *instance;
+}
+
+}  // namespace
+
+void ThreadPool::SetThreadCount(size_t count) {
+  threadCount().store(resolveThreadCount(count));
+}
+
+size_t ThreadPool::ThreadCount() { return threadCount().load(); }
+
+void ThreadPool::SetGrainSize(size_t grain) {
+  grain_size.store(std::max<size_t>(grain, 1));
+}
+
+size_t ThreadPool::GrainSize() { return grain_size.load(); }
+
+bool ThreadPool::shouldSplit(size_t count, size_t cost_per_item) {
+  return count > 1 && !in_parallel_region && ThreadCount() > 1 &&
+         count * cost_per_item >= 2 * GrainSize();
+}
+
+void ThreadPool::run(size_t count, size_t cost_per_item,
+                     const std::function<void(size_t, size_t)>& body) {
+  Pool& workers = activePool();
+  size_t threads = workers.threads();
+  size_t chunks = threads * kChunksPerThread;
+  size_t grain_items = GrainSize() / std::max<size_t>(cost_per_item, 1);
+  size_t chunk = std::max((count + chunks - 1) / chunks, grain_items);
+  chunk = std::max<size_t>(chunk, 1);
+  workers.run(count, chunk, body);
+}
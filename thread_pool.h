@@ -0,0 +1,42 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <cstddef>
+#include <functional>
+
+// Library-owned pool of worker threads. Each worker owns a task deque and
+// steals from the others when it runs dry; the thread calling ParallelFor
+// takes part in the work instead of blocking.
+class ThreadPool {
+ public:
+  // Number of threads used by parallel operations, including the calling
+  // thread. 0 selects std::thread::hardware_concurrency(). The default
+  // comes from the MATRIX_NUM_THREADS environment variable. Must not be
+  // called while matrix operations are running.
+  static void SetThreadCount(size_t count);
+  static size_t ThreadCount();
+
+  // Minimal amount of work (roughly flops or touched elements) handed to
+  // one task. Operations cheaper than that run on the calling thread.
+  static void SetGrainSize(size_t grain);
+  static size_t GrainSize();
+
+  // Calls body(begin, end) on disjoint subranges covering [0, count),
+  // where every item costs about cost_per_item units of work. Runs
+  // inline when the total is under the grain size, when one thread is
+  // configured or when called from inside another parallel region.
+  // The first exception thrown by body is rethrown here.
+  template <typename Body>
+  static void ParallelFor(size_t count, size_t cost_per_item, Body&& body) {
+    if (!shouldSplit(count, cost_per_item)) {
+      if (count) body(size_t(0), count);
+      return;
+    }
+    run(count, cost_per_item, std::ref(body));
+  }
+
+ private:
+  static bool shouldSplit(size_t count, size_t cost_per_item);
+  static void run(size_t count, size_t cost_per_item,
+                  const std::function<void(size_t, size_t)>& body);
+};
+#endif